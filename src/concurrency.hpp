@@ -0,0 +1,69 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  concurrency.hpp
+ *
+ *    Description:  Division of the threads among concurrent jobs
+ *
+ *        Created:  10/16/2026 06:48:12 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef CONCURRENCY_HPP
+#define CONCURRENCY_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <omp.h>
+
+/** Divides the threads available to the calling thread among concurrent jobs.
+ *
+ * Concurrent jobs may be nested, e.g. line search trials within seed
+ * candidates within cross-validation folds, and each job runs parallel loops
+ * over the sequences in turn. Every level divides the share of threads it was
+ * given, so that all levels together use as many threads as requested.
+ * Consequently, there are never more jobs than threads, and the nesting depth
+ * permitted by OpenMP is raised relative to the current level, so that the
+ * parallel loops within the jobs remain active at any depth.
+ *
+ * Use at most n_jobs as the number of threads of the parallel loop over the
+ * jobs, and call enter() at the start of each job. The nesting depth is
+ * restored when the object goes out of scope.
+ */
+struct ConcurrentJobs {
+  explicit ConcurrentJobs(size_t n_requested)
+      : n_threads(omp_get_max_threads()),
+        n_jobs(std::max<size_t>(1, std::min(n_requested, n_threads))),
+        max_levels(omp_get_max_active_levels()) {
+    if (n_jobs > 1)
+      omp_set_max_active_levels(
+          std::max(max_levels, omp_get_active_level() + 2));
+  };
+  ~ConcurrentJobs() {
+    if (n_jobs > 1)
+      omp_set_max_active_levels(max_levels);
+  };
+  ConcurrentJobs(const ConcurrentJobs &) = delete;
+  ConcurrentJobs &operator=(const ConcurrentJobs &) = delete;
+
+  /** Restrict the parallel loops of the calling job to its share of the
+   * threads of the current team. */
+  void enter() const {
+    const size_t team_size = omp_get_num_threads();
+    if (team_size > 1) {
+      const size_t idx = omp_get_thread_num();
+      omp_set_num_threads(n_threads / team_size
+                          + (idx < n_threads % team_size));
+    }
+  };
+
+  const size_t n_threads;
+  const size_t n_jobs;
+
+private:
+  const int max_levels;
+};
+
+#endif
@@ -3,11 +3,13 @@
 #include <iomanip>
 #include <fstream>
 #include <vector>
+#include <omp.h>
 #include <boost/filesystem.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/filter/bzip2.hpp>
 #include "../aux.hpp"
+#include "../concurrency.hpp"
 #include "analysis.hpp"
 #include "report.hpp"
 #include "../timer.hpp"
@@ -125,14 +127,14 @@ void check_data(const Data::Collection &collection,
           cout << "The first 3 sequences are:" << endl;
           size_t i = 0;
           for (auto &seq : dataset) {
-            cout << ">" << seq.definition << endl << seq.sequence << endl;
+            cout << seq << endl;
             if (++i >= 3)
               break;
           }
         }
         if (options.verbosity >= Verbosity::debug)
           for (auto &seq : dataset)
-            cout << ">" << seq.definition << endl << seq.sequence << endl;
+            cout << seq << endl;
       }
     }
 }
@@ -141,7 +143,8 @@ AnalysisResult train_evaluate(HMM &hmm, const Data::Collection &all_data,
                               const Data::Collection &training_data,
                               const Data::Collection &test_data,
                               const Options::HMM &options, bool do_training,
-                              bool relearning_phase = false) {
+                              bool relearning_phase = false,
+                              Training::Leaderboard *leaderboard = nullptr) {
   AnalysisResult result(hmm, options);
   // Define the learning and evaluation tasks
   Training::Tasks eval_tasks = hmm.define_training_tasks(options);
@@ -194,7 +197,8 @@ AnalysisResult train_evaluate(HMM &hmm, const Data::Collection &all_data,
     }
 
     if (not learn_tasks.empty())
-      result.training = hmm.train(training_data, learn_tasks, options);
+      result.training
+          = hmm.train(training_data, learn_tasks, options, leaderboard);
   }
 
   Evaluator evaluator(hmm);
@@ -357,6 +361,16 @@ HMM doit(const Data::Collection &all_data,
 
   hmm.switch_intermediate(options.store_intermediate);
 
+  // the models lacking the motif that is trained are the same across
+  // iterations and seeds, and when scoring multiple motifs against each other
+  // the same models lacking some of the motifs are evaluated repeatedly
+  shared_ptr<VariantCache> variant_cache;
+  if (options.multi_motif.variant_cache_size > 0) {
+    variant_cache = make_shared<VariantCache>(
+        options.multi_motif.variant_cache_size * 1024 * 1024);
+    hmm.use_variant_cache(variant_cache);
+  }
+
   // train background
   if (n_loaded == 0 and not options.objectives.empty()) {
     hmm.initialize_bg_with_bw(training_data, options);
@@ -463,45 +477,75 @@ HMM doit(const Data::Collection &all_data,
 
       vector<pair<string, HMM>> learned_models;
 
-      // seed and learn HMM parameters independently for each Plasma motif
+      // collect the Plasma motifs and all their wiggle variants
+      vector<pair<string, string>> candidates;  // motif and variant
       for (size_t seed_idx = 0; seed_idx < plasma_results.size(); seed_idx++) {
         string motif = plasma_results[seed_idx].motif;
-
-        cout << endl << "Training HMM for candidate motif " << motif_spec.name
-             << ":" << motif << endl;
-
         plasma_results[seed_idx].score = -numeric_limits<double>::infinity();
-
-        // consider all wiggle variants
         for (auto variant : generate_wiggle_variants(motif, options.wiggle,
-                                                     options.verbosity)) {
-          HMM model(hmm);
-          if (options.verbosity >= Verbosity::info and options.wiggle > 0)
-            cout << "Training HMM for Wiggle variant " << variant
-                 << " of candidate motif " << motif_spec.name << ":" << motif
-                 << endl;
-
-          if (options.extend > 0) {
-            if (options.verbosity >= Verbosity::info)
-              cout << "Extending seed by " << options.extend
-                   << " nucleotides of N." << endl;
-            variant = padding(options.extend) + variant
-                      + padding(options.extend);
-          }
+                                                     options.verbosity))
+          candidates.push_back(make_pair(motif, variant));
+      }
 
-          model.add_motif(variant, options.alpha, expected_seq_size,
-                          options.lambda, motif_spec.name,
-                          motif_spec.insertions, options.self_transition,
-                          options.left_padding, options.right_padding);
+      // seed and learn HMM parameters independently for each candidate;
+      // several candidates may be trained concurrently, in which case the
+      // threads are divided among them
+      const size_t n_candidates = candidates.size();
+      vector<AnalysisResult> candidate_results(n_candidates,
+                                               AnalysisResult(hmm, options));
+      vector<string> variants(n_candidates);
+      Training::Leaderboard leaderboard(options.abandon_margin);
+
+      const ConcurrentJobs jobs(
+          min<size_t>(options.n_parallel_candidates, n_candidates));
+#pragma omp parallel for schedule(dynamic, 1) num_threads(jobs.n_jobs) \
+    if (jobs.n_jobs > 1)
+      for (size_t idx = 0; idx < n_candidates; idx++) {
+        jobs.enter();
+
+        const string &motif = candidates[idx].first;
+        string variant = candidates[idx].second;
+
+        if (idx == 0 or candidates[idx - 1].first != motif)
+          cout << endl << "Training HMM for candidate motif "
+               << motif_spec.name << ":" << motif << endl;
+
+        HMM model(hmm);
+        if (options.verbosity >= Verbosity::info and options.wiggle > 0)
+          cout << "Training HMM for Wiggle variant " << variant
+               << " of candidate motif " << motif_spec.name << ":" << motif
+               << endl;
+
+        if (options.extend > 0) {
+          if (options.verbosity >= Verbosity::info)
+            cout << "Extending seed by " << options.extend
+                 << " nucleotides of N." << endl;
+          variant = padding(options.extend) + variant + padding(options.extend);
+        }
 
-          Options::HMM options_(options);
-          options_.label += "." + variant;
-          auto result = train_evaluate(model, all_data, training_data,
-                                       test_data, options_, training_necessary);
-          results.push_back(result);
+        model.add_motif(variant, options.alpha, expected_seq_size,
+                        options.lambda, motif_spec.name, motif_spec.insertions,
+                        options.self_transition, options.left_padding,
+                        options.right_padding);
+
+        Options::HMM options_(options);
+        options_.label += "." + variant;
+        candidate_results[idx]
+            = train_evaluate(model, all_data, training_data, test_data,
+                             options_, training_necessary, false,
+                             options.abandon_margin > 0 ? &leaderboard
+                                                        : nullptr);
+        variants[idx] = variant;
+      }
 
-          learned_models.push_back(make_pair(variant, model));
-        }
+      for (size_t idx = 0; idx < n_candidates; idx++) {
+        auto &result = candidate_results[idx];
+        results.push_back(result);
+        if (result.training.state.abandoned) {
+          if (options.verbosity >= Verbosity::info)
+            cout << "Discarding abandoned candidate " << variants[idx] << endl;
+        } else
+          learned_models.push_back(make_pair(variants[idx], result.model));
       }
 
       if (not options.multi_motif.accept_multiple) {
@@ -734,31 +778,46 @@ HMM doit(const Data::Collection &all_data,
       }
     }
   }
+  if (variant_cache and options.verbosity >= Verbosity::verbose)
+    cout << "Variant likelihood cache: " << variant_cache->hits << " hits, "
+         << variant_cache->misses << " misses." << endl;
   return hmm;
 }
 
 vector<HMM> cross_validation(const Data::Collection &all_data,
                              const Options::HMM &options, mt19937 &rng) {
-  vector<HMM> hmms;
-  for (size_t cross_validation_iteration = 0;
-       cross_validation_iteration < options.cross_validation_iterations;
-       cross_validation_iteration++) {
-    if (options.verbosity >= Verbosity::info
-        and options.cross_validation_iterations > 1)
-      cout << "Doing cross-validation " << (cross_validation_iteration + 1)
-           << " of " << options.cross_validation_iterations << "." << endl;
+  const size_t n_folds = options.cross_validation_iterations;
+
+  // the splits are drawn up front, so that they do not depend on the order in
+  // which the folds are processed
+  vector<CrossValidationSplit> splits;
+  for (size_t fold = 0; fold < n_folds; fold++)
+    splits.push_back(draw_cross_validation_split(
+        all_data, options.cross_validation_freq, rng));
+
+  // several folds may be processed concurrently, in which case the threads
+  // are divided among them
+  vector<HMM> hmms(n_folds, HMM(options.verbosity));
+  const ConcurrentJobs jobs(
+      min<size_t>(options.cross_validation_parallel, n_folds));
+#pragma omp parallel for schedule(dynamic, 1) num_threads(jobs.n_jobs) \
+    if (jobs.n_jobs > 1)
+  for (size_t fold = 0; fold < n_folds; fold++) {
+    jobs.enter();
+
+    if (options.verbosity >= Verbosity::info and n_folds > 1)
+      cout << "Doing cross-validation " << (fold + 1) << " of " << n_folds
+           << "." << endl;
 
     Options::HMM opt = options;
 
     if (options.cross_validation_freq < 1)
-      opt.label += ".cv" + to_string(cross_validation_iteration);
+      opt.label += ".cv" + to_string(fold);
 
     Data::Collection training_data, test_data;
-    prepare_cross_validation(all_data, training_data, test_data,
-                             options.cross_validation_freq, rng,
+    prepare_cross_validation(all_data, splits[fold], training_data, test_data,
                              options.verbosity);
-    HMM hmm = doit(all_data, training_data, test_data, opt);
-    hmms.push_back(hmm);
+    hmms[fold] = doit(all_data, training_data, test_data, opt);
   }
   return hmms;
 }
@@ -19,76 +19,97 @@ vector<string> get_paths(const vector<Specification::Set> &specs) {
   return paths;
 }
 
+CrossValidationSplit draw_cross_validation_split(
+    const Data::Collection &collection, double cross_validation_freq,
+    mt19937 &rng) {
+  CrossValidationSplit split;
+  split.all_training = cross_validation_freq == 1;
+  for (auto &contrast : collection) {
+    split.test.push_back({});
+    for (auto &dataset : contrast) {
+      vector<bool> is_test(dataset.sequences.size(), false);
+      if (not split.all_training)
+        for (size_t i = 0; i < is_test.size(); i++)
+          is_test[i]
+              = RandomDistribution::Probability(rng) >= cross_validation_freq;
+      split.test.back().push_back(is_test);
+    }
+  }
+  return split;
+}
+
 void prepare_cross_validation(const Data::Contrast &contrast,
+                              const vector<vector<bool>> &is_test,
                               Data::Contrast &training_data,
                               Data::Contrast &test_data,
-                              double cross_validation_freq,
-                              mt19937 &rng,
                               Verbosity verbosity) {
-  if (cross_validation_freq == 1)
-    training_data = contrast;
-  else {
-    for (auto &dataset : contrast) {
-      if (verbosity >= Verbosity::verbose)
-        cerr << "Splitting " << dataset.path << " into training and test data."
-             << endl;
-      Data::Set training, test;
-
-      training.sha1 = dataset.sha1;
-      test.sha1 = dataset.sha1;
-
-      training.path = dataset.path;
-      test.path = dataset.path;
-
-      training.motifs = dataset.motifs;
-      test.motifs = dataset.motifs;
-
-      training.contrast = dataset.contrast;
-      test.contrast = dataset.contrast;
-
-      for (auto &seq : dataset) {
-        double p = RandomDistribution::Probability(rng);
-        if (p >= cross_validation_freq) {
-          test.sequences.push_back(seq);
-          test.set_size += 1;
-          test.seq_size += seq.sequence.size();
-        } else {
-          training.sequences.push_back(seq);
-          training.set_size += 1;
-          training.seq_size += seq.sequence.size();
-        }
-      }
-      if (verbosity >= Verbosity::verbose) {
-        cerr << "Training data set size of " << dataset.path << " = "
-             << training.set_size << endl;
-        cerr << "Test data set size of " << dataset.path << " = "
-             << test.set_size << endl;
-      }
+  for (size_t set_idx = 0; set_idx < contrast.sets.size(); set_idx++) {
+    auto &dataset = contrast.sets[set_idx];
+    if (verbosity >= Verbosity::verbose)
+      cerr << "Splitting " << dataset.path << " into training and test data."
+           << endl;
+    Data::Set training, test;
+
+    training.sha1 = dataset.sha1;
+    test.sha1 = dataset.sha1;
+
+    training.path = dataset.path;
+    test.path = dataset.path;
 
-      training_data.sets.push_back(training);
-      training_data.seq_size += training.seq_size;
-      training_data.set_size += training.set_size;
+    training.motifs = dataset.motifs;
+    test.motifs = dataset.motifs;
 
-      test_data.sets.push_back(test);
-      test_data.seq_size += test.seq_size;
-      test_data.set_size += test.set_size;
+    training.contrast = dataset.contrast;
+    test.contrast = dataset.contrast;
+
+    // copies of the sequences share their contents with the originals
+    for (size_t i = 0; i < dataset.sequences.size(); i++) {
+      auto &seq = dataset.sequences[i];
+      if (is_test[set_idx][i]) {
+        test.sequences.push_back(seq);
+        test.set_size += 1;
+        test.seq_size += seq.size();
+      } else {
+        training.sequences.push_back(seq);
+        training.set_size += 1;
+        training.seq_size += seq.size();
+      }
+    }
+    if (verbosity >= Verbosity::verbose) {
+      cerr << "Training data set size of " << dataset.path << " = "
+           << training.set_size << endl;
+      cerr << "Test data set size of " << dataset.path << " = "
+           << test.set_size << endl;
     }
+
+    training_data.sets.push_back(training);
+    training_data.seq_size += training.seq_size;
+    training_data.set_size += training.set_size;
+
+    test_data.sets.push_back(test);
+    test_data.seq_size += test.seq_size;
+    test_data.set_size += test.set_size;
   }
 }
 
 void prepare_cross_validation(const Data::Collection &collection,
+                              const CrossValidationSplit &split,
                               Data::Collection &training_data,
                               Data::Collection &test_data,
-                              double cross_validation_freq,
-                              mt19937 &rng,
                               Verbosity verbosity) {
-  for (auto &contrast : collection) {
+  for (size_t contrast_idx = 0; contrast_idx < collection.contrasts.size();
+       contrast_idx++) {
+    auto &contrast = collection.contrasts[contrast_idx];
     Data::Contrast training, test;
-    training.name = contrast.name;
     test.name = contrast.name;
 
-    prepare_cross_validation(contrast, training, test, cross_validation_freq,
-                             rng, verbosity);
+    if (split.all_training)
+      training = contrast;
+    else {
+      training.name = contrast.name;
+      prepare_cross_validation(contrast, split.test[contrast_idx], training,
+                               test, verbosity);
+    }
 
     training_data.contrasts.push_back(training);
     training_data.seq_size += training.seq_size;
@@ -45,11 +45,25 @@ using Collection = Basic::Collection<Contrast>;
 using Seqs = std::vector<Seq>;
 }
 
+/** For each contrast and data set, which sequences belong to the test data of
+ * a cross-validation fold. */
+struct CrossValidationSplit {
+  bool all_training;
+  std::vector<std::vector<std::vector<bool>>> test;
+};
+
+/** Randomly assign each sequence to the training data with probability
+ * cross_validation_freq, and otherwise to the test data. */
+CrossValidationSplit draw_cross_validation_split(const Data::Collection &col,
+                                                 double cross_validation_freq,
+                                                 std::mt19937 &rng);
+
+/** Construct the training and test data of a cross-validation split. The
+ * sequences share their contents with those of the collection. */
 void prepare_cross_validation(const Data::Collection &col,
+                              const CrossValidationSplit &split,
                               Data::Collection &training_data,
                               Data::Collection &test_data,
-                              double cross_validation_freq,
-                              std::mt19937 &rng,
                               Verbosity verbosity);
 
 #endif
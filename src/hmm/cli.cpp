@@ -52,6 +52,7 @@ void gen_discrover_cli(size_t cols, string &config_path, Options::HMM &options,
   po::options_description multi_motif_options("Multiple motif mode options", cols);
   po::options_description mmie_options("MMIE options", cols);
   po::options_description linesearching_options("Line searching options", cols);
+  po::options_description stochastic_options("Stochastic gradient options", cols);
   po::options_description sampling_options("MCMC optimization options", cols);
   po::options_description termination_options("Termination options", cols);
 
@@ -189,10 +190,13 @@ void gen_discrover_cli(size_t cols, string &config_path, Options::HMM &options,
       "Note that, depending on the argument of --compress, the .viterbi, .bed, and .table files may be compressed, and require decompression for inspection.\n"
      ).c_str())
     ("threads", po::value(&options.n_threads), "Number of threads. If not given, as many are used as there are CPU cores on this machine.")
+    ("max_dp_memory", po::value(&options.max_dp_memory)->default_value(256), "Maximal memory in MB per thread for the forward and backward tables of a single sequence. Longer sequences are processed with checkpointing, needing memory proportional to the square root of their length.")
     ("time", po::bool_switch(&options.timing_information), "Output information about how long certain parts take to execute.")
     ("cv", po::value(&options.cross_validation_iterations)->default_value(0), "Number of cross validation iterations to do.")
     ("cv_freq", po::value(&options.cross_validation_freq)->default_value(0.9, "0.9"), "Fraction of data samples for training in cross validation.")
+    ("cv_par", po::value(&options.cross_validation_parallel)->default_value(1), "Number of cross validation iterations to process concurrently. The threads are divided among them, and all of them use the same copy of the sequences. Note that the progress output of concurrent iterations is interleaved.")
     ("nseq", po::value(&options.n_seq)->default_value(0), "Use only the first N sequences of each file. Use 0 to indicate all sequences.")
+    ("seqcache", po::value(&options.sequence_cache), "Directory for binary caches of the sequence files. When given, the encoded sequences of each FASTA file are stored there, and later runs on the same, unchanged file load them from the cache instead of parsing the file.")
     ("iter", po::value(&options.termination.max_iter)->default_value(1000), "Maximal number of iterations to perform in training. A value of 0 means no limit, and that the training is only terminated by the tolerance.")
     ("salt", po::value(&options.random_salt), "Seed for the pseudo random number generator (used e.g. for sequence shuffle generation and MCMC sampling). Set this to get reproducible results.")
     ("weight", po::bool_switch(&options.weighting), "When combining objective functions across multiple contrasts, combine values by weighting with the number of sequences per contrasts.")
@@ -205,9 +209,11 @@ void gen_discrover_cli(size_t cols, string &config_path, Options::HMM &options,
      "fr   \tFletcher-Reeves\n"
      "pr   \tPolak-Ribière\n"
      "hs   \tHestenes-Stiefel\n"
-     "dy   \tDai-Yuan")
+     "dy   \tDai-Yuan\n"
+     "lbfgs\tLimited-memory BFGS quasi-Newton method")
     ("cg_iter", po::value(&options.conjugate.restart_iteration)->default_value(0), "Number of iterations after which to reset conjugate gradient. Use 0 to never reset.")
     ("cg_thresh", po::value(&options.conjugate.restart_threshold)->default_value(0), "Threshold for gradient orthogonality (between 0 and 1) below which the conjugate gradient will be reset. Use 0 to never reset.")
+    ("lbfgs_mem", po::value(&options.conjugate.lbfgs_memory)->default_value(10), "Number of past iterations whose parameter and gradient differences are used by the L-BFGS method.")
     ;
 
   init_options.add_options()
@@ -216,6 +222,8 @@ void gen_discrover_cli(size_t cols, string &config_path, Options::HMM &options,
     ("alpha", po::value(&options.alpha)->default_value(0.03, "0.03"), "Probability of alternative nucleotides. The nucleotides not included in the IUPAC character will have this probability.")
     ("lambda", po::value(&options.lambda)->default_value(1), "Initial value for prior with which a motif is expected.")
     ("wiggle", po::value(&options.wiggle)->default_value(0), "For automatically determined seeds, consider variants shifted up- and downstream by up to the specified number of positions.")
+    ("candpar", po::value(&options.n_parallel_candidates)->default_value(1), "Number of automatically determined seeds and wiggle variants to train concurrently. The threads are divided among the concurrent trainings. Note that the progress output of concurrent trainings is interleaved.")
+    ("abandon", po::value(&options.abandon_margin)->default_value(0), "Stop training seeds and wiggle variants whose score after some number of iterations trails the best score of the other seeds and variants after as many iterations by more than this fraction of that best score. Seeds and variants that converged earlier count with their final score. With --candpar above 1, a seed or variant is only compared to those that already reached the same iteration, so which ones are stopped may depend on timing. Use 0 to train all seeds and variants to convergence.")
     ("extend", po::value(&options.extend)->default_value(0), "Extend seeds by this many Ns up- and downstream before HMM training.")
     ("padl", po::value(&options.left_padding)->default_value(0), "Add this many Ns upstream (to the left) of the seed.")
     ("padr", po::value(&options.right_padding)->default_value(0), "Add this many Ns downstream (to the right) of the seed.")
@@ -235,6 +243,7 @@ void gen_discrover_cli(size_t cols, string &config_path, Options::HMM &options,
     ("multiple", po::bool_switch(&options.multi_motif.accept_multiple), "Accept multiple motifs as long as the score increases. This can only be used with the objective function MICO.")
     ("relearn", po::value(&options.multi_motif.relearning)->default_value(Options::MultiMotif::Relearning::Full, "full"), "When accepting multiple motifs, whether and how to re-learn the model after a new motif is added. Choices: 'none', 'reest', 'full'.")
     ("resratio", po::value(&options.multi_motif.residual_ratio)->default_value(5.0), "Cutoff to discard new motifs in multi motif mode. The cutoff is applied on the ratio of conditional mutual information of the new motif and the conditions given the previous motifs. Must be non-negative. High values discard more motifs, and lead to less redundant motifs.")
+    ("varcache", po::value(&options.multi_motif.variant_cache_size)->default_value(256), "Memory in MB for caching the likelihoods of the sequences under models lacking some of the motifs. These are re-used across the iterations of training and across seeds, as only the motif being trained changes, when motifs are scored against the same previously accepted motifs, and when sampling changes only the motif. Use 0 to disable the cache.")
     ;
 
   mmie_options.add_options()
@@ -256,6 +265,14 @@ void gen_discrover_cli(size_t cols, string &config_path, Options::HMM &options,
     ("LSeta", po::value(&options.line_search.eta)->default_value(0.5, "0.5"), "The parameter η for the Moré-Thuente line search algorithm.")
     ("LSdelta", po::value(&options.line_search.delta)->default_value(0.66, "0.66"), "The parameter delta for the Moré-Thuente line search algorithm.")
     ("LSnum", po::value(&options.line_search.max_steps)->default_value(10, "10"), "How many gradient and function evaluation to perform maximally per line search.")
+    ("LSpar", po::value(&options.line_search.n_concurrent)->default_value(1), "How many step sizes to evaluate concurrently in each step of the line search. The additional step sizes are spread over the interval of uncertainty, and the threads are divided among the evaluations; there are no more concurrent evaluations than threads, e.g. per candidate when combined with --candpar. Concurrent evaluations count as one towards --LSnum.")
+    ;
+
+  stochastic_options.add_options()
+    ("batch", po::value(&options.stochastic.batch_size)->default_value(0), "Use stochastic gradient ascent on mini-batches of this many sequences instead of gradients over all sequences. The mini-batches are sampled from each data set in proportion to its size. Use 0 to always use all sequences.")
+    ("batchsteps", po::value(&options.stochastic.steps)->default_value(50), "Number of mini-batch steps per iteration. After each iteration the objective function is evaluated on all sequences for the termination criteria; if it did not improve, the iteration is undone and the step size is halved.")
+    ("batchrate", po::value(&options.stochastic.rate)->default_value(0.05, "0.05"), "Initial step size of the Adam method for mini-batch steps, in the space of log-transformed probabilities.")
+    ("svrg", po::bool_switch(&options.stochastic.svrg), "Reduce the variance of mini-batch gradients with the gradient on all sequences computed at the end of each iteration (SVRG).")
     ;
 
   termination_options.add_options()
@@ -292,6 +309,7 @@ void gen_discrover_cli(size_t cols, string &config_path, Options::HMM &options,
     .add(conjugate_options)
     .add(multi_motif_options)
     .add(mmie_options)
+    .add(stochastic_options)
     .add(sampling_options);
 
   hidden_options
@@ -26,7 +26,7 @@ ConditionalDecoder::ConditionalDecoder(const HMM &hmm_) : hmm(hmm_) {
 };
 
 void ConditionalDecoder::decode(std::ostream &os, const Data::Seq &seq) const {
-  const size_t n = seq.sequence.size();
+  const size_t n = seq.isequence.size();
   for (auto &group : emission_matrices)
     for (auto &matrix : group.second) {
       // TODO: handle indels in the motifs
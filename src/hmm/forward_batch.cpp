@@ -0,0 +1,336 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  forward_batch.cpp
+ *
+ *    Description:  Forward algorithm for batches of sequences processed in
+ *                  lock-step across SIMD lanes
+ *
+ *        Created:  10/16/2026 01:47:22 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "forward_batch.hpp"
+#include "workspace.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FORWARD_BATCH_X86 1
+#else
+#define FORWARD_BATCH_X86 0
+#endif
+
+using namespace std;
+
+namespace ForwardBatch {
+
+const size_t start_state = 0;
+
+enum class Lane { Emission, Separator, Done };
+
+/** The forward algorithm for W sequences. The state vectors are stored
+ * state-major, with the W lanes of a state being contiguous. */
+template <size_t W>
+inline __attribute__((always_inline)) void kernel(const Topology &topology,
+                                                  const Data::Seq *const *seqs,
+                                                  size_t n, double *log_likel) {
+  const size_t n_states = topology.n_states;
+  const size_t *pred_offset = topology.pred_offset.data();
+  const size_t *pred_state = topology.pred_state.data();
+  const double *pred_prob = topology.pred_prob.data();
+  const double *emission = topology.emission.data();
+
+  size_t len[W];
+  size_t max_len = 0;
+  for (size_t l = 0; l < W; l++) {
+    len[l] = l < n ? seqs[l]->isequence.size() : 0;
+    max_len = max(max_len, len[l]);
+  }
+
+  Workspace &workspace = Workspace::local();
+  workspace.previous.assign(n_states * W, 0);
+  workspace.current.assign(n_states * W, 0);
+  double *prev = workspace.previous.data();
+  double *cur = workspace.current.data();
+
+  double ll[W];
+  for (size_t l = 0; l < W; l++) {
+    ll[l] = 0;
+    prev[start_state * W + l] = 1;
+  }
+
+  Lane kind[W];
+  size_t offset[W];
+  double x[W], x_start[W], z[W];
+  for (size_t t = 0; t <= max_len; t++) {
+    // Lanes whose sequence ends at t are treated like separators, as the
+    // transition into the start state concludes the sequence.
+    for (size_t l = 0; l < W; l++) {
+      offset[l] = 0;
+      if (t > len[l])
+        kind[l] = Lane::Done;
+      else if (t == len[l] or seqs[l]->isequence(t) == empty_symbol)
+        kind[l] = Lane::Separator;
+      else {
+        kind[l] = Lane::Emission;
+        offset[l] = seqs[l]->isequence(t) * n_states;
+      }
+    }
+
+#pragma omp simd
+    for (size_t l = 0; l < W; l++)
+      x_start[l] = 0;
+    for (size_t e = pred_offset[start_state]; e < pred_offset[start_state + 1];
+         e++) {
+      const double *src = prev + pred_state[e] * W;
+      const double p = pred_prob[e];
+#pragma omp simd
+      for (size_t l = 0; l < W; l++)
+        x_start[l] += src[l] * p;
+    }
+
+#pragma omp simd
+    for (size_t l = 0; l < W; l++)
+      z[l] = 0;
+    for (size_t i = 0; i < n_states; i++) {
+#pragma omp simd
+      for (size_t l = 0; l < W; l++)
+        x[l] = 0;
+      for (size_t e = pred_offset[i]; e < pred_offset[i + 1]; e++) {
+        const double *src = prev + pred_state[e] * W;
+        const double p = pred_prob[e];
+#pragma omp simd
+        for (size_t l = 0; l < W; l++)
+          x[l] += src[l] * p;
+      }
+      double *dst = cur + i * W;
+#pragma omp simd
+      for (size_t l = 0; l < W; l++) {
+        dst[l] = x[l] * emission[offset[l] + i];
+        z[l] += dst[l];
+      }
+    }
+
+    for (size_t l = 0; l < W; l++)
+      if (kind[l] == Lane::Emission)
+        ll[l] += log(z[l]);
+      else {
+        if (kind[l] == Lane::Separator)
+          ll[l] += log(x_start[l]);
+        z[l] = 1;
+      }
+
+    for (size_t i = 0; i < n_states; i++) {
+      double *dst = cur + i * W;
+#pragma omp simd
+      for (size_t l = 0; l < W; l++)
+        dst[l] /= z[l];
+    }
+
+    for (size_t l = 0; l < W; l++)
+      if (kind[l] == Lane::Separator) {
+        for (size_t i = 0; i < n_states; i++)
+          cur[i * W + l] = 0;
+        cur[start_state * W + l] = 1;
+      }
+
+    swap(prev, cur);
+  }
+
+  for (size_t l = 0; l < n; l++)
+    log_likel[l] = ll[l];
+}
+
+/** The forward algorithm for W variants of the HMM on one sequence. The
+ * variants differ only in the states that they lack, so that the symbols are
+ * decoded and the emission probabilities looked up once for all lanes. A state
+ * missing from a variant is masked with a factor of zero; since the products
+ * and sums involving the other states are unaffected by this, the results are
+ * identical to those of the HMMs with these states removed. */
+template <size_t W>
+inline __attribute__((always_inline)) void variant_kernel(
+    const Topology &topology, const Data::Seq &seq, const double *keep,
+    double *log_likel) {
+  const size_t n_states = topology.n_states;
+  const size_t *pred_offset = topology.pred_offset.data();
+  const size_t *pred_state = topology.pred_state.data();
+  const double *pred_prob = topology.pred_prob.data();
+  const size_t len = seq.isequence.size();
+
+  Workspace &workspace = Workspace::local();
+  workspace.previous.assign(n_states * W, 0);
+  workspace.current.assign(n_states * W, 0);
+  double *prev = workspace.previous.data();
+  double *cur = workspace.current.data();
+
+  double ll[W];
+  for (size_t l = 0; l < W; l++) {
+    ll[l] = 0;
+    prev[start_state * W + l] = 1;
+  }
+
+  double x[W], x_start[W], z[W];
+  for (size_t t = 0; t <= len; t++) {
+    const size_t symbol = t < len ? seq.isequence(t) : empty_symbol;
+
+#pragma omp simd
+    for (size_t l = 0; l < W; l++)
+      x_start[l] = 0;
+    for (size_t e = pred_offset[start_state]; e < pred_offset[start_state + 1];
+         e++) {
+      const double *src = prev + pred_state[e] * W;
+      const double p = pred_prob[e];
+#pragma omp simd
+      for (size_t l = 0; l < W; l++)
+        x_start[l] += src[l] * p;
+    }
+
+    if (symbol == empty_symbol) {
+      // the transition into the start state concludes the sequence
+      for (size_t l = 0; l < W; l++)
+        ll[l] += log(x_start[l]);
+      fill(cur, cur + n_states * W, 0);
+#pragma omp simd
+      for (size_t l = 0; l < W; l++)
+        cur[start_state * W + l] = 1;
+      swap(prev, cur);
+      continue;
+    }
+
+    const double *emission = topology.emissions_of(symbol);
+#pragma omp simd
+    for (size_t l = 0; l < W; l++)
+      z[l] = 0;
+    for (size_t i = 0; i < n_states; i++) {
+#pragma omp simd
+      for (size_t l = 0; l < W; l++)
+        x[l] = 0;
+      for (size_t e = pred_offset[i]; e < pred_offset[i + 1]; e++) {
+        const double *src = prev + pred_state[e] * W;
+        const double p = pred_prob[e];
+#pragma omp simd
+        for (size_t l = 0; l < W; l++)
+          x[l] += src[l] * p;
+      }
+      const double e = emission[i];
+      const double *k = keep + i * W;
+      double *dst = cur + i * W;
+#pragma omp simd
+      for (size_t l = 0; l < W; l++) {
+        dst[l] = x[l] * e * k[l];
+        z[l] += dst[l];
+      }
+    }
+
+    for (size_t l = 0; l < W; l++)
+      ll[l] += log(z[l]);
+    for (size_t i = 0; i < n_states; i++) {
+      double *dst = cur + i * W;
+#pragma omp simd
+      for (size_t l = 0; l < W; l++)
+        dst[l] /= z[l];
+    }
+
+    swap(prev, cur);
+  }
+
+  for (size_t l = 0; l < W; l++)
+    log_likel[l] = ll[l];
+}
+
+/** Run variant_kernel<W> for up to W of the variants, starting with variant
+ * first. Unused lanes are filled with the complete HMM. */
+template <size_t W>
+inline __attribute__((always_inline)) void variant_chunk(
+    const Topology &topology, const Data::Seq &seq,
+    const vector<vector<bool>> &present, size_t first, double *log_likel) {
+  const size_t n_states = topology.n_states;
+  const size_t n = min(W, present.size() - first);
+  DPVector &keep = Workspace::local().keep;
+  keep.assign(n_states * W, 1);
+  for (size_t l = 0; l < n; l++)
+    for (size_t i = 0; i < n_states; i++)
+      keep[i * W + l] = present[first + l][i] ? 1 : 0;
+  double ll[W];
+  variant_kernel<W>(topology, seq, keep.data(), ll);
+  copy(ll, ll + n, log_likel + first);
+}
+
+#if FORWARD_BATCH_X86
+__attribute__((target("avx512f"))) void variant_chunk_avx512(
+    const Topology &topology, const Data::Seq &seq,
+    const vector<vector<bool>> &present, size_t first, double *log_likel) {
+  variant_chunk<8>(topology, seq, present, first, log_likel);
+}
+
+__attribute__((target("avx2"))) void variant_chunk_avx2(
+    const Topology &topology, const Data::Seq &seq,
+    const vector<vector<bool>> &present, size_t first, double *log_likel) {
+  variant_chunk<4>(topology, seq, present, first, log_likel);
+}
+
+__attribute__((target("avx512f"))) void log_likelihoods_avx512(
+    const Topology &topology, const Data::Seq *const *seqs, size_t n,
+    double *log_likel) {
+  kernel<8>(topology, seqs, n, log_likel);
+}
+
+__attribute__((target("avx2"))) void log_likelihoods_avx2(
+    const Topology &topology, const Data::Seq *const *seqs, size_t n,
+    double *log_likel) {
+  kernel<4>(topology, seqs, n, log_likel);
+}
+#endif
+
+size_t detect_width() {
+#if FORWARD_BATCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return 8;
+  if (__builtin_cpu_supports("avx2"))
+    return 4;
+#endif
+  return 0;
+}
+
+size_t width() {
+  static const size_t w = detect_width();
+  return w;
+}
+
+void log_likelihoods(const Topology &topology, const Data::Seq *const *seqs,
+                     size_t n, double *log_likel) {
+#if FORWARD_BATCH_X86
+  switch (width()) {
+    case 8:
+      log_likelihoods_avx512(topology, seqs, n, log_likel);
+      return;
+    case 4:
+      log_likelihoods_avx2(topology, seqs, n, log_likel);
+      return;
+  }
+#endif
+  for (size_t l = 0; l < n; l++)
+    kernel<1>(topology, seqs + l, 1, log_likel + l);
+}
+
+void variant_log_likelihoods(const Topology &topology, const Data::Seq &seq,
+                             const vector<vector<bool>> &present,
+                             double *log_likel) {
+  const size_t n = present.size();
+  size_t first = 0;
+#if FORWARD_BATCH_X86
+  // small numbers of variants do not fill the wider registers
+  const size_t w = width() == 8 and n <= 4 ? 4 : width();
+  for (; w == 8 and first < n; first += 8)
+    variant_chunk_avx512(topology, seq, present, first, log_likel);
+  for (; w == 4 and first < n; first += 4)
+    variant_chunk_avx2(topology, seq, present, first, log_likel);
+#endif
+  for (; first < n; first++)
+    variant_chunk<1>(topology, seq, present, first, log_likel);
+}
+}
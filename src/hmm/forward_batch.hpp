@@ -0,0 +1,56 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  forward_batch.hpp
+ *
+ *    Description:  Forward algorithm for batches of sequences processed in
+ *                  lock-step across SIMD lanes
+ *
+ *        Created:  10/16/2026 01:47:22 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef FORWARD_BATCH_HPP
+#define FORWARD_BATCH_HPP
+
+#include <vector>
+#include "basedefs.hpp"
+#include "topology.hpp"
+
+/** Scaled forward algorithm for several sequences at a time.
+ *
+ * As the number of states of the HMMs is small, the loops over states are too
+ * short to profit from vectorization. Instead, the sequences of a batch are
+ * assigned to the lanes of the vector registers, and are processed in
+ * lock-step. Sequences shorter than the longest one of the batch are masked
+ * once they end, and separator symbols are handled per lane.
+ *
+ * The arithmetic of each lane is identical to that of the scalar forward
+ * algorithm, so that the log likelihoods are bit-identical to those of
+ * HMM::compute_forward_scale.
+ */
+namespace ForwardBatch {
+/** The number of sequences processed in lock-step on this CPU; 8 with
+ * AVX-512, 4 with AVX2, and 0 if no supported instruction set is available,
+ * in which case the scalar algorithm has to be used. */
+size_t width();
+
+/** Compute the log likelihoods of n sequences, where n must not exceed
+ * width(). The results are written to log_likel. */
+void log_likelihoods(const Topology &topology, const Data::Seq *const *seqs,
+                     size_t n, double *log_likel);
+
+/** Compute the log likelihoods of one sequence under several variants of an
+ * HMM, each of which lacks some of its states; present[v][i] tells whether
+ * state i is part of variant v. The variants are assigned to the lanes of the
+ * vector registers, so that they are all evaluated in a single sweep over the
+ * sequence. The results are identical to those of the forward algorithm of
+ * the HMMs with the missing states removed, and are written to log_likel. */
+void variant_log_likelihoods(const Topology &topology, const Data::Seq &seq,
+                             const std::vector<std::vector<bool>> &present,
+                             double *log_likel);
+}
+
+#endif
@@ -58,7 +58,9 @@ HMM::HMM(const string &path, Verbosity verbosity_, double pseudo_count)
       emission(),
       pred(),
       succ(),
-      registration() {
+      topology(),
+      registration(),
+      variant_cache() {
   if (verbosity >= Verbosity::debug)
     cout << "Called HMM constructor 1." << endl;
   if (not boost::filesystem::exists(path))
@@ -88,7 +90,9 @@ HMM::HMM(const HMM &hmm, bool copy_deep)
       emission(hmm.emission),
       pred(hmm.pred),
       succ(hmm.succ),
-      registration(hmm.registration) {
+      topology(),
+      registration(hmm.registration),
+      variant_cache(hmm.variant_cache) {
   if (verbosity >= Verbosity::debug)
     cout << "Called HMM constructor 2." << endl;
   finalize_initialization();
@@ -106,7 +110,9 @@ HMM::HMM(Verbosity verbosity_, double pseudo_count_)
       emission(zero_matrix(n_states, n_emissions)),
       pred(),
       succ(),
-      registration() {
+      topology(),
+      registration(),
+      variant_cache() {
   if (verbosity >= Verbosity::debug)
     cout << "Called HMM constructor 3." << endl;
   Group special({Group::Kind::Special, "Special", {start_state}});
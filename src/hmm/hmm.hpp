@@ -72,13 +72,20 @@
 
 #include <boost/container/map.hpp>
 #include <boost/container/flat_map.hpp>
+#include <deque>
+#include <functional>
 #include <list>
+#include <random>
 #include <unordered_map>
 #include "association.hpp"
 #include "results.hpp"
 #include "hmm_options.hpp"
 #include "bitmask.hpp"
 #include "registration.hpp"
+#include "topology.hpp"
+#include "variant_cache.hpp"
+#include "viterbi.hpp"
+#include "workspace.hpp"
 #include "../verbosity.hpp"
 
 struct Gradient {
@@ -87,7 +94,64 @@ struct Gradient {
   matrix_t emission;
 };
 
+/** History of the limited-memory BFGS method. The parameter and gradient
+ * differences refer to the log-transformed transition and emission
+ * probabilities. */
+struct LBFGSHistory {
+  LBFGSHistory() : s(), y(), rho(), step(), gradient(), n_rejected(0){};
+  /** Recent pairs of parameter and gradient differences, oldest first. */
+  std::deque<Gradient> s, y;
+  /** For each pair 1 / (y . s) */
+  std::deque<double> rho;
+  /** Step of the last iteration, still waiting for its gradient difference */
+  Gradient step;
+  /** Gradient at the start of the last iteration */
+  Gradient gradient;
+  /** Number of pairs rejected for lack of positive curvature */
+  size_t n_rejected;
+};
+
+/** Compute the L-BFGS ascent direction with the two-loop recursion. */
+Gradient lbfgs_direction(const Gradient &gradient,
+                         const LBFGSHistory &history);
+/** Add the curvature pair of the last iteration to the L-BFGS history, given
+ * the gradient at the current parameters. */
+void update_lbfgs_history(LBFGSHistory &history, const Gradient &gradient,
+                          size_t memory, Verbosity verbosity);
+
+/** State of stochastic mini-batch gradient training. The Adam moments refer
+ * to the log-transformed transition and emission probabilities. */
+struct StochasticState {
+  StochasticState(unsigned int seed, double rate_)
+      : rng(seed),
+        rate(rate_),
+        m(),
+        v(),
+        t(0),
+        score(0),
+        gradient(),
+        evaluated(false),
+        n_batches(0){};
+  std::mt19937 rng;
+  /** Current Adam step size; halved when the full-data score decreases */
+  double rate;
+  /** Estimates of the first and second moments of the gradient */
+  Gradient m, v;
+  /** Number of Adam steps taken so far */
+  size_t t;
+  /** Score of the current model on the full data, and with SVRG also the
+   * gradient */
+  double score;
+  Gradient gradient;
+  /** Whether score and gradient refer to the current parameters */
+  bool evaluated;
+  /** Number of mini-batch gradient evaluations */
+  size_t n_batches;
+};
+
 class ConditionalDecoder;
+class SubHMM;
+struct PosteriorGradientContext;
 
 inline double scalar_product(const Gradient &gradient1,
                              const Gradient &gradient2) {
@@ -130,6 +194,9 @@ public:
   HMM(const std::string &path, Verbosity verbosity_,
       double pseudo_count_ = 1.0);
   HMM(const HMM &hmm, bool copy_deep = true);
+  HMM(HMM &&hmm) = default;
+  HMM &operator=(const HMM &hmm) = default;
+  HMM &operator=(HMM &&hmm) = default;
 
   using mask_sub_t = std::unordered_map<std::string, std::vector<size_t>>;
   using mask_t = std::unordered_map<std::string, mask_sub_t>;
@@ -169,8 +236,16 @@ protected:
   /** The indices of the successors of each state. */
   std::vector<std::vector<size_t>> succ;
 
+  /** Flat representation of pred, succ, and the parameters, used by the
+   * forward and backward algorithms. */
+  Topology topology;
+
   Registration registration;
 
+  /** Cache of log likelihoods under variants lacking some motifs; may be
+   * empty. */
+  std::shared_ptr<VariantCache> variant_cache;
+
   // -------------------------------------------------------------------------------------------
   // Initialization routines
   // -------------------------------------------------------------------------------------------
@@ -194,6 +269,10 @@ protected:
    * parameter consistency */
   void finalize_initialization();
 
+  /** Compile the topology used by the forward and backward algorithms.
+   * Has to be called whenever the parameters are changed. */
+  void compile_topology();
+
   /**  Check whether the motif is enriched in the desired samples */
   bool check_enrichment(const Data::Contrast &contrast, const matrix_t &counts,
                         size_t group_idx) const;
@@ -215,7 +294,8 @@ public:
   /** Perform HMM training. */
   Training::Result train(const Data::Collection &col,
                          const Training::Tasks &tasks,
-                         const Options::HMM &options);
+                         const Options::HMM &options,
+                         Training::Leaderboard *leaderboard = nullptr);
   /** Initialize HMM background with the Baum-Welch algorithm. */
   void initialize_bg_with_bw(const Data::Collection &col,
                              const Options::HMM &options);
@@ -223,15 +303,20 @@ public:
 protected:
   Training::Result train_inner(const Data::Collection &col,
                                const Training::Tasks &tasks,
-                               const Options::HMM &options);
+                               const Options::HMM &options,
+                               Training::Leaderboard *leaderboard);
 
   /** Perform iterative HMM training, using either:
    * a) re-estimation (expectation-maximization) or
    * b) gradient based.
+   * If a leaderboard is given, the score of the first task is reported to it
+   * after each iteration, and training is abandoned if it falls behind.
    **/
   Training::State iterative_training(const Data::Collection &col,
                                      const Training::Tasks &tasks,
-                                     const Options::HMM &options);
+                                     const Options::HMM &options,
+                                     Training::Leaderboard *leaderboard
+                                     = nullptr);
   /** Perform one iteration of iterative HMM training. */
   bool perform_training_iteration(const Data::Collection &col,
                                   const Training::Tasks &tasks,
@@ -239,15 +324,28 @@ protected:
                                   Training::State &ts,
                                   Gradient &prev_gradient,
                                   Gradient &prev_conjugate,
-                                  size_t &cg_niter);
+                                  size_t &cg_niter,
+                                  std::vector<LBFGSHistory> &lbfgs,
+                                  std::vector<StochasticState> &stochastic);
   /** Perform one iteration of gradient training. */
   bool perform_training_iteration_gradient(const Data::Collection &col,
                                            const Training::Task &task,
                                            const Options::HMM &options,
                                            int &center, double &score,
+                                           size_t &n_evaluations,
                                            Gradient &prev_gradient,
                                            Gradient &prev_conjugate,
-                                           size_t &cg_niter);
+                                           size_t &cg_niter,
+                                           LBFGSHistory &lbfgs);
+  /** Perform one iteration of stochastic mini-batch gradient training: a
+   * number of Adam steps on mini-batches, followed by an evaluation on the
+   * full data. */
+  bool perform_training_iteration_stochastic(const Data::Collection &col,
+                                             const Training::Task &task,
+                                             const Options::HMM &options,
+                                             double &score,
+                                             size_t &n_evaluations,
+                                             StochasticState &stochastic);
   /** Perform one iteration of re-estimation training. */
   bool perform_training_iteration_reestimation(const Data::Collection &col,
                                                const Training::Task &task,
@@ -351,21 +449,42 @@ protected:
     double log_likelihood;
     double posterior;
   };
-  struct posterior_gradient_t {
+  struct posterior_statistics_t {
     double log_likelihood;
+    /** The log likelihood under the model lacking the motifs */
+    double reduced_log_likelihood;
     double posterior;
-    matrix_t T;
-    matrix_t E;
   };
 
 public:
   vector_t posterior_atleast_one(const Data::Contrast &contrast,
                                  bitmask_t present) const;
   double viterbi(const Data::Seq &s, StatePath &path) const;
+  /** Pre-allocate the workspaces of all threads for the longest sequence of
+   * the collection. */
+  void reserve_workspaces(const Data::Collection &collection) const;
+  /** A Viterbi decoder for this HMM, to be reused across sequences.
+   * It is invalidated when the parameters of the HMM are changed. */
+  Viterbi viterbi_decoder() const;
   posterior_t posterior_atleast_one(const Data::Seq &seq,
                                     bitmask_t present) const;
   double expected_posterior(const Data::Seq &seq, bitmask_t present) const;
 
+  /** Posterior statistics of several motifs in one sequence. */
+  struct motif_posteriors_t {
+    double log_likelihood;
+    /** Probability of at least one occurrence of each motif. */
+    std::vector<double> posterior;
+    /** Expected number of occurrences of each motif. */
+    std::vector<double> expected;
+  };
+  /** Compute the posterior statistics of all given motif groups at once.
+   * This needs one forward-backward pass with the complete HMM, and a single
+   * fused forward sweep over the sequence for the HMMs lacking each one of the
+   * motifs. */
+  motif_posteriors_t motif_posteriors(const Data::Seq &seq,
+                                      const std::vector<size_t> &groups) const;
+
 protected:
   vector_t posterior_atleast_one(const Data::Set &dataset,
                                  bitmask_t present) const;
@@ -414,6 +533,18 @@ public:
   double log_likelihood(const Data::Collection &col) const;
   double log_likelihood(const Data::Contrast &contrast) const;
   double log_likelihood(const Data::Set &s) const;
+  /** The log likelihood of a sequence; uses the scale buffer of the thread's
+   * workspace. */
+  double log_likelihood(const Data::Seq &s) const;
+  /** The log likelihoods of all sequences of a data set. Uses the batched
+   * forward algorithm if the CPU supports it. */
+  std::vector<double> log_likelihoods(const Data::Set &s) const;
+  /** The log likelihoods of all sequences of a data set under the model
+   * lacking the motifs in present. They are taken from the variant cache if
+   * these were computed before for the same parameters of the other states,
+   * and added to it otherwise. */
+  VariantCache::values_t log_likelihoods_without(const Data::Set &s,
+                                                 bitmask_t present) const;
 
   double class_likelihood(const Data::Contrast &contrast, bitmask_t present,
                           bool compute_posterior) const;
@@ -479,25 +610,22 @@ protected:
   /** Perform one iteration of scaled Baum-Welch learning for a data collection */
   double BaumWelchIteration(matrix_t &T, matrix_t &E,
                             const Data::Collection &col,
-                            const Training::Targets &targets,
-                            const Options::HMM &options) const;
+                            const Training::Targets &targets) const;
   /** Perform one iteration of scaled Baum-Welch learning for a data set */
   double BaumWelchIteration(matrix_t &T, matrix_t &E, const Data::Set &dataset,
-                            const Training::Targets &targets,
-                            const Options::HMM &options) const;
+                            const Training::Targets &targets) const;
   /** Perform one iteration of Viterbi learning for a data collection */
   double ViterbiIteration(matrix_t &T, matrix_t &E, const Data::Collection &col,
-                          const Training::Targets &targets,
-                          const Options::HMM &options);
+                          const Training::Targets &targets);
   /** Perform one iteration of Viterbi learning for a data set */
   double ViterbiIteration(matrix_t &T, matrix_t &E, const Data::Set &dataset,
-                          const Training::Targets &targets,
-                          const Options::HMM &options);
+                          const Training::Targets &targets);
 
+  /** Add the expected statistics of a single sequence to T and E.
+   *  Not synchronized; callers that run in parallel have to use separate
+   *  accumulators. */
   double BaumWelchIteration(matrix_t &T, matrix_t &E, const Data::Seq &s,
                             const Training::Targets &targets) const;
-  double BaumWelchIteration_single(matrix_t &T, matrix_t &E, const Data::Seq &s,
-                                   const Training::Targets &targets) const;
 
   // -------------------------------------------------------------------------------------------
   // Monte-Carlo Markov Chain inference
@@ -519,18 +647,30 @@ protected:
                                      const Training::Task &task,
                                      int &center) const;
   /** Perform gradient line searching with the Moré-Thuente algorithm and the
-   * desired objective function. */
+   * desired objective function, along the given direction, which need not be
+   * the gradient. The first trial step has length initial_step. The number
+   * of function and gradient evaluations is added to n_evaluations. */
   std::pair<double, HMM> line_search_more_thuente(
-      const Data::Collection &col, const Gradient &gradient, double score,
-      int &info, const Training::Task &task, const Options::HMM &options) const;
+      const Data::Collection &col, const Gradient &direction,
+      const Gradient &gradient, double initial_step, double score, int &info,
+      size_t &n_evaluations, const Training::Task &task,
+      const Options::HMM &options) const;
   /** Auxiliary routine to build candidate HMM for a step in a given direction
    * and a given step size. */
   HMM build_trial_model(const Gradient &gradient, double alpha,
                         const Training::Task &task) const;
+  /** The difference of the log-transformed parameters of the given model and
+   * this one, for the targets; the counterpart of build_trial_model(). */
+  Gradient log_parameter_step(const HMM &hmm,
+                              const Training::Targets &targets) const;
 
   /** Compute the gradient of the desired objective function */
   Gradient compute_gradient(const Data::Collection &col, double &score,
                             const Training::Task &task, bool weighting) const;
+  /** The score of the objective function of a task, as computed along with
+   * the gradient by compute_gradient(), but without the gradient */
+  double compute_score(const Data::Collection &col, const Training::Task &task,
+                       bool weighting) const;
   Gradient compute_gradient(const Data::Contrast &contrast, double &score,
                             const Training::Task &task) const;
   double compute_gradient(const Data::Contrast &contrast, Gradient &gradient,
@@ -542,26 +682,91 @@ protected:
   // -------------------------------------------------------------------------------------------
 
   /** The standard forward algorithm with scaling.
-   *  The scaling vector is also determined. */
-  matrix_t compute_forward_scaled(const Data::Seq &s, vector_t &scale) const;
-  /** Computes only the scaling vector of the standard forward algorithm with scaling. */
-  vector_t compute_forward_scale(const Data::Seq &s) const;
+   *  The scaling vector is also determined.
+   *  The results are written into f and scale, which are typically the
+   *  buffers of the thread's workspace. */
+  void compute_forward_scaled(const Data::Seq &s, DPMatrix &f,
+                              DPVector &scale) const;
+  /** Computes only the scaling vector of the standard forward algorithm with scaling.
+   *  Uses the previous and current buffers of the thread's workspace. */
+  void compute_forward_scale(const Data::Seq &s, DPVector &scale) const;
 
   /** The standard forward algorithm with pre-scaling.
    *  The scaling vector is assumed to be given. */
-  matrix_t compute_forward_prescaled(const Data::Seq &s,
-                                     const vector_t &scale) const;
+  void compute_forward_prescaled(const Data::Seq &s, const DPVector &scale,
+                                 DPMatrix &f) const;
   /** The standard backward algorithm with pre-scaling.
    *  The scaling vector is assumed to be given. */
-  matrix_t compute_backward_prescaled(const Data::Seq &s,
-                                      const vector_t &scale) const;
-
-  double likelihood_from_scale(const vector_t &scale) const;
-  double log_likelihood_from_scale(const vector_t &scale) const;
-
-  double expected_state_posterior(size_t k, const matrix_t &f,
-                                  const matrix_t &b,
-                                  const vector_t &scale) const;
+  void compute_backward_prescaled(const Data::Seq &s, const DPVector &scale,
+                                  DPMatrix &b) const;
+
+  /** Called by the checkpointed forward-backward algorithm for every position
+   * t of a sequence of length L, from t = L + 1 down to t = 0, with the
+   * forward and backward columns of t, and the backward column of t + 1,
+   * which is nullptr for t = L + 1. */
+  using ForwardBackwardVisitor
+      = std::function<void(size_t t, const double *f, const double *b,
+                           const double *b_next)>;
+  /** Whether the forward and backward tables of a sequence of length L would
+   * exceed Workspace::max_memory. */
+  bool use_checkpointing(size_t L) const;
+  /** The forward and backward algorithms in O(sqrt(L)) memory.
+   *  Only the forward columns at every sqrt(L)-th position are kept; the
+   *  forward columns of each block are re-computed during the backward pass.
+   *  Uses the forward, backward, previous, and current buffers of the
+   *  thread's workspace. */
+  void forward_backward_checkpointed(const Data::Seq &s, DPVector &scale,
+                                     const ForwardBackwardVisitor &visit) const;
+  /** Log likelihood and expected statistics of one or more sequences. The
+   *  matrices are only allocated if the targets include transitions or
+   *  emissions, respectively. */
+  struct ExpectedStatistics {
+    ExpectedStatistics(size_t n_states, size_t n_emissions,
+                       const Training::Targets &targets);
+    double log_likel;
+    matrix_t T, E;
+    ExpectedStatistics &operator+=(const ExpectedStatistics &x);
+  };
+  /** Weighted sums over the sequences of a data set of their expected
+   *  statistics under the full model and under the model lacking the motifs
+   *  of a PosteriorGradientContext. The posterior and log likelihood
+   *  gradients are linear in these statistics, so that the gradient of a
+   *  weighted sum over the sequences is computed once from the sums. */
+  struct PosteriorStatistics {
+    PosteriorStatistics(const HMM &hmm,
+                        const PosteriorGradientContext &context);
+    ExpectedStatistics full, reduced;
+    PosteriorStatistics &operator+=(const PosteriorStatistics &x);
+  };
+  /** The log likelihood and expected transition and emission statistics of a
+   *  sequence for the given targets, from one forward and backward pass. */
+  ExpectedStatistics expected_statistics(
+      const Data::Seq &s, const Training::Targets &targets) const;
+  /** Add the expected transition and emission statistics of a sequence for
+   *  the given targets to T and E, and return the log likelihood. If
+   *  posteriors is given, the expected number of visits of the given states
+   *  is stored there. This does the forward and backward passes for all
+   *  other expected statistics methods; it uses checkpointing for long
+   *  sequences and leaves the scaling factors in the scale buffer of the
+   *  thread's workspace. */
+  double expected_statistics(const Data::Seq &s,
+                             const Training::Targets &targets, matrix_t &T,
+                             matrix_t &E,
+                             const std::vector<size_t> &states
+                             = std::vector<size_t>(),
+                             double *posteriors = nullptr) const;
+  /** The expected number of times that each of the given states is visited.
+   *  The scaling factors are left in the scale buffer of the thread's
+   *  workspace. */
+  std::vector<double> expected_state_posteriors(
+      const Data::Seq &s, const std::vector<size_t> &states) const;
+
+  double likelihood_from_scale(const DPVector &scale) const;
+  double log_likelihood_from_scale(const DPVector &scale) const;
+
+  double expected_state_posterior(size_t k, const DPMatrix &f,
+                                  const DPMatrix &b,
+                                  const DPVector &scale) const;
 
   // -------------------------------------------------------------------------------------------
   // Gradient methods
@@ -632,19 +837,40 @@ protected:
   posterior_t posterior_gradient(const Data::Set &s, const Training::Task &task,
                                  bitmask_t present, matrix_t &transition_g,
                                  matrix_t &emission_g) const;
-  posterior_gradient_t posterior_gradient(const Data::Seq &seq,
-                                          const Training::Task &task,
-                                          bitmask_t present,
-                                          matrix_t &transition_g,
-                                          matrix_t &emission_g) const;
+  /** Log likelihoods and posterior of the sequence with index seq_idx of the
+   * data set of the context; the context has to be created from this HMM,
+   * once for all sequences. The expected statistics under both models are
+   * left in the workspace of the calling thread, for
+   * add_posterior_statistics(). */
+  posterior_statistics_t posterior_statistics(
+      size_t seq_idx, const PosteriorGradientContext &context) const;
+  /** Add the expected statistics of the last call of posterior_statistics()
+   * in the calling thread to the sums, such that their gradient increases by
+   * posterior_weight times the posterior gradient of the sequence plus
+   * likelihood_weight times its log likelihood gradient. */
+  void add_posterior_statistics(PosteriorStatistics &sums,
+                                const posterior_statistics_t &res,
+                                double posterior_weight,
+                                double likelihood_weight = 0) const;
+  /** Add the gradient of the weighted sums of statistics to transition_g and
+   * emission_g. */
+  void posterior_gradient(const PosteriorStatistics &sums,
+                          const PosteriorGradientContext &context,
+                          matrix_t &transition_g, matrix_t &emission_g) const;
 
   /** (Log) likelihood gradient w.r.t. transformed transition probabilities */
   matrix_t transition_gradient(const matrix_t &T,
                                const Training::Range &allowed) const;
+  /** As above, for expected transitions of a sub model in its own indices */
+  matrix_t transition_gradient(const matrix_t &T, const SubHMM &sub,
+                               const Training::Range &allowed) const;
 
   /** (Log) likelihood gradient w.r.t. transformed emission probabilities */
   matrix_t emission_gradient(const matrix_t &E,
                              const Training::Range &allowed) const;
+  /** As above, for expected emissions of a sub model in its own indices */
+  matrix_t emission_gradient(const matrix_t &E, const SubHMM &sub,
+                             const Training::Range &allowed) const;
 
 public:
   std::pair<HMM, std::map<size_t, size_t>> add_revcomp_motifs() const;
@@ -666,6 +892,12 @@ public:
   bool check_consistency(double eps = 1e-6) const;
 
   void switch_intermediate(bool new_state) { store_intermediate = new_state; };
+  /** Use the given cache for the log likelihoods of the variants lacking
+   * motifs; it is shared by copies of this HMM. */
+  void use_variant_cache(std::shared_ptr<VariantCache> cache) {
+    variant_cache = cache;
+  };
+  bool has_variant_cache() const { return variant_cache != nullptr; };
 
   mask_t compute_mask(const Data::Collection &col) const;
 
@@ -699,6 +931,8 @@ public:
 protected:
   Training::Range complementary_states(size_t group_idx) const;
   Training::Range complementary_states_mask(bitmask_t present) const;
+  /** For each state whether it is not part of the groups in present. */
+  std::vector<bool> complementary_states_flags(bitmask_t present) const;
 };
 
 namespace Exception {
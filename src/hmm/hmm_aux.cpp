@@ -51,6 +51,7 @@ void HMM::shift_forward(size_t group_idx, size_t n) {
   for (size_t j = 0; j < n_emissions; j++)
     emission(*groups[group_idx].states.rbegin(), j) = 1.0 / n_emissions;
   normalize_emission(emission);
+  compile_topology();
 }
 
 void HMM::shift_backward(size_t group_idx, size_t n) {
@@ -61,6 +62,7 @@ void HMM::shift_backward(size_t group_idx, size_t n) {
   for (size_t j = 0; j < n_emissions; j++)
     emission(*groups[group_idx].states.begin(), j) = 1.0 / n_emissions;
   normalize_emission(emission);
+  compile_topology();
 }
 
 void HMM::serialize(ostream &os, const ExecutionInformation &exec_info,
@@ -671,13 +673,14 @@ HMM::mask_t HMM::compute_mask(const Data::Collection &collection) const {
   if (verbosity >= Verbosity::debug)
     cout << "HMM::compute-mask(Data::Collection)" << endl;
   HMM::mask_t mask;
+  Viterbi decoder = viterbi_decoder();
   for (auto &contrast : collection)
     for (auto &dataset : contrast) {
       mask_sub_t m;
       for (auto &seq : dataset) {
         vector<size_t> v;
         HMM::StatePath path;
-        viterbi(seq, path);
+        decoder.decode(seq, path);
         size_t idx = 0;
         for (auto state : path) {
           if (state >= first_state)
@@ -727,6 +730,13 @@ Training::Range HMM::complementary_states_mask(bitmask_t present_mask) const {
   return range;
 }
 
+vector<bool> HMM::complementary_states_flags(bitmask_t present_mask) const {
+  vector<bool> flags(n_states);
+  for (size_t i = 0; i < n_states; i++)
+    flags[i] = (present_mask & bitmask_t(1 << group_ids[i])) == 0;
+  return flags;
+}
+
 string HMM::get_group_consensus(const matrix_t &m, size_t idx, double threshold) const {
   const string iupac = "-acmgrsvtwyhkdbn";
   string gapped_consensus = "";
@@ -785,13 +795,12 @@ void HMM::print_occurrence_table_header(ostream &out) const {
 void HMM::print_occurrence_table(const string &file_path, const Data::Seq &seq,
                                  const StatePath &path, ostream &out,
                                  bool bed) const {
-  size_t seqlen = seq.sequence.size();
+  size_t seqlen = seq.isequence.size();
   size_t midpoint = seqlen / 2;
-  bool revcomp = false;
   // reverse-complementary sequences look like this: xxx$xxx
   // so their length is 2n + 1, and the middle nucleotide is $
-  if (seqlen % 2 == 1 and seq.sequence[midpoint] == '$')
-    revcomp = true;
+  bool revcomp = seq.isequence.has_revcomp();
+  const string text = seq.sequence();
 
   double center;
   if (revcomp)
@@ -806,7 +815,7 @@ void HMM::print_occurrence_table(const string &file_path, const Data::Seq &seq,
         size_t end = pos + 1;
         while (end != path.size() and path[end] > path[pos])
           end++;
-        string motif = seq.sequence.substr(pos, end - pos);
+        string motif = text.substr(pos, end - pos);
 
         bool strand = (not revcomp) or (pos < midpoint);
         // forward_pos is the position relative to the forward strand
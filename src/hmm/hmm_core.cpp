@@ -27,6 +27,8 @@
  * =====================================================================================
  */
 
+#include <algorithm>
+#include <cmath>
 #include <boost/range/adaptors.hpp>
 #include "../aux.hpp"
 #include "hmm.hpp"
@@ -34,216 +36,277 @@
 using namespace std;
 
 double HMM::viterbi(const Data::Seq &s, StatePath &path) const {
-  // TODO: precompute log probabilities
-  size_t L = s.isequence.size();
-
-  vector_t v_current
-      = scalar_vector(n_states, -numeric_limits<double>::infinity());
-  vector_t v_previous
-      = scalar_vector(n_states, -numeric_limits<double>::infinity());
-  v_previous(start_state) = 0;
-  boost::numeric::ublas::matrix<size_t> traceback(L, n_states);
-  for (size_t i = 0; i < L; i++) {
-    size_t symbol = s.isequence(i);
-    if (symbol == empty_symbol)
-      for (size_t k = start_state; k < n_states; k++) {
-        double tmp = v_previous(k) + log(transition(k, start_state));
-        if (tmp > v_current(start_state)) {
-          v_current(start_state) = tmp;
-          traceback(i, start_state) = k;
-        }
-      }
-    else
-      for (size_t l = start_state; l < n_states; l++) {
-        double m = -numeric_limits<double>::infinity();
-        for (size_t k = start_state; k < n_states; k++) {
-          double tmp = v_previous(k) + log(transition(k, l));
-          if (tmp > m) {
-            m = tmp;
-            traceback(i, l) = k;
-          }
-        }
-        v_current(l) = log(emission(l, symbol)) + m;
-      }
-    v_previous = v_current;
-    v_current = scalar_vector(n_states, -numeric_limits<double>::infinity());
-  }
+  Viterbi decoder(topology);
+  return decoder.decode(s, path);
+}
+
+Viterbi HMM::viterbi_decoder() const { return Viterbi(topology); }
 
-  double p = -numeric_limits<double>::infinity();
-  size_t pi = 0;
-  for (size_t k = start_state; k < n_states; k++) {
-    double tmp = v_previous(k) + log(transition(k, start_state));
-    if (tmp > p) {
-      p = tmp;
-      pi = k;
+/** One step of the scaled forward algorithm. Computes the column cur of
+ * position t + 1 from the column prev of position t, where symbol is the
+ * symbol at position t; cur has to be filled with zeros. Separators and the
+ * end of the sequence are handled by passing the empty symbol. Returns the
+ * scaling factor. */
+static double forward_step(const Topology &topology, size_t symbol,
+                           const double *prev, double *cur) {
+  const size_t start_state = 0;
+  const size_t n_states = topology.n_states;
+  const size_t *pred_offset = topology.pred_offset.data();
+  const size_t *pred_state = topology.pred_state.data();
+  const double *pred_prob = topology.pred_prob.data();
+  if (symbol == empty_symbol) {
+    double x = 0;
+    for (size_t e = pred_offset[start_state]; e < pred_offset[start_state + 1];
+         e++)
+      x += prev[pred_state[e]] * pred_prob[e];
+    cur[start_state] = 1;
+    return x;
+  } else {
+    const double *emission_t = topology.emissions_of(symbol);
+    double z = 0;
+    for (size_t i = 0; i < n_states; i++) {
+      double emission_i_t = emission_t[i];
+      if (emission_i_t > 0) {
+        double x = 0;
+        for (size_t e = pred_offset[i]; e < pred_offset[i + 1]; e++)
+          x += prev[pred_state[e]] * pred_prob[e];
+        z += cur[i] = x * emission_i_t;
+      }
     }
+    for (size_t i = 0; i < n_states; i++)
+      cur[i] /= z;
+    return z;
   }
-  path = StatePath(L);
-  path(L - 1) = pi;
-  for (size_t i = L - 1; i > 0; i--)
-    pi = path(i - 1) = traceback(i, pi);
-
-  return p;
-};
-
-vector_t HMM::compute_forward_scale(const Data::Seq &s) const {
-  size_t T = s.isequence.size();
-  vector_t scale = zero_vector(T + 2);
-  vector_t prev = zero_vector(n_states);
-  vector_t cur = zero_vector(n_states);
-
-  prev(start_state) = 1;
-  scale(0) = 1;
-  for (size_t t = 0; t < T; t++) {
-    size_t symbol = s.isequence(t);
-    if (symbol == empty_symbol) {
-      for (auto pre : pred[start_state])
-        cur(start_state) += prev(pre) * transition(pre, start_state);
-      scale(t + 1) = cur(start_state);
-      cur(start_state) = 1;
-    } else {
-      for (size_t i = 0; i < n_states; i++) {
-        double emission_i_t = emission(i, symbol);
-        if (emission_i_t > 0) {
-          for (auto pre : pred[i])
-            cur(i) += prev(pre) * transition(pre, i);
-          cur(i) *= emission_i_t;
-          scale(t + 1) += cur(i);
-        }
+}
+
+/** One step of the backward algorithm with pre-scaling. Computes the column
+ * cur of position t from the column next of position t + 1, where symbol is
+ * the symbol at position t; cur has to be filled with zeros. */
+static void backward_step(const Topology &topology, size_t symbol,
+                          double scale, const double *next, double *cur) {
+  const size_t start_state = 0;
+  const size_t n_states = topology.n_states;
+  if (symbol == empty_symbol) {
+    const size_t *pred_offset = topology.pred_offset.data();
+    const size_t *pred_state = topology.pred_state.data();
+    const double *pred_prob = topology.pred_prob.data();
+    for (size_t e = pred_offset[start_state]; e < pred_offset[start_state + 1];
+         e++)
+      cur[pred_state[e]] = next[start_state] * pred_prob[e] / scale;
+  } else {
+    const size_t *succ_offset = topology.succ_offset.data();
+    const size_t *succ_state = topology.succ_state.data();
+    const double *succ_prob = topology.succ_prob.data();
+    const double *emission_t = topology.emissions_of(symbol);
+    for (size_t i = 0; i < n_states; i++) {
+      double x = 0;
+      for (size_t e = succ_offset[i]; e < succ_offset[i + 1]; e++) {
+        size_t suc = succ_state[e];
+        x += next[suc] * succ_prob[e] * emission_t[suc];
       }
-      for (size_t i = 0; i < n_states; i++)
-        cur(i) /= scale(t + 1);
+      cur[i] = x / scale;
     }
-    prev = cur;
-    cur = zero_vector(n_states);
   }
+}
 
-  for (auto pre : pred[start_state])
-    cur(start_state) += prev(pre) * transition(pre, start_state);
-  scale(T + 1) = cur(start_state);
-  return scale;
+/** The last step of the backward algorithm with pre-scaling: computes the
+ * column of the last position of a sequence from the column of the final
+ * transition into the start state. */
+static void backward_last_step(const Topology &topology, double scale,
+                               const double *next, double *cur) {
+  const size_t n_states = topology.n_states;
+  const size_t *succ_offset = topology.succ_offset.data();
+  const size_t *succ_state = topology.succ_state.data();
+  const double *succ_prob = topology.succ_prob.data();
+  for (size_t i = 0; i < n_states; i++) {
+    double x = 0;
+    for (size_t e = succ_offset[i]; e < succ_offset[i + 1]; e++)
+      x += next[succ_state[e]] * succ_prob[e];
+    cur[i] = x / scale;
+  }
 }
 
-matrix_t HMM::compute_forward_scaled(const Data::Seq &s,
-                                     vector_t &scale) const {
-  size_t T = s.isequence.size();
-  matrix_t m = zero_matrix(T + 2, n_states);
-  if (scale.size() != T + 2)
-    scale = zero_vector(T + 2);
+void HMM::compute_forward_scale(const Data::Seq &s, DPVector &scale) const {
+  const size_t T = s.isequence.size();
+  Workspace &workspace = Workspace::local();
+  DPVector &prev = workspace.previous;
+  DPVector &cur = workspace.current;
+  scale.assign(T + 2, 0);
+  prev.assign(n_states, 0);
+  cur.assign(n_states, 0);
 
-  m(0, start_state) = 1;
-  scale(0) = 1;
-  for (size_t t = 0; t < T; t++) {
-    size_t symbol = s.isequence(t);
-    if (symbol == empty_symbol) {
-      for (auto pre : pred[start_state])
-        m(t + 1, start_state) += m(t, pre) * transition(pre, start_state);
-      scale(t + 1) = m(t + 1, start_state);
-      m(t + 1, start_state) = 1;
-    } else {
-      for (size_t i = 0; i < n_states; i++) {
-        double emission_i_t = emission(i, symbol);
-        if (emission_i_t > 0) {
-          for (auto pre : pred[i])
-            m(t + 1, i) += m(t, pre) * transition(pre, i);
-          scale(t + 1) += m(t + 1, i) *= emission_i_t;
-        }
-      }
-      for (size_t i = 0; i < n_states; i++)
-        m(t + 1, i) /= scale(t + 1);
-    }
+  prev[start_state] = 1;
+  scale[0] = 1;
+  for (size_t t = 0; t <= T; t++) {
+    size_t symbol = t < T ? s.isequence(t) : empty_symbol;
+    scale[t + 1] = forward_step(topology, symbol, prev.data(), cur.data());
+    swap(prev, cur);
+    fill(begin(cur), end(cur), 0);
   }
+}
 
-  for (auto pre : pred[start_state])
-    m(T + 1, start_state) += m(T, pre) * transition(pre, start_state);
-  scale(T + 1) = m(T + 1, start_state);
-  m(T + 1, start_state) = 1;
+void HMM::compute_forward_scaled(const Data::Seq &s, DPMatrix &m,
+                                 DPVector &scale) const {
+  const size_t T = s.isequence.size();
+  m.reset(T + 2, n_states);
+  scale.assign(T + 2, 0);
+
+  m(0, start_state) = 1;
+  scale[0] = 1;
+  for (size_t t = 0; t <= T; t++) {
+    size_t symbol = t < T ? s.isequence(t) : empty_symbol;
+    scale[t + 1] = forward_step(topology, symbol, m.row(t), m.row(t + 1));
+  }
 
   if (verbosity >= Verbosity::debug)
     cout << "alpha = " << m << endl;
-  return m;
 }
 
-matrix_t HMM::compute_forward_prescaled(const Data::Seq &s,
-                                        const vector_t &scale) const {
-  size_t T = s.isequence.size();
-  matrix_t m = zero_matrix(T + 2, n_states);
-  m(0, start_state) = 1.0 / scale(0);
+void HMM::compute_forward_prescaled(const Data::Seq &s,
+                                    const DPVector &scale, DPMatrix &m) const {
+  const size_t T = s.isequence.size();
+  const size_t *pred_offset = topology.pred_offset.data();
+  const size_t *pred_state = topology.pred_state.data();
+  const double *pred_prob = topology.pred_prob.data();
+  m.reset(T + 2, n_states);
+  m(0, start_state) = 1.0 / scale[0];
   for (size_t t = 0; t < T; t++) {
     size_t symbol = s.isequence(t);
+    const double *prev = &m(t, 0);
+    double *cur = &m(t + 1, 0);
     if (symbol == empty_symbol) {
-      for (auto k : pred[start_state])
-        m(t + 1, start_state) += m(t, k) * transition(k, start_state);
-      m(t + 1, start_state) /= scale(t + 1);
+      double x = 0;
+      for (size_t e = pred_offset[start_state]; e < pred_offset[start_state + 1];
+           e++)
+        x += prev[pred_state[e]] * pred_prob[e];
+      cur[start_state] = x / scale[t + 1];
     } else {
+      const double *emission_t = topology.emissions_of(symbol);
       for (size_t i = 0; i < n_states; i++) {
-        double emission_i_t = emission(i, symbol);
+        double emission_i_t = emission_t[i];
         if (emission_i_t > 0) {
-          for (auto k : pred[i])
-            m(t + 1, i) += m(t, k) * transition(k, i);
-          m(t + 1, i) *= emission_i_t;
+          double x = 0;
+          for (size_t e = pred_offset[i]; e < pred_offset[i + 1]; e++)
+            x += prev[pred_state[e]] * pred_prob[e];
+          cur[i] = x * emission_i_t / scale[t + 1];
         }
-        m(t + 1, i) /= scale(t + 1);
       }
     }
   }
 
-  for (auto k : pred[start_state])
-    m(T + 1, start_state) += m(T, k) * transition(k, start_state);
-  m(T + 1, start_state) /= scale(T + 1);
-  return m;
+  double x = 0;
+  for (size_t e = pred_offset[start_state]; e < pred_offset[start_state + 1];
+       e++)
+    x += m(T, pred_state[e]) * pred_prob[e];
+  m(T + 1, start_state) = x / scale[T + 1];
 }
 
 // Assuming that max_order == 0
-matrix_t HMM::compute_backward_prescaled(const Data::Seq &s,
-                                         const vector_t &scale) const {
-  size_t T = s.isequence.size();
-  matrix_t m = zero_matrix(T + 2, n_states);
-  m(T + 1, start_state) = 1 / scale(T + 1);
-  for (size_t i = 0; i < n_states; i++) {
-    for (auto suc : succ[i])
-      m(T, i) += m(T + 1, suc) * transition(i, suc);
-    m(T, i) /= scale(T);
-  }
-
-  for (int t = T - 1; t >= 0; t--) {
-    size_t symbol = s.isequence(t);
-    if (symbol == empty_symbol)
-      for (auto pre : pred[start_state])
-        m(t, pre) = m(t + 1, start_state) * transition(pre, start_state)
-                    / scale(t);
-    else
-      for (size_t i = 0; i < n_states; i++) {  // TODO flip loops around
-        for (auto suc : succ[i])
-          m(t, i) += m(t + 1, suc) * transition(i, suc) * emission(suc, symbol);
-        m(t, i) /= scale(t);
-      }
-  }
+void HMM::compute_backward_prescaled(const Data::Seq &s, const DPVector &scale,
+                                     DPMatrix &m) const {
+  const size_t T = s.isequence.size();
+  m.reset(T + 2, n_states);
+  m(T + 1, start_state) = 1 / scale[T + 1];
+  backward_last_step(topology, scale[T], m.row(T + 1), m.row(T));
+  for (int t = T - 1; t >= 0; t--)
+    backward_step(topology, s.isequence(t), scale[t], m.row(t + 1), m.row(t));
 
   if (verbosity >= Verbosity::debug)
     cout << "beta = " << m << endl;
-  return m;
 }
 
-double HMM::likelihood_from_scale(const vector_t &scale) const {
+bool HMM::use_checkpointing(size_t L) const {
+  return 2 * (L + 2) * n_states * sizeof(double) > Workspace::max_memory;
+}
+
+void HMM::forward_backward_checkpointed(const Data::Seq &s, DPVector &scale,
+                                        const ForwardBackwardVisitor &visit)
+    const {
+  const size_t T = s.isequence.size();
+  const size_t n_rows = T + 2;
+  const size_t block_size = ceil(sqrt(n_rows));
+  const size_t n_blocks = (n_rows + block_size - 1) / block_size;
+
+  Workspace &workspace = Workspace::local();
+  DPMatrix &checkpoints = workspace.forward;
+  DPMatrix &block = workspace.backward;
+  DPVector &next = workspace.previous;
+  DPVector &cur = workspace.current;
+
+  // Forward pass, keeping only the first column of every block
+  checkpoints.reset(n_blocks, n_states);
+  cur.assign(n_states, 0);
+  next.assign(n_states, 0);
+  scale.assign(n_rows, 0);
+  cur[start_state] = 1;
+  scale[0] = 1;
+  for (size_t t = 0; t <= T; t++) {
+    if (t % block_size == 0)
+      copy(begin(cur), end(cur), checkpoints.row(t / block_size));
+    size_t symbol = t < T ? s.isequence(t) : empty_symbol;
+    scale[t + 1] = forward_step(topology, symbol, cur.data(), next.data());
+    swap(cur, next);
+    fill(begin(next), end(next), 0);
+  }
+  if ((T + 1) % block_size == 0)
+    copy(begin(cur), end(cur), checkpoints.row((T + 1) / block_size));
+
+  // Backward pass, re-computing the forward columns of one block at a time
+  block.reset(block_size, n_states);
+  next.assign(n_states, 0);
+  for (size_t block_idx = n_blocks; block_idx-- > 0;) {
+    const size_t first = block_idx * block_size;
+    const size_t last = min(n_rows, first + block_size);
+    fill(begin(block.data), end(block.data), 0);
+    copy(checkpoints.row(block_idx), checkpoints.row(block_idx) + n_states,
+         block.row(0));
+    for (size_t t = first; t + 1 < last; t++) {
+      size_t symbol = t < T ? s.isequence(t) : empty_symbol;
+      forward_step(topology, symbol, block.row(t - first),
+                   block.row(t + 1 - first));
+    }
+
+    for (size_t t = last; t-- > first;) {
+      fill(begin(cur), end(cur), 0);
+      if (t == T + 1)
+        cur[start_state] = 1 / scale[T + 1];
+      else if (t == T)
+        backward_last_step(topology, scale[T], next.data(), cur.data());
+      else
+        backward_step(topology, s.isequence(t), scale[t], next.data(),
+                      cur.data());
+      visit(t, block.row(t - first), cur.data(),
+            t == T + 1 ? nullptr : next.data());
+      swap(cur, next);
+    }
+  }
+}
+
+double HMM::likelihood_from_scale(const DPVector &scale) const {
   double pf = 1;
   for (size_t i = 0; i < scale.size(); i++)
-    pf *= scale(i);
+    pf *= scale[i];
   return pf;
 }
 
-double HMM::log_likelihood_from_scale(const vector_t &scale) const {
+double HMM::log_likelihood(const Data::Seq &s) const {
+  DPVector &scale = Workspace::local().scale;
+  compute_forward_scale(s, scale);
+  return log_likelihood_from_scale(scale);
+}
+
+double HMM::log_likelihood_from_scale(const DPVector &scale) const {
   double logpf = 0;
   for (size_t i = 0; i < scale.size(); i++)
-    logpf += log(scale(i));
+    logpf += log(scale[i]);
   return logpf;
 }
 
-double HMM::expected_state_posterior(size_t k, const matrix_t &f,
-                                     const matrix_t &b,
-                                     const vector_t &scale) const {
+double HMM::expected_state_posterior(size_t k, const DPMatrix &f,
+                                     const DPMatrix &b,
+                                     const DPVector &scale) const {
   double s = 0;
   for (size_t i = 0; i < f.size1(); i++)
-    s += f(i, k) * b(i, k) * scale(i);
+    s += f(i, k) * b(i, k) * scale[i];
   return s;
 }
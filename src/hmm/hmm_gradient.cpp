@@ -32,6 +32,7 @@
 #include "../aux.hpp"
 #include "hmm.hpp"
 #include "logistic.hpp"
+#include "reduction.hpp"
 #include "subhmm.hpp"
 
 using namespace std;
@@ -45,60 +46,33 @@ double HMM::log_likelihood_gradient(const Data::Seqs &seqs,
   transition_g = zero_matrix(n_states, n_states);
   emission_g = zero_matrix(n_states, n_emissions);
 
-  double lp = 0;
-  vector<matrix_t> t_g, e_g;
-
-#pragma omp parallel shared(emission_g, transition_g) if (DO_PARALLEL)
-  {
-#pragma omp single
-    // Initalize storage for thread intermediate results
-    {
-      size_t n_threads = omp_get_num_threads();
-      //    cout << "B Num threads = " << n_threads << endl;
-      if (not targets.transition.empty())
-        t_g = vector<matrix_t>(
-            n_threads, zero_matrix(transition_g.size1(), transition_g.size2()));
-      if (not targets.emission.empty())
-        e_g = vector<matrix_t>(
-            n_threads, zero_matrix(emission_g.size1(), emission_g.size2()));
-    }
-
-#pragma omp for reduction(+ : lp)
-    // Compute likelihood for each sequence
-    for (size_t i = 0; i < seqs.size(); i++) {
-      int thread_idx = omp_get_thread_num();
-      vector_t scale;
-      matrix_t f = compute_forward_scaled(seqs[i], scale);
-      matrix_t b = compute_backward_prescaled(seqs[i], scale);
-
-      // Compute expected statistics
-      matrix_t T, E;
-      double logp = BaumWelchIteration_single(T, E, seqs[i], targets);
-
-      if (not targets.transition.empty())
-        // Compute log likelihood gradients w.r.t. transition probability
-        t_g[thread_idx] += transition_gradient(T, targets.transition);
-
-      if (not targets.emission.empty())
-        // Compute log likelihood gradients w.r.t. emission probability
-        e_g[thread_idx] += emission_gradient(E, targets.emission);
-
-      lp += logp;
-    }
-
-#pragma omp single
-    // Collect results of threads
-    {
-      if (not targets.transition.empty())
-        for (auto &x : t_g)
-          transition_g += x;
-      if (not targets.emission.empty())
-        for (auto &x : e_g)
-          emission_g += x;
-    }
+  const size_t n_seqs = seqs.size();
+  const size_t n_chunks = min(n_seqs, n_reduction_chunks);
+  if (n_chunks == 0)
+    return 0;
+
+  // the gradient is linear in the expected statistics, so these are summed
+  // up, and the gradient is computed once from the sums
+  vector<ExpectedStatistics> partials(
+      n_chunks, ExpectedStatistics(n_states, n_emissions, targets));
+#pragma omp parallel for schedule(dynamic) if (DO_PARALLEL)
+  for (size_t chunk = 0; chunk < n_chunks; chunk++) {
+    ExpectedStatistics &partial = partials[chunk];
+    const size_t end = chunk_begin(chunk + 1, n_chunks, n_seqs);
+    for (size_t i = chunk_begin(chunk, n_chunks, n_seqs); i < end; i++)
+      partial.log_likel
+          += expected_statistics(seqs[i], targets, partial.T, partial.E);
   }
+  tree_reduce(partials);
+
+  if (not targets.transition.empty())
+    // Compute log likelihood gradients w.r.t. transition probability
+    transition_g += transition_gradient(partials[0].T, targets.transition);
+  if (not targets.emission.empty())
+    // Compute log likelihood gradients w.r.t. emission probability
+    emission_g += emission_gradient(partials[0].E, targets.emission);
 
-  return lp;
+  return partials[0].log_likel;
 }
 
 double HMM::chi_square_gradient(const Data::Contrast &contrast,
@@ -382,27 +356,22 @@ double HMM::class_likelihood_gradient(const Data::Set &dataset,
          << "current_class_prior = " << current_class_prior << endl
          << "log_class_prior = " << log_class_prior << endl;
 
-  double l = 0;               // log-likelihood
-  vector<matrix_t> t_g, e_g;  // thread-local storage for gradients of
-                              // transition and emission probabilities
-#pragma omp parallel shared(g, t_g, e_g) if (DO_PARALLEL)
-  {
-#pragma omp single
-    // Initialize storage for thread-intermediate results
-    {
-      size_t n_threads = omp_get_num_threads();
-      if (not task.targets.transition.empty())
-        t_g = vector<matrix_t>(
-            n_threads, zero_matrix(g.transition.size1(), g.transition.size2()));
-      if (not task.targets.emission.empty())
-        e_g = vector<matrix_t>(
-            n_threads, zero_matrix(g.emission.size1(), g.emission.size2()));
-    }
-
-#pragma omp for schedule(static) reduction(+ : l)
-    for (size_t i = 0; i < dataset.set_size; i++) {
-      int thread_idx = omp_get_thread_num();
-
+  const PosteriorGradientContext context(
+      *this, complementary_states_mask(present), task, dataset, present);
+
+  const size_t n_seqs = dataset.set_size;
+  const size_t n_chunks = min(n_seqs, n_reduction_chunks);
+  if (n_chunks == 0)
+    return 0;
+
+  double l = 0;  // log-likelihood
+  // weighted sums of the expected statistics of each chunk of sequences
+  vector<PosteriorStatistics> partials(n_chunks,
+                                       PosteriorStatistics(*this, context));
+#pragma omp parallel for schedule(dynamic) reduction(+ : l) if (DO_PARALLEL)
+  for (size_t chunk = 0; chunk < n_chunks; chunk++) {
+    const size_t end = chunk_begin(chunk + 1, n_chunks, n_seqs);
+    for (size_t i = chunk_begin(chunk, n_chunks, n_seqs); i < end; i++) {
       /* c                     Class 1
        * not C                 Class 2
        * current_class_prior   P(c)
@@ -414,9 +383,7 @@ double HMM::class_likelihood_gradient(const Data::Set &dataset,
        * exp(-x)               1 / P(C|X)
        */
 
-      matrix_t t, e;
-      posterior_gradient_t res
-          = posterior_gradient(dataset.sequences[i], task, present, t, e);
+      const posterior_statistics_t res = posterior_statistics(i, context);
       double p = res.posterior;
       double x = 0;
       if (log_class_prior != 0)
@@ -425,7 +392,8 @@ double HMM::class_likelihood_gradient(const Data::Set &dataset,
                   + (1 - p) * (1 - class_cond) / (1 - marginal_motif_prior));
       if (verbosity >= Verbosity::verbose)
         cout << "Sequence " << dataset.sequences[i].definition << " p = " << p
-             << " class log likelihood = " << x << " exp -> " << exp(x) << endl;
+             << " class log likelihood = " << x << " exp -> " << exp(x)
+             << endl;
       double term_a = class_cond / marginal_motif_prior - 1;
       double term_b = exp(-x) * current_class_prior
                       / (1 - marginal_motif_prior);
@@ -433,40 +401,22 @@ double HMM::class_likelihood_gradient(const Data::Set &dataset,
 
       // \del \log P(C|X) = P(C) / (P(C|X) * (1 - P(m))) * (P(m|C)/P(m) - 1) * \del P(m|X)
 
-      if (not task.targets.transition.empty())
-        t_g[thread_idx] += term_c * t;
-      if (not task.targets.emission.empty())
-        e_g[thread_idx] += term_c * e;
-
-      if (task.measure == Measure::ClassificationLikelihood) {
-        if (not task.targets.transition.empty()) {
-          // Compute log likelihood gradients for the full model w.r.t.
-          // transition probability
-          t_g[thread_idx]
-              += transition_gradient(res.T, task.targets.transition);
-        }
-        if (not task.targets.emission.empty()) {
-          // Compute log likelihood gradients for the full model w.r.t. emission
-          // probability
-          e_g[thread_idx] += emission_gradient(res.E, task.targets.emission);
-        }
+      // for the classification likelihood also the log likelihood gradient of
+      // the full model
+      const bool full_likelihood
+          = task.measure == Measure::ClassificationLikelihood;
+      add_posterior_statistics(partials[chunk], res, term_c,
+                               full_likelihood ? 1 : 0);
+      if (full_likelihood)
         x += res.log_likelihood;
-      }
       if (not isfinite(x))
         throw Exception::HMM::Calculation::Infinity();
       l += x;
     }
-
-#pragma omp single
-    {
-      if (not task.targets.transition.empty())
-        for (auto &t : t_g)
-          g.transition += t;
-      if (not task.targets.emission.empty())
-        for (auto &e : e_g)
-          g.emission += e;
-    }
   }
+  tree_reduce(partials);
+  posterior_gradient(partials[0], context, g.transition, g.emission);
+
   if (verbosity >= Verbosity::debug)
     cout << "Data::Set " << dataset.path << " l = " << l << endl;
 
@@ -695,52 +645,15 @@ double HMM::rank_information_gradient(const Data::Set &dataset,
 
   const size_t n = dataset.set_size;
 
-  // a vector of expected counts of occurrences across the sequences
-  vector_t counts(n);
-  // vectors of transition and emission gradient matrices for each sequence
-  vector<Gradient> gradients(n);
-
-#pragma omp parallel shared(gradients, counts) if (DO_PARALLEL)
-  // for each of the samples
-  for (size_t seq_idx = 0; seq_idx < n; seq_idx++) {
-    if (verbosity >= Verbosity::debug)
-      cout << "Computing posterior gradient for sequence "
-           << dataset.sequences[seq_idx].definition << endl;
-
-    Gradient current_gradient;
-    // compute posterior gradients for transition and emission probabilities,
-    // and store the expected occurrences
-    double current_counts
-        = posterior_gradient(dataset.sequences[seq_idx], task, present,
-                             current_gradient.transition,
-                             current_gradient.emission).posterior;
+  const PosteriorGradientContext context(
+      *this, complementary_states_mask(present), task, dataset, present);
 
-    if (verbosity >= Verbosity::debug)
-      cout << "Transition gradient of sequence "
-           << dataset.sequences[seq_idx].definition << " = "
-           << gradients[seq_idx].transition << endl
-           << "Emission gradient of sequence "
-           << dataset.sequences[seq_idx].definition << " = "
-           << gradients[seq_idx].emission << endl;
-#pragma omp critical(store_results)
-    {
-      if (not task.targets.transition.empty())
-        gradients[seq_idx].transition = current_gradient.transition;
-      if (not task.targets.emission.empty())
-        gradients[seq_idx].emission = current_gradient.emission;
-      counts(seq_idx) = current_counts;
-    }
-  }
+  // a vector of expected counts of occurrences across the sequences
+  const vector_t counts = posterior_atleast_one(dataset, present);
 
   if (verbosity >= Verbosity::debug)
     cout << "Posterior = " << counts << endl;
 
-  Gradient cumul_gradient;
-  if (not task.targets.transition.empty())
-    cumul_gradient.transition = zero_matrix(n_states, n_states);
-  if (not task.targets.emission.empty())
-    cumul_gradient.emission = zero_matrix(n_states, n_emissions);
-
   double total = 0;
   for (auto &c : counts)
     total += c;
@@ -748,41 +661,50 @@ double HMM::rank_information_gradient(const Data::Set &dataset,
   if (verbosity >= Verbosity::debug)
     cout << "debug1 " << dataset.path << " " << total << endl;
 
+  // The gradient is the sum over the ranks i < n - 1 of a factor times the
+  // posterior gradients of the sequences up to rank i, plus the total factor
+  // times those of all sequences. Thus the posterior gradient of each
+  // sequence is weighted with the sum of the factors of its own and of
+  // the following ranks, plus the total factor.
+  vector<double> weights(n, 0);
   double total_factor = 0;
   double cum_count = 0;
-  for (size_t i = 0; i < n; i++) {
-    if (not task.targets.transition.empty())
-      cumul_gradient.transition += gradients[i].transition;
-    if (not task.targets.emission.empty())
-      cumul_gradient.emission += gradients[i].emission;
-
-    if (i < n - 1) {
-      cum_count += counts(i);
-      double current_factor = log(cum_count) - log(i + 1 - cum_count)
-                              + log(n - i - 1 - total + cum_count)
-                              - log(total - cum_count);
-      double current_contribution = log(n - total) - log(total)
-                                    + log(total - cum_count)
-                                    - log(n - i - 1 - total + cum_count);
-      total_factor += current_contribution;
-
-      if (verbosity >= Verbosity::debug)
-        cout << "debug2 " << dataset.path << " " << i << " " << cum_count << " "
-             << current_factor << " " << current_contribution << " "
-             << total_factor << endl;
+  for (size_t i = 0; i + 1 < n; i++) {
+    cum_count += counts(i);
+    double current_factor = log(cum_count) - log(i + 1 - cum_count)
+                            + log(n - i - 1 - total + cum_count)
+                            - log(total - cum_count);
+    double current_contribution = log(n - total) - log(total)
+                                  + log(total - cum_count)
+                                  - log(n - i - 1 - total + cum_count);
+    total_factor += current_contribution;
 
-      if (not task.targets.transition.empty())
-        g.transition += cumul_gradient.transition * current_factor;
-      if (not task.targets.emission.empty())
-        g.emission += cumul_gradient.emission * current_factor;
+    if (verbosity >= Verbosity::debug)
+      cout << "debug2 " << dataset.path << " " << i << " " << cum_count << " "
+           << current_factor << " " << current_contribution << " "
+           << total_factor << endl;
+
+    weights[i] = current_factor;
+  }
+  for (size_t i = n; i-- > 1;)
+    weights[i - 1] += weights[i];
+
+  const size_t n_chunks = min(n, n_reduction_chunks);
+  if (n_chunks > 0) {
+    vector<PosteriorStatistics> partials(n_chunks,
+                                         PosteriorStatistics(*this, context));
+#pragma omp parallel for schedule(dynamic) if (DO_PARALLEL)
+    for (size_t chunk = 0; chunk < n_chunks; chunk++) {
+      const size_t end = chunk_begin(chunk + 1, n_chunks, n);
+      for (size_t i = chunk_begin(chunk, n_chunks, n); i < end; i++)
+        add_posterior_statistics(partials[chunk],
+                                 posterior_statistics(i, context),
+                                 weights[i] + total_factor);
     }
+    tree_reduce(partials);
+    posterior_gradient(partials[0], context, g.transition, g.emission);
   }
 
-  if (not task.targets.transition.empty())
-    g.transition += cumul_gradient.transition * total_factor;
-  if (not task.targets.emission.empty())
-    g.emission += cumul_gradient.emission * total_factor;
-
   if (not task.targets.transition.empty())
     g.transition /= log(2.0) * n * n;  // we compute the mean mutual information
                                        // over all ranks, rather than the sum
@@ -835,111 +757,189 @@ matrix_t HMM::emission_gradient(const matrix_t &E,
   return m;
 }
 
-HMM::posterior_gradient_t HMM::posterior_gradient(const Data::Seq &seq,
-                                                  const Training::Task &task,
-                                                  bitmask_t present,
-                                                  matrix_t &transition_g,
-                                                  matrix_t &emission_g) const {
-  // Training::Task task(task_);
-  if (verbosity >= Verbosity::debug)
-    cout << "Posterior gradient calculation (Seq, Feature)." << endl;
+/** Compute the log likelihood gradient w.r.t. the transformed transition
+ * probabilities, for expected transitions T of a sub model. Equivalent to
+ * lifting T to the states of this model, without doing so. */
+matrix_t HMM::transition_gradient(const matrix_t &T, const SubHMM &sub,
+                                  const Training::Range &range) const {
+  matrix_t m = zero_matrix(n_states, n_states);
+  for (auto i : range) {
+    const int r = sub.reduce[i];
+    if (r == -1)
+      continue;
+    for (auto j : succ[i])
+      for (auto k : succ[i])
+        if (sub.reduce[k] != -1)
+          m(i, j) += T(r, sub.reduce[k])
+                     * (((j == k) ? 1 : 0) - transition(i, j));
+  }
+  return m;
+}
 
-  SubHMM subhmm(*this, complementary_states_mask(present));
+/** Compute the log likelihood gradient w.r.t. the transformed emission
+ * probabilities, for expected emissions E of a sub model. */
+matrix_t HMM::emission_gradient(const matrix_t &E, const SubHMM &sub,
+                                const Training::Range &range) const {
+  matrix_t m = zero_matrix(n_states, n_emissions);
+  for (auto j : range) {
+    const int r = sub.reduce[j];
+    if (r == -1)
+      continue;
+    for (size_t k = 0; k < n_emissions; k++)
+      for (size_t l = 0; l < n_emissions; l++)
+        m(j, k) += E(r, l) * (((k == l) ? 1 : 0) - emission(j, k));
+  }
+  return m;
+}
 
-  if (verbosity >= Verbosity::debug)
-    cout << *this << endl << subhmm << endl;
+HMM::PosteriorStatistics::PosteriorStatistics(
+    const HMM &hmm, const PosteriorGradientContext &context)
+    : full(hmm.n_states, hmm.n_emissions, context.task.targets),
+      reduced(context.reduced.n_states, context.reduced.n_emissions,
+              context.reduced_targets) {}
+
+HMM::PosteriorStatistics &HMM::PosteriorStatistics::operator+=(
+    const PosteriorStatistics &x) {
+  full += x.full;
+  reduced += x.reduced;
+  return *this;
+}
 
-  if (verbosity >= Verbosity::debug) {
-    cout << "Transition targets are";
-    for (auto x : task.targets.transition)
-      cout << " " << x;
-    cout << endl;
-    cout << "Emission targets are";
-    for (auto x : task.targets.emission)
-      cout << " " << x;
-    cout << endl;
+/** Size the matrices of the expected statistics for the targets, and zero
+ * them; this does not allocate once they had the size before. */
+static void clear_statistics(matrix_t &T, matrix_t &E, size_t n_states,
+                             size_t n_emissions,
+                             const Training::Targets &targets) {
+  if (not targets.transition.empty()) {
+    T.resize(n_states, n_states, false);
+    T.clear();
+  }
+  if (not targets.emission.empty()) {
+    E.resize(n_states, n_emissions, false);
+    E.clear();
   }
+}
 
-  if (not task.targets.transition.empty())
-    transition_g = zero_matrix(n_states, n_states);
-  if (not task.targets.emission.empty())
-    emission_g = zero_matrix(n_states, n_emissions);
+HMM::posterior_statistics_t HMM::posterior_statistics(
+    size_t seq_idx, const PosteriorGradientContext &context) const {
+  const Data::Seq &seq = context.dataset.sequences[seq_idx];
+  const Training::Targets &targets = context.task.targets;
+  const SubHMM &subhmm = context.reduced;
+  Workspace &workspace = Workspace::local();
+  matrix_t &T = workspace.transition_stats, &E = workspace.emission_stats;
+  matrix_t &Tr = workspace.reduced_transition_stats,
+           &Er = workspace.reduced_emission_stats;
 
-  Training::Targets reduced_targets = subhmm.map_down(task.targets);
+  // Compute expected statistics, for the full and reduced models
+  clear_statistics(T, E, n_states, n_emissions, targets);
+  const double logp = expected_statistics(seq, targets, T, E);
+  // for the reduced model only the log likelihood is needed if it has no
+  // targets, and it may be taken from the variant cache
+  double logpr;
+  if (context.reduced_log_likelihoods)
+    logpr = (*context.reduced_log_likelihoods)[seq_idx];
+  else {
+    clear_statistics(Tr, Er, subhmm.n_states, subhmm.n_emissions,
+                     context.reduced_targets);
+    logpr = subhmm.expected_statistics(seq, context.reduced_targets, Tr, Er);
+  }
 
   if (verbosity >= Verbosity::debug) {
-    cout << "targets emission = ";
-    for (auto &x : task.targets.emission)
-      cout << " " << x;
-    cout << endl;
-    cout << "targets transition = ";
-    for (auto &x : task.targets.transition)
-      cout << " " << x;
-    cout << endl;
-    cout << "reduced targets emission = ";
-    for (auto &x : reduced_targets.emission)
-      cout << " " << x;
-    cout << endl;
-    cout << "reduced targets transition = ";
-    for (auto &x : reduced_targets.transition)
-      cout << " " << x;
-    cout << endl;
+    cout << "Full logp = " << logp << endl << "Reduced logp = " << logpr
+         << endl;
+    if (not targets.transition.empty())
+      cout << "Expected transitions full = " << T << endl;
+    if (not targets.emission.empty())
+      cout << "Expected emissions full = " << E << endl;
+    if (not context.reduced_targets.transition.empty())
+      cout << "Expected transitions constitutive_range = " << Tr << endl;
+    if (not context.reduced_targets.emission.empty())
+      cout << "Expected emissions constitutive_range = " << Er << endl;
   }
 
-  // Compute gradient for each sequence
-  // int thread_idx = omp_get_thread_num();
-  // if(verbosity >= Verbosity::debug)
-  //   cout << "Thread " << thread_idx << " Data sample " <<  endl
-  //        << seq2string(seq.sequence) << endl;
+  double posterior = 1 - exp(logpr - logp);
 
-  // Compute expected statistics, for the full and reduced models
-  matrix_t T, Tr, E, Er;
-  double logp = BaumWelchIteration_single(T, E, seq, task.targets);
-  double logpr = subhmm.BaumWelchIteration_single(Tr, Er, seq, reduced_targets);
+  if (verbosity >= Verbosity::debug)
+    cout << "The posterior coming from the gradient calculus: " << posterior
+         << endl;
+  posterior_statistics_t result = {logp, logpr, posterior};
+  return result;
+}
 
-  Tr = subhmm.lift_transition(Tr);
-  Er = subhmm.lift_emission(Er);
+void HMM::add_posterior_statistics(PosteriorStatistics &sums,
+                                   const posterior_statistics_t &res,
+                                   double posterior_weight,
+                                   double likelihood_weight) const {
+  const Workspace &workspace = Workspace::local();
+  // the posterior gradient is the ratio of the likelihoods of the reduced and
+  // the full model times the difference of their log likelihood gradients
+  const double ratio = exp(res.reduced_log_likelihood - res.log_likelihood);
+  const double full_weight = posterior_weight * ratio + likelihood_weight;
+  const double reduced_weight = posterior_weight * ratio;
+  // noalias() avoids the temporary that ublas would otherwise allocate
+  if (sums.full.T.size1() > 0)
+    noalias(sums.full.T) += full_weight * workspace.transition_stats;
+  if (sums.full.E.size1() > 0)
+    noalias(sums.full.E) += full_weight * workspace.emission_stats;
+  if (sums.reduced.T.size1() > 0)
+    noalias(sums.reduced.T)
+        += reduced_weight * workspace.reduced_transition_stats;
+  if (sums.reduced.E.size1() > 0)
+    noalias(sums.reduced.E)
+        += reduced_weight * workspace.reduced_emission_stats;
+  sums.full.log_likel += res.log_likelihood;
+  sums.reduced.log_likel += res.reduced_log_likelihood;
+}
 
-  if (verbosity >= Verbosity::debug)
-    cout << "Full logp = " << logp << endl << "Reduced logp = " << logpr << endl
-         << "Expected transitions full = " << T << endl
-         << "Expected emissions full = " << E << endl
-         << "Expected transitions constitutive_range = " << Tr << endl
-         << "Expected emissions constitutive_range = " << Er << endl;
+void HMM::posterior_gradient(const PosteriorStatistics &sums,
+                             const PosteriorGradientContext &context,
+                             matrix_t &transition_g,
+                             matrix_t &emission_g) const {
+  const Training::Targets &targets = context.task.targets;
+  const SubHMM &subhmm = context.reduced;
 
-  if (not task.targets.transition.empty()) {
+  if (not targets.transition.empty()) {
     // Compute log likelihood gradients for the full model w.r.t. transition
     // probability
-    matrix_t t = transition_gradient(T, task.targets.transition);
+    transition_g += transition_gradient(sums.full.T, targets.transition);
     // Compute log likelihood gradients for the reduced model w.r.t. transition
     // probability
-    matrix_t tr = transition_gradient(Tr, task.targets.transition);
-
-    // Compute posterior probability gradients for the reduced model w.r.t.
-    // transition probability and accumulate
-    transition_g += exp(logpr - logp) * (t - tr);
+    if (sums.reduced.T.size1() > 0)
+      transition_g
+          -= transition_gradient(sums.reduced.T, subhmm, targets.transition);
   }
 
-  if (not task.targets.emission.empty()) {
+  if (not targets.emission.empty()) {
     // Compute log likelihood gradients for the full model w.r.t. emission
     // probability
-    matrix_t e = emission_gradient(E, task.targets.emission);
+    emission_g += emission_gradient(sums.full.E, targets.emission);
     // Compute log likelihood gradients for the reduced model w.r.t. emission
     // probability
-    matrix_t er = emission_gradient(Er, task.targets.emission);
-
-    // Compute posterior probability gradients for the reduced model w.r.t.
-    // emission probability and accumulate
-    emission_g += exp(logpr - logp) * (e - er);
+    if (sums.reduced.E.size1() > 0)
+      emission_g -= emission_gradient(sums.reduced.E, subhmm, targets.emission);
   }
+}
 
-  double posterior = 1 - exp(logpr - logp);
-
-  if (verbosity >= Verbosity::verbose)
-    cout << "The posterior coming from the gradient calculus: " << posterior
-         << endl;
-  posterior_gradient_t result = {logp, posterior, T, E};
-  return result;
+/** Print the targets of the posterior gradient and those mapped to the
+ * reduced model. */
+static void print_targets(const PosteriorGradientContext &context) {
+  const Training::Targets &targets = context.task.targets;
+  cout << "targets emission = ";
+  for (auto &x : targets.emission)
+    cout << " " << x;
+  cout << endl;
+  cout << "targets transition = ";
+  for (auto &x : targets.transition)
+    cout << " " << x;
+  cout << endl;
+  cout << "reduced targets emission = ";
+  for (auto &x : context.reduced_targets.emission)
+    cout << " " << x;
+  cout << endl;
+  cout << "reduced targets transition = ";
+  for (auto &x : context.reduced_targets.transition)
+    cout << " " << x;
+  cout << endl;
 }
 
 HMM::posterior_t HMM::posterior_gradient(const Data::Set &dataset,
@@ -947,135 +947,46 @@ HMM::posterior_t HMM::posterior_gradient(const Data::Set &dataset,
                                          bitmask_t present,
                                          matrix_t &transition_g,
                                          matrix_t &emission_g) const {
-  // Training::Task task(task_);
   if (verbosity >= Verbosity::verbose)
     cout << "Posterior gradient calculation (Feature)." << endl;
 
-  SubHMM subhmm(*this, complementary_states_mask(present));
-
-  // cout << subhmm << endl;
+  const PosteriorGradientContext context(
+      *this, complementary_states_mask(present), task, dataset, present);
 
-  if (verbosity >= Verbosity::debug) {
-    cout << "Transition targets are";
-    for (auto x : task.targets.transition)
-      cout << " " << x;
-    cout << endl;
-    cout << "Emission targets are";
-    for (auto x : task.targets.emission)
-      cout << " " << x;
-    cout << endl;
-  }
+  if (verbosity >= Verbosity::debug)
+    print_targets(context);
 
   if (not task.targets.transition.empty())
     transition_g = zero_matrix(n_states, n_states);
   if (not task.targets.emission.empty())
     emission_g = zero_matrix(n_states, n_emissions);
   double posterior = 0;
-  vector<matrix_t> t_g, e_g;
-
-  Training::Targets reduced_targets = subhmm.map_down(task.targets);
-
-  if (verbosity >= Verbosity::debug) {
-    cout << "targets emission = ";
-    for (auto &x : task.targets.emission)
-      cout << " " << x;
-    cout << endl;
-    cout << "targets transition = ";
-    for (auto &x : task.targets.transition)
-      cout << " " << x;
-    cout << endl;
-    cout << "reduced targets emission = ";
-    for (auto &x : reduced_targets.emission)
-      cout << " " << x;
-    cout << endl;
-    cout << "reduced targets transition = ";
-    for (auto &x : reduced_targets.transition)
-      cout << " " << x;
-    cout << endl;
-  }
-
   double l = 0;
 
-#pragma omp parallel shared(emission_g, transition_g) if (DO_PARALLEL)
-  {
-#pragma omp single
-    // Initalize storage for thread intermediate results
-    {
-      size_t n_threads = omp_get_num_threads();
-      //    cout << "B Num threads = " << n_threads << endl;
-      if (not task.targets.transition.empty())
-        t_g = vector<matrix_t>(
-            n_threads, zero_matrix(transition_g.size1(), transition_g.size2()));
-      if (not task.targets.emission.empty())
-        e_g = vector<matrix_t>(
-            n_threads, zero_matrix(emission_g.size1(), emission_g.size2()));
-    }
-
-#pragma omp for reduction(+ : posterior, l)
+  const size_t n_seqs = dataset.sequences.size();
+  const size_t n_chunks = min(n_seqs, n_reduction_chunks);
+  if (n_chunks > 0) {
+    vector<PosteriorStatistics> partials(n_chunks,
+                                         PosteriorStatistics(*this, context));
+#pragma omp parallel for schedule(dynamic) reduction(+ : posterior, l) \
+    if (DO_PARALLEL)
     // Compute gradient for each sequence
-    for (size_t i = 0; i < dataset.sequences.size(); i++) {
-      int thread_idx = omp_get_thread_num();
-      if (verbosity >= Verbosity::debug)
-        cout << "Thread " << thread_idx << " Data sample " << i << endl
-             << seq2string(dataset.sequences[i].isequence) << endl;
-
-      // Compute expected statistics, for the full and reduced models
-      matrix_t T, Tr, E, Er;
-      double logp
-          = BaumWelchIteration_single(T, E, dataset.sequences[i], task.targets);
-      double logpr = subhmm.BaumWelchIteration_single(
-          Tr, Er, dataset.sequences[i], reduced_targets);
-
-      Tr = subhmm.lift_transition(Tr);
-      Er = subhmm.lift_emission(Er);
-
-      if (verbosity >= Verbosity::debug)
-        cout << "Full logp = " << logp << endl << "Reduced logp = " << logpr
-             << endl << "Expected transitions full = " << T << endl
-             << "Expected emissions full = " << E << endl
-             << "Expected transitions constitutive_range = " << Tr << endl
-             << "Expected emissions constitutive_range = " << Er << endl;
-
-      if (not task.targets.transition.empty()) {
-        // Compute log likelihood gradients for the full model w.r.t. transition
-        // probability
-        matrix_t t = transition_gradient(T, task.targets.transition);
-        // Compute log likelihood gradients for the reduced model w.r.t.
-        // transition probability
-        matrix_t tr = transition_gradient(Tr, task.targets.transition);
-
-        // Compute posterior probability gradients for the reduced model w.r.t.
-        // transition probability and accumulate
-        t_g[thread_idx] += exp(logpr - logp) * (t - tr);
+    for (size_t chunk = 0; chunk < n_chunks; chunk++) {
+      const size_t end = chunk_begin(chunk + 1, n_chunks, n_seqs);
+      for (size_t i = chunk_begin(chunk, n_chunks, n_seqs); i < end; i++) {
+        if (verbosity >= Verbosity::debug)
+          cout << "Thread " << omp_get_thread_num() << " Data sample " << i
+               << endl << dataset.sequences[i].sequence() << endl;
+
+        const posterior_statistics_t res = posterior_statistics(i, context);
+        add_posterior_statistics(partials[chunk], res, 1);
+
+        posterior += res.posterior;
+        l += res.log_likelihood;
       }
-
-      if (not task.targets.emission.empty()) {
-        // Compute log likelihood gradients for the full model w.r.t. emission
-        // probability
-        matrix_t e = emission_gradient(E, task.targets.emission);
-        // Compute log likelihood gradients for the reduced model w.r.t.
-        // emission probability
-        matrix_t er = emission_gradient(Er, task.targets.emission);
-
-        // Compute posterior probability gradients for the reduced model w.r.t.
-        // emission probability and accumulate
-        e_g[thread_idx] += exp(logpr - logp) * (e - er);
-      }
-
-      posterior += 1 - exp(logpr - logp);
-      l += logp;
-    }
-
-#pragma omp single
-    // Collect results of threads
-    {
-      if (not task.targets.transition.empty())
-        for (auto &x : t_g)
-          transition_g += x;
-      if (not task.targets.emission.empty())
-        for (auto &x : e_g)
-          emission_g += x;
     }
+    tree_reduce(partials);
+    posterior_gradient(partials[0], context, transition_g, emission_g);
   }
 
   if (verbosity >= Verbosity::verbose)
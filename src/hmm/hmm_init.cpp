@@ -33,9 +33,12 @@ using namespace std;
 
 void HMM::finalize_initialization() {
   initialize_pred_succ();
+  compile_topology();
   check_consistency();
 }
 
+void HMM::compile_topology() { topology = Topology(transition, emission); }
+
 void HMM::initialize_pred_succ() {
   pred = vector<vector<size_t>>();
   succ = vector<vector<size_t>>();
@@ -29,9 +29,11 @@
 
 #include <fstream>
 #include <iomanip>
+#include <set>
 #include "../timer.hpp"
 #include "../aux.hpp"
 #include "hmm.hpp"
+#include "reduction.hpp"
 #include "../format_constants.hpp"
 
 using namespace std;
@@ -96,6 +98,7 @@ void HMM::train_background(const Data::Collection &collection,
 
   if (transition.size1() > bg_hmm.transition.size1())
     throw Exception::HMM::Learning::TrainBgTooLate();
+  compile_topology();
 
   if (options.verbosity >= Verbosity::debug)
     cout << *this << endl;
@@ -120,7 +123,8 @@ void HMM::initialize_bg_with_bw(const Data::Collection &collection,
 
 Training::Result HMM::train(const Data::Collection &collection,
                             const Training::Tasks &tasks,
-                            const Options::HMM &options) {
+                            const Options::HMM &options,
+                            Training::Leaderboard *leaderboard) {
   Training::Result result;
   if (options.verbosity >= Verbosity::verbose)
     cout << "Model to be evaluated = " << *this << endl;
@@ -145,6 +149,8 @@ Training::Result HMM::train(const Data::Collection &collection,
         cout << "Performing training." << endl;
       Timer learning_timer;
 
+      reserve_workspaces(collection);
+
       if (options.verbosity >= Verbosity::verbose)
         cout << "Registering data sets for class based HMMs." << endl;
 
@@ -157,7 +163,7 @@ Training::Result HMM::train(const Data::Collection &collection,
                                  options.conditional_motif_prior1,
                                  options.conditional_motif_prior2);
 
-      result = train_inner(collection, tasks, options);
+      result = train_inner(collection, tasks, options, leaderboard);
       if (options.verbosity >= Verbosity::verbose)
         cout << endl << "The parameters changed by an L1-norm of "
              << result.delta << endl;
@@ -184,7 +190,8 @@ Training::Result HMM::train(const Data::Collection &collection,
 
 Training::Result HMM::train_inner(const Data::Collection &collection,
                                   const Training::Tasks &tasks,
-                                  const Options::HMM &options) {
+                                  const Options::HMM &options,
+                                  Training::Leaderboard *leaderboard) {
   Training::Result result;
   if (tasks.empty())
     return result;
@@ -211,22 +218,52 @@ Training::Result HMM::train_inner(const Data::Collection &collection,
           }
         }
     } else
-      result.state = iterative_training(collection, tasks, options);
+      result.state
+          = iterative_training(collection, tasks, options, leaderboard);
     result.delta = norml1(previous.emission - emission)
                    + norml1(previous.transition - transition);
     return result;
   }
 }
 
+void HMM::reserve_workspaces(const Data::Collection &collection) const {
+  size_t max_len = 0;
+  for (auto &contrast : collection)
+    for (auto &dataset : contrast)
+      for (auto &seq : dataset)
+        max_len = max<size_t>(max_len, seq.isequence.size());
+#pragma omp parallel if (DO_PARALLEL)
+  Workspace::local().reserve(max_len, n_states);
+}
+
+HMM::ExpectedStatistics::ExpectedStatistics(size_t n_states,
+                                            size_t n_emissions,
+                                            const Training::Targets &targets)
+    : log_likel(0), T(), E() {
+  if (not targets.transition.empty())
+    T = zero_matrix(n_states, n_states);
+  if (not targets.emission.empty())
+    E = zero_matrix(n_states, n_emissions);
+}
+
+HMM::ExpectedStatistics &HMM::ExpectedStatistics::operator+=(
+    const ExpectedStatistics &x) {
+  log_likel += x.log_likel;
+  if (T.size1() > 0)
+    T += x.T;
+  if (E.size1() > 0)
+    E += x.E;
+  return *this;
+}
+
 double HMM::BaumWelchIteration(matrix_t &T, matrix_t &E,
                                const Data::Collection &collection,
-                               const Training::Targets &targets,
-                               const Options::HMM &options) const {
+                               const Training::Targets &targets) const {
   double log_likel = 0;
   for (auto &contrast : collection)
     for (auto &dataset : contrast)
       if (not dataset.is_control)
-        log_likel += BaumWelchIteration(T, E, dataset, targets, options);
+        log_likel += BaumWelchIteration(T, E, dataset, targets);
   if (verbosity >= Verbosity::debug)
     cout << "Done BaumWelchIteration(Collection) log_likel = " << log_likel
          << endl;
@@ -235,129 +272,150 @@ double HMM::BaumWelchIteration(matrix_t &T, matrix_t &E,
 
 double HMM::BaumWelchIteration(matrix_t &T, matrix_t &E,
                                const Data::Set &dataset,
-                               const Training::Targets &targets,
-                               const Options::HMM &options) const {
-  double log_likel = 0;
-  // TODO find out if there's a performance benefit to the split-up critical
-  // regions.
-#pragma omp parallel for reduction(+ : log_likel) shared(E, T) if (DO_PARALLEL)
-  for (size_t j = 0; j < dataset.sequences.size(); j++)
-    log_likel += BaumWelchIteration(T, E, dataset.sequences[j], targets);
+                               const Training::Targets &targets) const {
+  const size_t n_seqs = dataset.sequences.size();
+  const size_t n_chunks = min(n_seqs, n_reduction_chunks);
+  if (n_chunks == 0)
+    return 0;
+  vector<ExpectedStatistics> partials(
+      n_chunks, ExpectedStatistics(n_states, n_emissions, targets));
+#pragma omp parallel for schedule(dynamic) if (DO_PARALLEL)
+  for (size_t chunk = 0; chunk < n_chunks; chunk++) {
+    ExpectedStatistics &partial = partials[chunk];
+    const size_t end = chunk_begin(chunk + 1, n_chunks, n_seqs);
+    for (size_t j = chunk_begin(chunk, n_chunks, n_seqs); j < end; j++)
+      partial.log_likel += BaumWelchIteration(
+          partial.T, partial.E, dataset.sequences[j], targets);
+  }
+  tree_reduce(partials);
+  if (not targets.transition.empty())
+    T += partials[0].T;
+  if (not targets.emission.empty())
+    E += partials[0].E;
+  double log_likel = partials[0].log_likel;
   if (verbosity >= Verbosity::debug)
     cout << "Done BaumWelchIteration(Seqs) log_likel = " << log_likel << endl;
   return log_likel;
 }
 
-double HMM::BaumWelchIteration_single(matrix_t &T, matrix_t &E,
-                                      const Data::Seq &s,
-                                      const Training::Targets &targets) const {
-  size_t L = s.isequence.size();
+HMM::ExpectedStatistics HMM::expected_statistics(
+    const Data::Seq &s, const Training::Targets &targets) const {
+  ExpectedStatistics stats(n_states, n_emissions, targets);
+  stats.log_likel = expected_statistics(s, targets, stats.T, stats.E);
+  return stats;
+}
 
-  vector_t scale;
-  matrix_t f = compute_forward_scaled(s, scale);
-  matrix_t b = compute_backward_prescaled(s, scale);
+double HMM::expected_statistics(const Data::Seq &s,
+                                const Training::Targets &targets, matrix_t &T,
+                                matrix_t &E, const vector<size_t> &states,
+                                double *posteriors) const {
+  // without targets and posteriors only the likelihood is needed, for which
+  // the forward pass suffices
+  if (targets.transition.empty() and targets.emission.empty()
+      and posteriors == nullptr)
+    return log_likelihood(s);
+
+  // the posteriors are summed up position by position with checkpointing
+  if (posteriors != nullptr)
+    fill(posteriors, posteriors + states.size(), 0.0);
+
+  const size_t L = s.isequence.size();
+  Workspace &workspace = Workspace::local();
+  DPVector &scale = workspace.scale;
+
+  // transitions from position i; for i == L the one to the start state
+  auto add_transitions = [&](size_t i, const double *f_i,
+                             const double *b_next) {
+    if (i == L) {
+      for (auto pre : pred[start_state])
+        T(pre, start_state) += f_i[pre] * transition(pre, start_state)
+                               * b_next[start_state];
+      return;
+    }
+    size_t symbol = s.isequence(i);
+    if (symbol == empty_symbol)
+      for (auto k : targets.transition)
+        T(k, start_state) += f_i[k] * transition(k, start_state)
+                             * b_next[start_state];
+    else
+      // TODO change the order of the loops
+      for (auto k : targets.transition) {
+        double f_i_k = f_i[k];
+        for (auto suc : succ[k])
+          T(k, suc) += f_i_k * transition(k, suc) * emission(suc, symbol)
+                       * b_next[suc];
+      }
+  };
+
+  // emissions of the symbol at position t - 1
+  auto add_emissions = [&](size_t t, const double *f_t, const double *b_t) {
+    size_t symbol = s.isequence(t - 1);
+    if (symbol != empty_symbol)
+      for (auto k : targets.emission)
+        E(k, symbol) += f_t[k] * b_t[k] * scale[t];
+  };
+
+  if (use_checkpointing(L))
+    forward_backward_checkpointed(
+        s, scale,
+        [&](size_t t, const double *f, const double *b, const double *b_next) {
+          if (t <= L and not targets.transition.empty())
+            add_transitions(t, f, b_next);
+          if (t >= 1 and t <= L and not targets.emission.empty())
+            add_emissions(t, f, b);
+          if (posteriors != nullptr)
+            for (size_t j = 0; j < states.size(); j++)
+              posteriors[j] += f[states[j]] * b[states[j]] * scale[t];
+        });
+  else {
+    DPMatrix &f = workspace.forward;
+    DPMatrix &b = workspace.backward;
+    compute_forward_scaled(s, f, scale);
+    compute_backward_prescaled(s, scale, b);
 
-  double log_likel = log_likelihood_from_scale(scale);
+    if (not targets.transition.empty())
+      for (size_t i = 0; i <= L; i++)
+        add_transitions(i, f.row(i), b.row(i + 1));
 
-  if (not targets.transition.empty()) {
-    if (not(T.size1() == n_states and T.size2() == n_states))
-      T = zero_matrix(n_states, n_states);
-
-    // for all transitions except the one to the start state
-    for (size_t i = 0; i < L; i++) {
-      size_t symbol = s.isequence(i);
-      if (symbol == empty_symbol)
-        for (auto k : targets.transition)
-          T(k, start_state) += f(i, k) * transition(k, start_state)
-                               * b(i + 1, start_state);
-      else
-        // TODO change the order of the loops
-        for (auto k : targets.transition) {
-          double f_i_k = f(i, k);
-          for (auto suc : succ[k])
-            T(k, suc) += f_i_k * transition(k, suc) * emission(suc, symbol)
-                         * b(i + 1, suc);
-        }
-    }
+    if (not targets.emission.empty())
+      for (size_t t = 1; t <= L; t++)
+        add_emissions(t, f.row(t), b.row(t));
 
-    // for the transition to the start_state
-    for (auto pre : pred[start_state])
-      T(pre, start_state) += f(L, pre) * transition(pre, start_state)
-                             * b(L + 1, start_state);
+    if (posteriors != nullptr)
+      for (size_t j = 0; j < states.size(); j++)
+        posteriors[j] = expected_state_posterior(states[j], f, b, scale);
   }
 
-  if (not targets.emission.empty()) {
-    if (not(E.size1() == n_states and E.size2() == n_emissions))
-      E = zero_matrix(n_states, n_emissions);
-
-    for (size_t i = 0; i < L; i++) {
-      size_t symbol = s.isequence(i);
-      if (symbol != empty_symbol)
-        for (auto k : targets.emission)
-          E(k, symbol) += f(i + 1, k) * b(i + 1, k) * scale(i + 1);
-    }
-  }
-  return log_likel;
+  return log_likelihood_from_scale(scale);
 }
 
 double HMM::BaumWelchIteration(matrix_t &T, matrix_t &E, const Data::Seq &s,
                                const Training::Targets &targets) const {
-  size_t L = s.isequence.size();
-
-  vector_t scale;
-  matrix_t f = compute_forward_scaled(s, scale);
-  matrix_t b = compute_backward_prescaled(s, scale);
+  Workspace &workspace = Workspace::local();
+  matrix_t &t = workspace.transition_stats;
+  matrix_t &e = workspace.emission_stats;
+  if (not targets.transition.empty()) {
+    t.resize(n_states, n_states, false);
+    t.clear();
+  }
+  if (not targets.emission.empty()) {
+    e.resize(n_states, n_emissions, false);
+    e.clear();
+  }
 
-  double log_likel = log_likelihood_from_scale(scale);
+  double log_likel = expected_statistics(s, targets, t, e);
   if (verbosity >= Verbosity::debug)
     cerr << "log_likel = " << log_likel << endl;
 
   if (not targets.transition.empty()) {
-    matrix_t t = zero_matrix(n_states, n_states);
-
-    // for all transitions except the one to the start state
-    for (size_t i = 0; i < L; i++) {
-      size_t symbol = s.isequence(i);
-      if (symbol == empty_symbol)
-        for (auto k : targets.transition)
-          t(k, start_state) += f(i, k) * transition(k, start_state)
-                               * b(i + 1, start_state);
-      else
-        // TODO change the order of the loops
-        for (auto k : targets.transition) {
-          double f_i_k = f(i, k);
-          for (auto suc : succ[k])
-            t(k, suc) += f_i_k * transition(k, suc) * emission(suc, symbol)
-                         * b(i + 1, suc);
-        }
-    }
-
-    // for the transition to the start_state
-    for (auto pre : pred[start_state])
-      t(pre, start_state) += f(L, pre) * transition(pre, start_state)
-                             * b(L + 1, start_state);
-
     if (verbosity >= Verbosity::debug)
       cerr << "t = " << t << endl;
-
-#pragma omp critical(update_T)
     T += t;
   }
 
   if (not targets.emission.empty()) {
-    matrix_t e = zero_matrix(n_states, n_emissions);
-
-    for (size_t i = 0; i < L; i++) {
-      size_t symbol = s.isequence(i);
-      if (symbol != empty_symbol)
-        for (auto k : targets.emission)
-          e(k, symbol) += f(i + 1, k) * b(i + 1, k) * scale(i + 1);
-    }
-
     if (verbosity >= Verbosity::debug)
       cerr << "e = " << e << endl;
-
-#pragma omp critical(update_E)
     E += e;
   }
   if (verbosity >= Verbosity::debug)
@@ -367,49 +425,54 @@ double HMM::BaumWelchIteration(matrix_t &T, matrix_t &E, const Data::Seq &s,
 
 double HMM::ViterbiIteration(matrix_t &T, matrix_t &E,
                              const Data::Collection &collection,
-                             const Training::Targets &targets,
-                             const Options::HMM &options) {
+                             const Training::Targets &targets) {
   double log_likel = 0;
   for (auto &contrast : collection)
     for (auto &dataset : contrast)
-      log_likel += ViterbiIteration(T, E, dataset, targets, options);
+      log_likel += ViterbiIteration(T, E, dataset, targets);
   return log_likel;
 }
 
 double HMM::ViterbiIteration(matrix_t &T, matrix_t &E, const Data::Set &dataset,
-                             const Training::Targets &training_targets,
-                             const Options::HMM &options) {
-  double log_likel = 0;
-#pragma omp parallel for reduction(+ : log_likel) shared(E, T) if (DO_PARALLEL)
-  for (size_t j = 0; j < dataset.sequences.size(); j++) {
+                             const Training::Targets &training_targets) {
+  const size_t n_seqs = dataset.sequences.size();
+  const size_t n_chunks = min(n_seqs, n_reduction_chunks);
+  if (n_chunks == 0)
+    return 0;
+  vector<ExpectedStatistics> partials(
+      n_chunks, ExpectedStatistics(n_states, n_emissions, training_targets));
+#pragma omp parallel if (DO_PARALLEL)
+  {
+    Viterbi decoder = viterbi_decoder();
     StatePath path;
-    double cur_log_likel = viterbi(dataset.sequences[j], path);
-
-    size_t L = dataset.sequences[j].isequence.size();
-
-    matrix_t t = zero_matrix(n_states, n_states);
-    if (not training_targets.transition.empty()) {
-      t(start_state, path[0]) += 1;
-      for (size_t i = 0; i < L - 1; i++)
-        t(path[i], path[i + 1]) += 1;
-      t(path[L - 1], start_state) += 1;
-    }
+#pragma omp for schedule(dynamic)
+    for (size_t chunk = 0; chunk < n_chunks; chunk++) {
+      ExpectedStatistics &partial = partials[chunk];
+      const size_t end = chunk_begin(chunk + 1, n_chunks, n_seqs);
+      for (size_t j = chunk_begin(chunk, n_chunks, n_seqs); j < end; j++) {
+        partial.log_likel += decoder.decode(dataset.sequences[j], path);
+
+        size_t L = dataset.sequences[j].isequence.size();
+
+        if (not training_targets.transition.empty()) {
+          partial.T(start_state, path[0]) += 1;
+          for (size_t i = 0; i < L - 1; i++)
+            partial.T(path[i], path[i + 1]) += 1;
+          partial.T(path[L - 1], start_state) += 1;
+        }
 
-    matrix_t e = zero_matrix(n_states, n_emissions);
-    if (not training_targets.emission.empty())
-      for (size_t i = 0; i < L; i++)
-        e(path[i], dataset.sequences[j].isequence[i]) += 1;
-
-#pragma omp critical
-    {
-      if (not training_targets.emission.empty())
-        E += e;
-      if (not training_targets.transition.empty())
-        T += t;
+        if (not training_targets.emission.empty())
+          for (size_t i = 0; i < L; i++)
+            partial.E(path[i], dataset.sequences[j].isequence[i]) += 1;
+      }
     }
-    log_likel += cur_log_likel;
   }
-  return log_likel;
+  tree_reduce(partials);
+  if (not training_targets.transition.empty())
+    T += partials[0].T;
+  if (not training_targets.emission.empty())
+    E += partials[0].E;
+  return partials[0].log_likel;
 }
 
 void HMM::reestimation(const Data::Collection &collection,
@@ -434,10 +497,10 @@ double HMM::reestimationIteration(const Data::Collection &collection,
 
   switch (task.measure) {
     case Measure::Likelihood:
-      log_likel = BaumWelchIteration(T, E, collection, task.targets, options);
+      log_likel = BaumWelchIteration(T, E, collection, task.targets);
       break;
     case Measure::Viterbi:
-      log_likel = ViterbiIteration(T, E, collection, task.targets, options);
+      log_likel = ViterbiIteration(T, E, collection, task.targets);
       break;
     default:
       break;
@@ -492,6 +555,7 @@ void HMM::M_Step(const matrix_t &T_, const matrix_t &E_,
   for (auto t : targets.emission)
     for (size_t j = 0; j < n_emissions; j++)
       emission(t, j) = E(t, j);
+  compile_topology();
 
   if (verbosity >= Verbosity::verbose) {
     if (not targets.transition.empty())
@@ -547,6 +611,16 @@ Gradient HMM::compute_gradient(const Data::Collection &collection,
   return gradient;
 }
 
+double HMM::compute_score(const Data::Collection &collection,
+                          const Training::Task &task, bool weighting) const {
+  // without targets, the gradient computation only determines the score
+  Training::Task score_task = task;
+  score_task.targets = Training::Targets();
+  double score;
+  compute_gradient(collection, score, score_task, weighting);
+  return score;
+}
+
 Gradient HMM::compute_gradient(const Data::Contrast &contrast, double &score,
                                const Training::Task &task) const {
   if (verbosity >= Verbosity::verbose)
@@ -609,7 +683,8 @@ double HMM::compute_gradient(const Data::Contrast &contrast, Gradient &gradient,
 
 Training::State HMM::iterative_training(const Data::Collection &collection,
                                         const Training::Tasks &tasks,
-                                        const Options::HMM &options) {
+                                        const Options::HMM &options,
+                                        Training::Leaderboard *leaderboard) {
   Training::State state(tasks.size());
   size_t iteration = 0;
 
@@ -625,10 +700,29 @@ Training::State HMM::iterative_training(const Data::Collection &collection,
 
   Gradient gradient, conjugate;
   size_t cg_niter = 0;
+  // the curvature pairs of one task do not apply to the others
+  vector<LBFGSHistory> lbfgs(tasks.size());
+  // like the L-BFGS history, the moment estimates and the full-data
+  // evaluation of stochastic training are specific to a task
+  vector<StochasticState> stochastic;
+  for (size_t task_idx = 0; task_idx < tasks.size(); task_idx++)
+    stochastic.push_back(StochasticState(options.random_salt + task_idx,
+                                         options.stochastic.rate));
   while ((iteration++ < options.termination.max_iter
           or options.termination.max_iter == 0)
          and perform_training_iteration(collection, tasks, options, state,
-                                        gradient, conjugate, cg_niter))
+                                        gradient, conjugate, cg_niter, lbfgs,
+                                        stochastic)) {
+    if (leaderboard != nullptr and not state.scores[0].empty()
+        and not leaderboard->report(state.scores[0].size(),
+                                    state.scores[0].back())) {
+      if (verbosity >= Verbosity::info)
+        cout << "Abandoning training: score " << state.scores[0].back()
+             << " trails the best score of the alternative models after "
+             << state.scores[0].size() << " iterations." << endl;
+      state.abandoned = true;
+      break;
+    }
     if (verbosity >= Verbosity::info) {
       cout << endl << "Iteration                                      "
            << iteration << endl;
@@ -640,6 +734,10 @@ Training::State HMM::iterative_training(const Data::Collection &collection,
                << groups[group_idx].name << ":"
                << get_group_consensus(group_idx) << endl;
     }
+  }
+  if (leaderboard != nullptr and not state.abandoned
+      and not state.scores[0].empty())
+    leaderboard->report(state.scores[0].size(), state.scores[0].back(), true);
 
   if (verbosity >= Verbosity::info) {
     cout << endl << "Finished after " << iteration << " iterations." << endl
@@ -652,6 +750,20 @@ Training::State HMM::iterative_training(const Data::Collection &collection,
         cout << " " << groups[group_idx].name << ":"
              << get_group_consensus(group_idx);
     cout << endl;
+    if (state.n_evaluations > 0)
+      cout << "Function and gradient evaluations " << state.n_evaluations
+           << endl;
+    if (options.conjugate.mode == Options::Conjugate::Mode::LBFGS) {
+      size_t n_rejected = 0;
+      for (auto &history : lbfgs)
+        n_rejected += history.n_rejected;
+      cout << "L-BFGS pairs rejected for curvature " << n_rejected << endl;
+    }
+    size_t n_batches = 0;
+    for (auto &state : stochastic)
+      n_batches += state.n_batches;
+    if (n_batches > 0)
+      cout << "Mini-batch gradient evaluations " << n_batches << endl;
   }
 
   return state;
@@ -660,12 +772,12 @@ Training::State HMM::iterative_training(const Data::Collection &collection,
 bool HMM::perform_training_iteration(
     const Data::Collection &collection, const Training::Tasks &tasks,
     const Options::HMM &options, Training::State &state,
-    Gradient &prev_gradient, Gradient &prev_conjugate, size_t &cg_niter) {
+    Gradient &prev_gradient, Gradient &prev_conjugate, size_t &cg_niter,
+    vector<LBFGSHistory> &lbfgs, vector<StochasticState> &stochastic) {
   bool done = true;
 
-  size_t task_idx = 0;
-
-  for (auto task : tasks) {
+  for (size_t task_idx = 0; task_idx < tasks.size(); task_idx++) {
+    const Training::Task &task = tasks[task_idx];
     double score = -numeric_limits<double>::infinity();
     if (task.measure != Measure::Undefined) {
       if (store_intermediate)
@@ -708,10 +820,17 @@ bool HMM::perform_training_iteration(
         score
             = *(state.scores[task_idx].rbegin() + options.termination.past - 1);
 
-      if (Training::measure2method(task.measure) == Training::Method::Gradient)
+      if (Training::measure2method(task.measure) == Training::Method::Gradient
+          and options.stochastic.batch_size > 0)
+        done = perform_training_iteration_stochastic(
+                   collection, task, options, score, state.n_evaluations,
+                   stochastic[task_idx]) and done;
+      else if (Training::measure2method(task.measure)
+               == Training::Method::Gradient)
         done = perform_training_iteration_gradient(
                    collection, task, options, state.center, score,
-                   prev_gradient, prev_conjugate, cg_niter) and done;
+                   state.n_evaluations, prev_gradient, prev_conjugate,
+                   cg_niter, lbfgs[task_idx]) and done;
 
       if (Training::measure2method(task.measure)
           == Training::Method::Reestimation)
@@ -721,11 +840,19 @@ bool HMM::perform_training_iteration(
       if ((task.measure == Measure::ClassificationPosterior
            or task.measure == Measure::ClassificationLikelihood)
           and (not(options.dont_learn_class_prior
-                   and options.dont_learn_conditional_motif_prior)))
+                   and options.dont_learn_conditional_motif_prior))) {
         done = reestimate_class_parameters(collection, task, options, score)
                and done;
+        stochastic[task_idx].evaluated = false;
+      }
+
+      // the parameters changed, so that the full-data evaluations of the
+      // other tasks no longer apply
+      for (size_t other_idx = 0; other_idx < tasks.size(); other_idx++)
+        if (other_idx != task_idx)
+          stochastic[other_idx].evaluated = false;
     }
-    state.scores[task_idx++].push_back(score);
+    state.scores[task_idx].push_back(score);
   }
 
   if (store_intermediate)
@@ -882,6 +1009,7 @@ Gradient compute_conjugate(Gradient gradient, Gradient &prev_gradient,
 
     switch (cg_options.mode) {
       case Options::Conjugate::Mode::None:
+      case Options::Conjugate::Mode::LBFGS:
         break;
       case Options::Conjugate::Mode::FletcherReeves:
         beta = scalar_product(gradient, gradient)
@@ -929,10 +1057,86 @@ Gradient compute_conjugate(Gradient gradient, Gradient &prev_gradient,
   return conjugate;
 }
 
+/** y += a * x */
+void add_scaled(Gradient &y, double a, const Gradient &x) {
+  if (y.transition.size1() > 0)
+    y.transition += a * x.transition;
+  if (y.emission.size1() > 0)
+    y.emission += a * x.emission;
+}
+
+bool same_shape(const Gradient &a, const Gradient &b) {
+  return a.transition.size1() == b.transition.size1()
+         and a.transition.size2() == b.transition.size2()
+         and a.emission.size1() == b.emission.size1()
+         and a.emission.size2() == b.emission.size2();
+}
+
+/** Compute the L-BFGS ascent direction with the two-loop recursion. The
+ * history holds the pairs of the minimization of the negated objective. */
+Gradient lbfgs_direction(const Gradient &gradient,
+                         const LBFGSHistory &history) {
+  Gradient q = gradient;
+  const size_t m = history.s.size();
+  vector<double> alpha(m);
+  for (size_t k = m; k-- > 0;) {
+    alpha[k] = history.rho[k] * scalar_product(history.s[k], q);
+    add_scaled(q, -alpha[k], history.y[k]);
+  }
+  if (m > 0) {
+    // scale with the estimate of the inverse Hessian's magnitude
+    const double gamma = scalar_product(history.s[m - 1], history.y[m - 1])
+                         / scalar_product(history.y[m - 1], history.y[m - 1]);
+    q.transition *= gamma;
+    q.emission *= gamma;
+  }
+  for (size_t k = 0; k < m; k++) {
+    const double beta = history.rho[k] * scalar_product(history.y[k], q);
+    add_scaled(q, alpha[k] - beta, history.s[k]);
+  }
+  return q;
+}
+
+/** Add the curvature pair of the last iteration to the L-BFGS history, given
+ * the gradient at the current parameters. Pairs without positive curvature
+ * are rejected. */
+void update_lbfgs_history(LBFGSHistory &history, const Gradient &gradient,
+                          size_t memory, Verbosity verbosity) {
+  if (not same_shape(history.gradient, gradient)) {
+    // the targets changed; the previous pairs do not apply anymore
+    history.s.clear();
+    history.y.clear();
+    history.rho.clear();
+  } else if (same_shape(history.step, gradient)) {
+    Gradient y = history.gradient;
+    add_scaled(y, -1, gradient);
+    const double sy = scalar_product(history.step, y);
+    const double yy = scalar_product(y, y);
+    if (sy > 1e-10 * yy and sy > 0) {
+      history.s.push_back(history.step);
+      history.y.push_back(y);
+      history.rho.push_back(1 / sy);
+      while (history.s.size() > memory) {
+        history.s.pop_front();
+        history.y.pop_front();
+        history.rho.pop_front();
+      }
+    } else {
+      history.n_rejected++;
+      if (verbosity >= Verbosity::verbose)
+        cout << "Rejecting L-BFGS pair: s . y = " << sy << " y . y = " << yy
+             << endl;
+    }
+  }
+  history.step = Gradient();
+  history.gradient = gradient;
+}
+
 bool HMM::perform_training_iteration_gradient(
     const Data::Collection &collection, const Training::Task &task,
     const Options::HMM &options, int &center, double &score,
-    Gradient &prev_gradient, Gradient &prev_conjugate, size_t &cg_niter) {
+    size_t &n_evaluations, Gradient &prev_gradient, Gradient &prev_conjugate,
+    size_t &cg_niter, LBFGSHistory &lbfgs) {
   if (verbosity >= Verbosity::verbose)
     cerr << "HMM::perform_training_iteration_gradient" << endl;
 
@@ -949,6 +1153,7 @@ bool HMM::perform_training_iteration_gradient(
   double previous_score;
   Gradient gradient
       = compute_gradient(collection, previous_score, task, options.weighting);
+  n_evaluations++;
   double gradient_comp_time = timer.tock();
   if (options.timing_information)
     cerr << "Gradient computation time: "
@@ -970,13 +1175,38 @@ bool HMM::perform_training_iteration_gradient(
     cout << "The transition gradient is : " << gradient.transition << endl
          << "The emission gradient is : " << gradient.emission << endl;
 
-  if (options.conjugate.mode != Options::Conjugate::Mode::None) {
+  const bool use_lbfgs = options.conjugate.mode
+                         == Options::Conjugate::Mode::LBFGS;
+  Gradient direction;
+  double initial_step = 1;
+  if (use_lbfgs) {
+    update_lbfgs_history(lbfgs, gradient, options.conjugate.lbfgs_memory,
+                         verbosity);
+    direction = lbfgs_direction(gradient, lbfgs);
+    if (scalar_product(direction, gradient) <= 0) {
+      if (verbosity >= Verbosity::verbose)
+        cout << "L-BFGS direction is not an ascent direction; resetting."
+             << endl;
+      lbfgs.s.clear();
+      lbfgs.y.clear();
+      lbfgs.rho.clear();
+      direction = gradient;
+    }
+    // with curvature information the quasi-Newton step is tried first
+    if (not lbfgs.s.empty())
+      initial_step = sqrt(scalar_product(direction, direction));
+    if (verbosity >= Verbosity::verbose)
+      cout << "L-BFGS history size = " << lbfgs.s.size()
+           << " initial step = " << initial_step << endl;
+  } else if (options.conjugate.mode != Options::Conjugate::Mode::None) {
     gradient = compute_conjugate(gradient, prev_gradient, prev_conjugate,
                                  options.conjugate, cg_niter);
     if (verbosity >= Verbosity::verbose)
       cout << "The transition conjugate gradient is : " << gradient.transition << endl
         << "The emission conjugate gradient is : " << gradient.emission << endl;
   }
+  if (not use_lbfgs)
+    direction = gradient;
 
   double gradient_norm = sqrt(scalar_product(gradient, gradient));
   if (verbosity >= Verbosity::verbose)
@@ -1012,8 +1242,14 @@ bool HMM::perform_training_iteration_gradient(
       cout << "Skipping line search. Gradient norm is zero." << endl;
   } else {
     int info;
+    timer.tick();
     pair<double, HMM> res = line_search_more_thuente(
-        collection, gradient, previous_score, info, task, options);
+        collection, direction, gradient, initial_step, previous_score, info,
+        n_evaluations, task, options);
+    double line_search_time = timer.tock();
+    if (options.timing_information)
+      cerr << "Line search time: " + time_to_pretty_string(line_search_time)
+           << endl;
     if (info != 1)
       cout << "Line search exit status: " << info << " - "
            << line_search_status(info) << endl;
@@ -1083,6 +1319,8 @@ bool HMM::perform_training_iteration_gradient(
       cout << "Gradient norm criterion                        OK" << endl;
     done = rel_score_criterion or grad_norm_criterion;
     score = new_score;
+    if (use_lbfgs)
+      lbfgs.step = log_parameter_step(candidate, task.targets);
     *this = candidate;
   } else {
     score = previous_score;
@@ -1091,6 +1329,184 @@ bool HMM::perform_training_iteration_gradient(
   return done;
 }
 
+/** Draw a mini-batch of about n sequences. Each data set contributes in
+ * proportion to its size, and at least one sequence, so that the class priors
+ * keyed by the data sets' SHA1 hashes still apply. */
+Data::Collection sample_batch(const Data::Collection &collection, size_t n,
+                              mt19937 &rng) {
+  Data::Collection batch;
+  for (auto &contrast : collection) {
+    Data::Contrast sub;
+    sub.name = contrast.name;
+    for (auto &dataset : contrast) {
+      sub.sets.push_back(Data::Set());
+      Data::Set &set = sub.sets.back();
+      set.contrast = dataset.contrast;
+      set.path = dataset.path;
+      set.is_shuffle = dataset.is_shuffle;
+      set.is_control = dataset.is_control;
+      set.motifs = dataset.motifs;
+      set.sha1 = dataset.sha1;
+      const size_t N = dataset.sequences.size();
+      size_t k = round(1.0 * n * N / collection.set_size);
+      k = min<size_t>(N, max<size_t>(1, k));
+      // Floyd's algorithm for sampling k of N indices without replacement
+      std::set<size_t> indices;
+      for (size_t j = N - k; j < N; j++) {
+        size_t i = uniform_int_distribution<size_t>(0, j)(rng);
+        if (not indices.insert(i).second)
+          indices.insert(j);
+      }
+      for (auto i : indices) {
+        set.sequences.push_back(dataset.sequences[i]);
+        set.seq_size += dataset.sequences[i].size();
+      }
+      set.set_size = set.sequences.size();
+      sub.seq_size += set.seq_size;
+      sub.set_size += set.set_size;
+    }
+    batch.seq_size += sub.seq_size;
+    batch.set_size += sub.set_size;
+    batch.contrasts.push_back(move(sub));
+  }
+  return batch;
+}
+
+/** Update the Adam moment estimates of one parameter matrix with the gradient
+ * g, and store the bias-corrected step in step. */
+void adam_update(matrix_t &m, matrix_t &v, matrix_t &step, const matrix_t &g,
+                 size_t t, double rate, const Options::Stochastic &options) {
+  if (m.size1() != g.size1() or m.size2() != g.size2()) {
+    m = zero_matrix(g.size1(), g.size2());
+    v = zero_matrix(g.size1(), g.size2());
+  }
+  step = zero_matrix(g.size1(), g.size2());
+  const double c1 = 1 - pow(options.beta1, t);
+  const double c2 = 1 - pow(options.beta2, t);
+  for (size_t i = 0; i < g.size1(); i++)
+    for (size_t j = 0; j < g.size2(); j++) {
+      m(i, j) = options.beta1 * m(i, j) + (1 - options.beta1) * g(i, j);
+      v(i, j) = options.beta2 * v(i, j)
+                + (1 - options.beta2) * g(i, j) * g(i, j);
+      step(i, j) = rate * (m(i, j) / c1)
+                   / (sqrt(v(i, j) / c2) + options.epsilon);
+    }
+}
+
+/** Take one Adam step for the gradient g; returns the step in log-parameter
+ * space. */
+Gradient adam_step(StochasticState &state, const Gradient &g,
+                   const Options::Stochastic &options) {
+  state.t++;
+  Gradient step;
+  adam_update(state.m.transition, state.v.transition, step.transition,
+              g.transition, state.t, state.rate, options);
+  adam_update(state.m.emission, state.v.emission, step.emission, g.emission,
+              state.t, state.rate, options);
+  return step;
+}
+
+bool HMM::perform_training_iteration_stochastic(
+    const Data::Collection &collection, const Training::Task &task,
+    const Options::HMM &options, double &score, size_t &n_evaluations,
+    StochasticState &stochastic) {
+  if (verbosity >= Verbosity::verbose)
+    cerr << "HMM::perform_training_iteration_stochastic" << endl;
+
+  const Options::Stochastic &opt = options.stochastic;
+  Timer timer;
+
+  if (not stochastic.evaluated) {
+    // the first iteration, or the parameters were changed otherwise since the
+    // last one; the moment estimates are kept, as they still describe the
+    // gradients of this task
+    if (opt.svrg)
+      stochastic.gradient = compute_gradient(
+          collection, stochastic.score, task, options.weighting);
+    else
+      stochastic.score = compute_score(collection, task, options.weighting);
+    n_evaluations++;
+    stochastic.evaluated = true;
+  }
+
+  const double previous_score = stochastic.score;
+  const HMM snapshot = *this;
+
+  for (size_t step_idx = 0; step_idx < opt.steps; step_idx++) {
+    Data::Collection batch
+        = sample_batch(collection, opt.batch_size, stochastic.rng);
+    double batch_score;
+    Gradient g = compute_gradient(batch, batch_score, task, options.weighting);
+    stochastic.n_batches++;
+    if (opt.svrg) {
+      // control variate: the batch gradient of the snapshot, whose full-data
+      // gradient is known
+      double snapshot_score;
+      Gradient h = snapshot.compute_gradient(batch, snapshot_score, task,
+                                             options.weighting);
+      stochastic.n_batches++;
+      if (same_shape(g, h) and same_shape(g, stochastic.gradient)) {
+        add_scaled(g, -1, h);
+        add_scaled(g, 1, stochastic.gradient);
+      }
+    }
+    Gradient step = adam_step(stochastic, g, opt);
+    double step_norm = sqrt(scalar_product(step, step));
+    if (step_norm > 0 and std::isfinite(step_norm))
+      *this = build_trial_model(step, step_norm, task);
+    if (verbosity >= Verbosity::verbose)
+      cout << "Mini-batch " << step_idx << " score = " << batch_score
+           << " step norm = " << step_norm << endl;
+  }
+
+  // the full-data gradient is only needed as control variate
+  double new_score;
+  Gradient gradient;
+  if (opt.svrg)
+    gradient = compute_gradient(collection, new_score, task, options.weighting);
+  else
+    new_score = compute_score(collection, task, options.weighting);
+  n_evaluations++;
+
+  double stochastic_time = timer.tock();
+  if (options.timing_information)
+    cerr << "Stochastic gradient time: " + time_to_pretty_string(stochastic_time)
+         << endl;
+
+  double score_difference = new_score - previous_score;
+  double relative_score_difference = score_difference / fabs(new_score);
+
+  if (verbosity >= Verbosity::info) {
+    cout << "Score                                          " << new_score
+         << endl;
+    cout << "Gradient learning, relative score difference   "
+         << relative_score_difference << endl;
+  }
+
+  bool done = false;
+  if (score_difference < 0 or not std::isfinite(new_score)) {
+    // undo the steps and continue with a smaller step size
+    *this = snapshot;
+    stochastic.rate /= 2;
+    stochastic.m = stochastic.v = Gradient();
+    stochastic.t = 0;
+    if (verbosity >= Verbosity::info)
+      cout << "Full-data score decreased; reducing the step size to "
+           << stochastic.rate << endl;
+    score = previous_score;
+    done = stochastic.rate < opt.rate / 1024;
+  } else {
+    stochastic.score = new_score;
+    stochastic.gradient = move(gradient);
+    score = new_score;
+    done = relative_score_difference < options.termination.delta_tolerance;
+    if (done)
+      cout << "Relative score criterion                       OK" << endl;
+  }
+
+  return done;
+}
+
 namespace Exception {
 namespace HMM {
 namespace Learning {
@@ -27,7 +27,9 @@
  * =====================================================================================
  */
 
+#include <omp.h>
 #include <iomanip>
+#include "../concurrency.hpp"
 #include "../timer.hpp"
 #include "../aux.hpp"
 #include "logistic.hpp"
@@ -114,10 +116,32 @@ HMM HMM::build_trial_model(const Gradient &gradient, double alpha,
     trial_hmm.transition = t_step;
   if (not task.targets.emission.empty())
     trial_hmm.emission = e_step;
+  trial_hmm.compile_topology();
 
   return trial_hmm;
 }
 
+Gradient HMM::log_parameter_step(const HMM &hmm,
+                                 const Training::Targets &targets) const {
+  // entries that are zero in either model do not change in log space
+  auto difference = [](const matrix_t &a, const matrix_t &b,
+                       const Training::Range &rows) {
+    matrix_t d = zero_matrix(a.size1(), a.size2());
+    for (auto i : rows)
+      for (size_t j = 0; j < a.size2(); j++)
+        if (a(i, j) > 0 and b(i, j) > 0)
+          d(i, j) = log(a(i, j)) - log(b(i, j));
+    return d;
+  };
+  Gradient step;
+  if (not targets.transition.empty())
+    step.transition
+        = difference(hmm.transition, transition, targets.transition);
+  if (not targets.emission.empty())
+    step.emission = difference(hmm.emission, emission, targets.emission);
+  return step;
+}
+
 inline double psi(double v1, double v2, const Gradient &g, double alpha,
                   double mu, const Gradient &direction, Verbosity verbosity) {
   double d = dderiv(direction, g);
@@ -173,6 +197,15 @@ Gradient normalize(const Gradient &gradient) {
   return u;
 }
 
+/** A step size of the line search together with the function value and
+ * gradient of the model for that step. */
+struct Trial {
+  Trial(double stp, const HMM &hmm) : stp(stp), f(0), dg(0), hmm(hmm), g() {}
+  double stp, f, dg;
+  HMM hmm;
+  Gradient g;
+};
+
 /** Line-searching algorithm due to
  * Jorge J. Moré and David J. Thuente.
  * Line Search Algorithms with Guaranteed Sufficient Decrease
@@ -205,8 +238,9 @@ Gradient normalize(const Gradient &gradient) {
  *
  **/
 pair<double, HMM> HMM::line_search_more_thuente(
-    const Data::Collection &collection, const Gradient &initial_gradient_,
-    double initial_score, int &info, const Training::Task &task,
+    const Data::Collection &collection, const Gradient &search_direction,
+    const Gradient &initial_gradient, double initial_step, double initial_score,
+    int &info, size_t &n_evaluations, const Training::Task &task,
     const Options::HMM &options) const {
   const Verbosity verbo = verbosity;
   // const Verbosity verbo = Verbosity::verbose;
@@ -215,8 +249,6 @@ pair<double, HMM> HMM::line_search_more_thuente(
   info = 0;
   bool failed = false;
 
-  Gradient initial_gradient = initial_gradient_;
-
   // check option validity
   if (options.line_search.max_steps == 0) {
     cout << "Error: line search option max_steps must be a positive integer."
@@ -238,7 +270,7 @@ pair<double, HMM> HMM::line_search_more_thuente(
 
   size_t nfev = 1;
 
-  const Gradient direction = normalize(initial_gradient);
+  const Gradient direction = normalize(search_direction);
 
   double dginit = dderiv(direction, initial_gradient);
   if (dginit <= 0) {
@@ -251,8 +283,7 @@ pair<double, HMM> HMM::line_search_more_thuente(
   // TODO determine alpha_min and alpha_max
   const double min_score = initial_score
                            / (1 - options.termination.delta_tolerance);
-  const double stpmin = (min_score - initial_score)
-                        / dderiv(direction, initial_gradient);
+  const double stpmin = (min_score - initial_score) / dginit;
   // const double stpmin = (min_score - initial_score) / options.line_search.mu / dderiv(direction, initial_gradient);
   if (verbo >= Verbosity::debug) {
     cout << "min_score = " << min_score << endl;
@@ -264,8 +295,7 @@ pair<double, HMM> HMM::line_search_more_thuente(
   if (task.measure == Measure::MutualInformation
       or task.measure == Measure::MatthewsCorrelationCoefficient)
     upper_limit = (1 - initial_score) / options.line_search.mu
-                  / dderiv(direction,
-                           initial_gradient);  // Assume the maximal score is 1
+                  / dginit;  // Assume the maximal score is 1
   if (verbo >= Verbosity::debug)
     cout << "Upper limit = " << upper_limit << endl;
   double strict_upper_limit = min(upper_limit + 1, upper_limit * 1.1);
@@ -298,7 +328,7 @@ pair<double, HMM> HMM::line_search_more_thuente(
   // THE VARIABLES STP, F, DG CONTAIN THE VALUES OF THE STEP,
   // FUNCTION, AND DERIVATIVE AT THE CURRENT STEP.
 
-  double stp = 1;
+  double stp = initial_step;
   double stx = 0;
   double fx = initial_score;
   double dgx = dginit;
@@ -309,6 +339,77 @@ pair<double, HMM> HMM::line_search_more_thuente(
   bool brackt = false;
   bool stage1 = true;
 
+  // The threads available to this line search, e.g. the share of one of
+  // several concurrently trained seeds, are divided among the concurrent step
+  // sizes; there are no more of them than threads.
+  const ConcurrentJobs jobs(options.line_search.n_concurrent);
+  const size_t n_concurrent = jobs.n_jobs;
+
+  // Evaluate the function and gradient of the trial models. If there are
+  // several, they are evaluated concurrently.
+  auto evaluate = [&](vector<Trial> &trials) {
+    const size_t n = trials.size();
+#pragma omp parallel for schedule(static, 1) num_threads(n) if (n > 1)
+    for (size_t i = 0; i < n; i++) {
+      jobs.enter();
+      trials[i].g = trials[i].hmm.compute_gradient(collection, trials[i].f,
+                                                   task, options.weighting);
+    }
+  };
+
+  // Update the interval of uncertainty with the function value f and
+  // directional derivative dg at the given step, and compute the next step,
+  // which is stored in step. Returns false if the input to mcstep was
+  // invalid.
+  auto update_interval = [&](double &step, double f, double dg, double stmin,
+                             double stmax) {
+    // IN THE FIRST STAGE WE SEEK A STEP FOR WHICH THE MODIFIED
+    // FUNCTION HAS A NONNEGATIVE VALUE AND NONPOSITIVE DERIVATIVE.
+    double ftest1 = finit + step * dgtest;
+    if (stage1 and f >= ftest1 and dg <= min(ftol, gtol) * dginit)
+      stage1 = false;
+
+    // A MODIFIED FUNCTION IS USED TO PREDICT THE STEP ONLY IF
+    // WE HAVE NOT OBTAINED A STEP FOR WHICH THE MODIFIED
+    // FUNCTION HAS A NONPOSITIVE FUNCTION VALUE AND NONNEGATIVE
+    // DERIVATIVE, AND IF A LOWER FUNCTION VALUE HAS BEEN
+    // OBTAINED BUT THE DECREASE IS NOT SUFFICIENT.
+
+    if (stage1 and f >= fx and f < ftest1) {
+      // DEFINE THE MODIFIED FUNCTION AND DERIVATIVE VALUES.
+      if (verbo >= Verbosity::verbose)
+        cout << "Using modified function and derivative values." << endl;
+      double fm = f - step * dgtest;
+      double fxm = fx - stx * dgtest;
+      double fym = fy - sty * dgtest;
+      double dgm = dg - dgtest;
+      double dgxm = dgx - dgtest;
+      double dgym = dgy - dgtest;
+
+      // CALL CSTEP TO UPDATE THE INTERVAL OF UNCERTAINTY
+      // AND TO COMPUTE THE NEW STEP.
+      if (not mcstep(stx, fxm, dgxm, sty, fym, dgym, step, fm, dgm, brackt,
+                     stmin, stmax, verbo))
+        return false;
+
+      // RESET THE FUNCTION AND GRADIENT VALUES FOR F.
+      fx = fxm + stx * dgtest;
+      fy = fym + sty * dgtest;
+      dgx = dgxm + dgtest;
+      dgy = dgym + dgtest;
+
+    } else {
+      // CALL MCSTEP TO UPDATE THE INTERVAL OF UNCERTAINTY
+      // AND TO COMPUTE THE NEW STEP.
+      if (verbo >= Verbosity::verbose)
+        cout << "Using original function and derivative values." << endl;
+      if (not mcstep(stx, fx, dgx, sty, fy, dgy, step, f, dg, brackt, stmin,
+                     stmax, verbo))
+        return false;
+    }
+    return true;
+  };
+
   // START OF ITERATIONS
   while (true) {
     if (verbo >= Verbosity::verbose) {
@@ -344,20 +445,41 @@ pair<double, HMM> HMM::line_search_more_thuente(
 
     // EVALUATE THE FUNCTION AND GRADIENT AT STP
     // AND COMPUTE THE DIRECTIONAL DERIVATIVE.
-    // We return to main program to obtain F and G.
+    // Additional step sizes, spread over the interval of uncertainty, are
+    // evaluated concurrently if so desired. Together they count as one
+    // evaluation.
     nfev++;
-    double f;
-    HMM trial_hmm = build_trial_model(initial_gradient, stp, task);
-    Gradient trial_gradient
-        = trial_hmm.compute_gradient(collection, f, task, options.weighting);
-    if (verbo >= Verbosity::verbose)
+    vector<Trial> trials;
+    trials.push_back(Trial(stp, build_trial_model(search_direction, stp, task)));
+    if (n_concurrent > 1 and stp != stx) {
+      const double lo = max(stmin, stpmin), hi = min(stmax, stpmax);
+      for (size_t j = 1; j < n_concurrent; j++) {
+        double s = lo + (hi - lo) * j / n_concurrent;
+        if (s != stp and s > 0)
+          trials.push_back(
+              Trial(s, build_trial_model(search_direction, s, task)));
+      }
+    }
+    Timer timer;
+    evaluate(trials);
+    n_evaluations += trials.size();
+    for (auto &trial : trials)
+      trial.dg = dderiv(direction, trial.g);
+    if (verbo >= Verbosity::verbose) {
       cout << "Function and gradient evaluation!" << endl;
+      if (trials.size() > 1)
+        cout << "Evaluated " << trials.size() << " step sizes in "
+             << time_to_pretty_string(timer.tock()) << endl;
+    }
 
-    double dg = dderiv(direction, trial_gradient);
+    const double f = trials[0].f;
+    const double dg = trials[0].dg;
     double ftest1 = finit + stp * dgtest;
 
     if (verbo >= Verbosity::verbose)
-      cout << "stp = " << stp << " f = " << f << " dg = " << dg << endl;
+      for (auto &trial : trials)
+        cout << "stp = " << trial.stp << " f = " << trial.f
+             << " dg = " << trial.dg << endl;
     if (verbo >= Verbosity::debug)
       cout << "ftest1 = " << ftest1 << endl;
 
@@ -375,58 +497,52 @@ pair<double, HMM> HMM::line_search_more_thuente(
     if (f >= ftest1 and fabs(dg) <= gtol * fabs(dginit))
       info = 1;
 
+    // If the step of the algorithm does not fulfill both conditions, accept
+    // the best of the additional steps that does.
+    if (info != 1) {
+      const Trial *best = nullptr;
+      for (size_t i = 1; i < trials.size(); i++)
+        if (trials[i].f >= finit + trials[i].stp * dgtest
+            and fabs(trials[i].dg) <= gtol * fabs(dginit)
+            and (best == nullptr or trials[i].f > best->f))
+          best = &trials[i];
+      if (best != nullptr) {
+        info = 1;
+        if (verbo >= Verbosity::verbose)
+          cout << "Accepting concurrently evaluated step " << best->stp
+               << endl;
+        trials[0] = *best;
+      }
+    }
+
     // CHECK FOR TERMINATION.
     if (info != 0) {
       if (verbo >= Verbosity::info)
         cout << "Fnc & grad evaluations in line search          " << nfev
              << endl;
-      return pair<double, HMM>(f, trial_hmm);
+      return pair<double, HMM>(trials[0].f, trials[0].hmm);
     }
 
-    // IN THE FIRST STAGE WE SEEK A STEP FOR WHICH THE MODIFIED
-    // FUNCTION HAS A NONNEGATIVE VALUE AND NONPOSITIVE DERIVATIVE.
-    if (stage1 and f >= ftest1 and dg <= min(ftol, gtol) * dginit)
-      stage1 = false;
-
-    // A MODIFIED FUNCTION IS USED TO PREDICT THE STEP ONLY IF
-    // WE HAVE NOT OBTAINED A STEP FOR WHICH THE MODIFIED
-    // FUNCTION HAS A NONPOSITIVE FUNCTION VALUE AND NONNEGATIVE
-    // DERIVATIVE, AND IF A LOWER FUNCTION VALUE HAS BEEN
-    // OBTAINED BUT THE DECREASE IS NOT SUFFICIENT.
-
-    if (stage1 and f >= fx and f < ftest1) {
-      // DEFINE THE MODIFIED FUNCTION AND DERIVATIVE VALUES.
-      if (verbo >= Verbosity::verbose)
-        cout << "Using modified function and derivative values." << endl;
-      double fm = f - stp * dgtest;
-      double fxm = fx - stx * dgtest;
-      double fym = fy - sty * dgtest;
-      double dgm = dg - dgtest;
-      double dgxm = dgx - dgtest;
-      double dgym = dgy - dgtest;
-
-      // CALL CSTEP TO UPDATE THE INTERVAL OF UNCERTAINTY
-      // AND TO COMPUTE THE NEW STEP.
-      if (not mcstep(stx, fxm, dgxm, sty, fym, dgym, stp, fm, dgm, brackt,
-                     stmin, stmax, verbo))
-        // the intial parameters of mcstep were wrong
-        return pair<double, HMM>(initial_score, *this);
-
-      // RESET THE FUNCTION AND GRADIENT VALUES FOR F.
-      fx = fxm + stx * dgtest;
-      fy = fym + sty * dgtest;
-      dgx = dgxm + dgtest;
-      dgy = dgym + dgtest;
-
-    } else {
-      // CALL MCSTEP TO UPDATE THE INTERVAL OF UNCERTAINTY
-      // AND TO COMPUTE THE NEW STEP.
-      if (verbo >= Verbosity::verbose)
-        cout << "Using original function and derivative values." << endl;
-      if (not mcstep(stx, fx, dgx, sty, fy, dgy, stp, f, dg, brackt, stmin,
-                     stmax, verbo))
-        // the intial parameters of mcstep were wrong
-        return pair<double, HMM>(initial_score, *this);
+    // Update the interval of uncertainty with the step of the algorithm, and
+    // then with the additional steps that are admissible for it, from the
+    // lowest to the highest function value. The step proposed after the last
+    // of these updates is the next one.
+    if (not update_interval(stp, f, dg, stmin, stmax))
+      // the intial parameters of mcstep were wrong
+      return pair<double, HMM>(initial_score, *this);
+    sort(begin(trials) + 1, end(trials),
+         [](const Trial &a, const Trial &b) { return a.f < b.f; });
+    for (size_t i = 1; i < trials.size(); i++) {
+      const double s = trials[i].stp;
+      if ((brackt and (s <= min(stx, sty) or s >= max(stx, sty)))
+          or dgx * (s - stx) <= 0 or (dgx - dgtest) * (s - stx) <= 0
+          or s < stpmin or s > stpmax)
+        continue;
+      const double lo = brackt ? min(stx, sty) : stx;
+      const double hi = brackt ? max(stx, sty) : s + xtrapf * (s - stx);
+      double next = s;
+      if (update_interval(next, trials[i].f, trials[i].dg, lo, hi))
+        stp = next;
     }
 
     // FORCE A SUFFICIENT DECREASE IN THE SIZE OF THE
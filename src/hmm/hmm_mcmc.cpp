@@ -50,6 +50,7 @@ void HMM::modify_column(mt19937 &rng) {
   double amount = emission(col, i) * rel_amount;
   emission(col, i) -= amount;
   emission(col, j) += amount;
+  compile_topology();
 }
 
 void HMM::modify_transition(mt19937 &rng, double eps) {
@@ -86,6 +87,7 @@ void HMM::modify_transition(mt19937 &rng, double eps) {
     z += transition(col, i);
   for (size_t i = 0; i < n_states; i++)
     transition(col, i) /= z;
+  compile_topology();
 }
 
 HMM HMM::random_variant(const Options::HMM &options, mt19937 &rng) const {
@@ -153,6 +155,7 @@ void HMM::swap_columns(mt19937 &rng) {
     emission(i, k) = emission(j, k);
     emission(j, k) = temp;
   }
+  compile_topology();
 }
 
 void HMM::add_column(size_t n, const vector<double> &e) {
@@ -272,12 +275,25 @@ vector<list<pair<HMM, double>>> HMM::mcmc(const Data::Collection &collection,
   MCMC::Generator<HMM> gen(options, n_states - first_state);
   MCMC::MonteCarlo<HMM> mcmc(gen, eval, verbosity);
   vector<double> temperatures;
+  // most proposals only change the motif, so that the log likelihoods under
+  // the model lacking it can be re-used from the variant likelihood cache
+  HMM initial(*this);
+  shared_ptr<VariantCache> cache = variant_cache;
+  if (not cache and options.multi_motif.variant_cache_size > 0) {
+    cache = make_shared<VariantCache>(options.multi_motif.variant_cache_size
+                                      * 1024 * 1024);
+    initial.use_variant_cache(cache);
+  }
   vector<HMM> init;
   for (size_t i = 0; i < options.sampling.n_parallel; i++) {
-    init.push_back(*this);
+    init.push_back(initial);
     temperatures.push_back(temperature);
     temperature /= 2;
   }
-  return mcmc.parallel_tempering(temperatures, init,
-                                 options.termination.max_iter);
+  auto trajectories = mcmc.parallel_tempering(temperatures, init,
+                                              options.termination.max_iter);
+  if (cache and verbosity >= Verbosity::verbose)
+    cout << "Variant likelihood cache: " << cache->hits << " hits, "
+         << cache->misses << " misses." << endl;
+  return trajectories;
 }
@@ -58,6 +58,8 @@ istream &operator>>(istream &is, Conjugate::Mode &conjugate) {
     conjugate = Conjugate::Mode::HestenesStiefel;
   else if (token == "dy" or token == "daiyan" or token == "daiyan")
     conjugate = Conjugate::Mode::DaiYuan;
+  else if (token == "lbfgs")
+    conjugate = Conjugate::Mode::LBFGS;
   else
     throw Exception::Optimization::InvalidConjugate(token);
   return is;
@@ -137,7 +139,19 @@ ostream &operator<<(ostream &os, const vector<X> &v) {
 ostream &operator<<(ostream &os, const LineSearch &options) {
   os << "Line search options:" << endl << "mu = " << options.mu << endl
      << "eta = " << options.eta << endl << "delta = " << options.delta << endl
-     << "max_steps = " << options.max_steps << endl;
+     << "max_steps = " << options.max_steps << endl
+     << "n_concurrent = " << options.n_concurrent << endl;
+  return os;
+}
+
+ostream &operator<<(ostream &os, const Stochastic &options) {
+  os << "Stochastic gradient options:" << endl
+     << "batch_size = " << options.batch_size << endl
+     << "steps = " << options.steps << endl << "rate = " << options.rate
+     << endl << "beta1 = " << options.beta1 << endl
+     << "beta2 = " << options.beta2 << endl
+     << "epsilon = " << options.epsilon << endl << "svrg = " << options.svrg
+     << endl;
   return os;
 }
 
@@ -190,7 +204,9 @@ ostream &operator<<(ostream &os, const HMM &options) {
      // implement
      << "evaluation_options = " << options.evaluate << endl
      << "n_threads = " << options.n_threads << endl
-     << "n_seq = " << options.n_seq << endl << "alpha = " << options.alpha
+     << "max_dp_memory = " << options.max_dp_memory << endl
+     << "n_seq = " << options.n_seq << endl
+     << "sequence_cache = " << options.sequence_cache << endl << "alpha = " << options.alpha
      << endl
      << "contingency_pseudo_count = " << options.contingency_pseudo_count
      << endl << "emission_pseudo_count = " << options.emission_pseudo_count
@@ -202,6 +218,8 @@ ostream &operator<<(ostream &os, const HMM &options) {
      << "accept_multiple = " << options.multi_motif.accept_multiple << endl
      << "relearning = " << options.multi_motif.relearning << endl
      << "residual_ratio = " << options.multi_motif.residual_ratio << endl
+     << "variant_cache_size = " << options.multi_motif.variant_cache_size
+     << endl
      << "output_compression = " << options.output_compression << endl
      << "extend= " << options.extend << endl
      << "left_padding = " << options.left_padding << endl
@@ -209,9 +227,14 @@ ostream &operator<<(ostream &os, const HMM &options) {
      << "timing_information = " << options.timing_information << endl
      << "cross_validation_iterations = " << options.cross_validation_iterations
      << endl << "cross_validation_freq = " << options.cross_validation_freq
+     << endl
+     << "cross_validation_parallel = " << options.cross_validation_parallel
      << endl << "store_intermediate = " << options.store_intermediate << endl
      << "wiggle = " << options.wiggle << endl
+     << "n_parallel_candidates = " << options.n_parallel_candidates << endl
+     << "abandon_margin = " << options.abandon_margin << endl
      << "line_search = " << options.line_search << endl
+     << "stochastic = " << options.stochastic << endl
      << "random_salt = " << options.random_salt << endl
      << "dont_learn_class_prior = " << options.dont_learn_class_prior << endl
      << "dont_learn_conditional_motif_prior = "
@@ -67,6 +67,23 @@ struct LineSearch {
   double eta;
   double delta = 0.66;
   size_t max_steps;
+  /** Number of step sizes evaluated concurrently per line search step. */
+  size_t n_concurrent = 1;
+};
+
+/** Options for stochastic mini-batch gradient training */
+struct Stochastic {
+  /** Number of sequences per mini-batch; 0 to use the full data */
+  size_t batch_size = 0;
+  /** Number of mini-batch steps between evaluations on the full data */
+  size_t steps = 50;
+  /** Initial step size of Adam in log-parameter space */
+  double rate = 0.05;
+  double beta1 = 0.9;
+  double beta2 = 0.999;
+  double epsilon = 1e-8;
+  /** Whether to use stochastic variance reduced gradients */
+  bool svrg = false;
 };
 
 struct Evaluation {
@@ -85,11 +102,14 @@ struct Conjugate {
     FletcherReeves,
     PolakRibiere,
     HestenesStiefel,
-    DaiYuan
+    DaiYuan,
+    LBFGS
   };
   Mode mode;
   size_t restart_iteration;
   double restart_threshold;
+  /** Number of curvature pairs kept by L-BFGS */
+  size_t lbfgs_memory;
 };
 
 struct MultiMotif {
@@ -106,6 +126,8 @@ struct MultiMotif {
   bool accept_multiple;
   Relearning relearning;
   double residual_ratio;
+  /** Memory in MB for caching log likelihoods of models lacking motifs */
+  size_t variant_cache_size;
 };
 
 struct HMM {
@@ -121,7 +143,9 @@ struct HMM {
 #endif
   Evaluation evaluate;
   size_t n_threads;
+  size_t max_dp_memory;
   size_t n_seq;
+  std::string sequence_cache;
   double alpha;
   double contingency_pseudo_count, emission_pseudo_count,
       transition_pseudo_count;
@@ -137,10 +161,14 @@ struct HMM {
   bool timing_information;
   size_t cross_validation_iterations;
   double cross_validation_freq;
+  size_t cross_validation_parallel;  // number of folds processed at once
   bool store_intermediate;  // to write out intermediate parameterizations
   size_t wiggle;
+  size_t n_parallel_candidates;  // number of seed candidates trained at once
+  double abandon_margin;  // relative score margin to abandon seed candidates
   Conjugate conjugate;
   LineSearch line_search;
+  Stochastic stochastic;
   unsigned int random_salt;  // seed for the random number generator
 
   bool dont_learn_class_prior;
@@ -175,6 +203,7 @@ std::ostream &operator<<(std::ostream &os,
                          const MultiMotif::Relearning &relearning);
 std::ostream &operator<<(std::ostream &os, const Verbosity &verbosity);
 std::ostream &operator<<(std::ostream &os, const LineSearch &options);
+std::ostream &operator<<(std::ostream &os, const Stochastic &options);
 std::ostream &operator<<(std::ostream &os, const Termination &options);
 std::ostream &operator<<(std::ostream &os, const Sampling &options);
 std::ostream &operator<<(std::ostream &os,
@@ -27,10 +27,13 @@
  * =====================================================================================
  */
 
+#include <algorithm>
 #include "../aux.hpp"
+#include "../sha1.hpp"
 #include "hmm.hpp"
 #include "subhmm.hpp"
 #include "conditional_mutual_information.hpp"
+#include "forward_batch.hpp"
 
 using namespace std;
 
@@ -207,12 +210,44 @@ double HMM::log_likelihood(const Data::Contrast &contrast) const {
 
 double HMM::log_likelihood(const Data::Set &dataset) const {
   double l = 0;
-#pragma omp parallel for schedule(static) reduction(+ : l) if (DO_PARALLEL)
-  for (size_t i = 0; i < dataset.set_size; i++)
-    l += log_likelihood_from_scale(compute_forward_scale(dataset.sequences[i]));
+  for (auto x : log_likelihoods(dataset))
+    l += x;
   return l;
 }
 
+vector<double> HMM::log_likelihoods(const Data::Set &dataset) const {
+  const size_t n = dataset.set_size;
+  vector<double> logp(n);
+  const size_t width = ForwardBatch::width();
+  if (width == 0) {
+#pragma omp parallel for schedule(static) if (DO_PARALLEL)
+    for (size_t i = 0; i < n; i++)
+      logp[i] = log_likelihood(dataset.sequences[i]);
+    return logp;
+  }
+
+  // Batch sequences of similar length to minimize the number of idle lanes
+  vector<const Data::Seq *> seqs(n);
+  for (size_t i = 0; i < n; i++)
+    seqs[i] = &dataset.sequences[i];
+  stable_sort(begin(seqs), end(seqs),
+              [](const Data::Seq *a, const Data::Seq *b) {
+    return a->isequence.size() > b->isequence.size();
+  });
+
+  vector<double> sorted_logp(n);
+  const size_t n_batches = (n + width - 1) / width;
+#pragma omp parallel for schedule(dynamic) if (DO_PARALLEL)
+  for (size_t batch = 0; batch < n_batches; batch++) {
+    const size_t first = batch * width;
+    ForwardBatch::log_likelihoods(topology, &seqs[first],
+                                  min(width, n - first), &sorted_logp[first]);
+  }
+  for (size_t i = 0; i < n; i++)
+    logp[seqs[i] - &dataset.sequences[0]] = sorted_logp[i];
+  return logp;
+}
+
 vector_t HMM::expected_posterior(const Data::Contrast &contrast,
                                  bitmask_t present) const {
   vector_t v = zero_vector(contrast.sets.size());
@@ -225,30 +260,63 @@ double HMM::expected_posterior(const Data::Set &dataset,
                                bitmask_t present) const {
   double m = 0;
   vector<size_t> present_groups = unpack_mask(present);
+  // Assume the first state of each motif is constitutive for the motif
+  vector<size_t> states;
+  for (auto group_idx : present_groups)
+    states.push_back(groups[group_idx].states[0]);
 #pragma omp parallel for schedule(static) reduction(+ : m) if (DO_PARALLEL)
-  for (size_t i = 0; i < dataset.set_size; i++) {
-    vector_t scale;
-    matrix_t f = compute_forward_scaled(dataset.sequences[i], scale);
-    matrix_t b = compute_backward_prescaled(dataset.sequences[i], scale);
-    for (auto group_idx : present_groups)
-      // Assume the first state of each motif is constitutive for the motif
-      m += expected_state_posterior(groups[group_idx].states[0], f, b, scale);
-  }
+  for (size_t i = 0; i < dataset.set_size; i++)
+    for (auto x : expected_state_posteriors(dataset.sequences[i], states))
+      m += x;
   return m;
 };
 
 double HMM::expected_posterior(const Data::Seq &seq, bitmask_t present) const {
   vector<size_t> present_groups = unpack_mask(present);
-  vector_t scale;
-  matrix_t f = compute_forward_scaled(seq, scale);
-  matrix_t b = compute_backward_prescaled(seq, scale);
-  double m = 0;
+  // Assume the first state of each motif is constitutive for the motif
+  vector<size_t> states;
   for (auto group_idx : present_groups)
-    // Assume the first state of each motif is constitutive for the motif
-    m += expected_state_posterior(groups[group_idx].states[0], f, b, scale);
+    states.push_back(groups[group_idx].states[0]);
+  double m = 0;
+  for (auto x : expected_state_posteriors(seq, states))
+    m += x;
   return m;
 };
 
+HMM::motif_posteriors_t HMM::motif_posteriors(
+    const Data::Seq &seq, const vector<size_t> &group_idxs) const {
+  const size_t n = group_idxs.size();
+  motif_posteriors_t res;
+
+  // Assume the first state of each motif is constitutive for the motif
+  vector<size_t> states;
+  for (auto group_idx : group_idxs)
+    states.push_back(groups[group_idx].states[0]);
+  res.expected.resize(states.size());
+  matrix_t T, E;
+  res.log_likelihood = expected_statistics(seq, Training::Targets(), T, E,
+                                           states, res.expected.data());
+
+  vector<vector<bool>> variants;
+  for (auto group_idx : group_idxs)
+    variants.push_back(complementary_states_flags(bitmask_t(1) << group_idx));
+  vector<double> logps_wo_motif(n);
+  ForwardBatch::variant_log_likelihoods(topology, seq, variants,
+                                        logps_wo_motif.data());
+  for (size_t j = 0; j < n; j++)
+    res.posterior.push_back(1 - exp(logps_wo_motif[j] - res.log_likelihood));
+  return res;
+}
+
+vector<double> HMM::expected_state_posteriors(
+    const Data::Seq &seq, const vector<size_t> &states) const {
+  vector<double> posteriors(states.size(), 0);
+  matrix_t T, E;
+  expected_statistics(seq, Training::Targets(), T, E, states,
+                      posteriors.data());
+  return posteriors;
+}
+
 vector_t HMM::posterior_atleast_one(const Data::Contrast &contrast,
                                     bitmask_t present) const {
   if (verbosity >= Verbosity::debug)
@@ -280,6 +348,41 @@ HMM::pair_posteriors_t HMM::pair_posterior_atleast_one(
   return v;
 }
 
+/** The key of a data set in the variant likelihood cache. Subsets of a data
+ * set, like the folds of cross-validation and mini-batches, share the SHA1 of
+ * its file, so the key is a hash over the nucleotides of its sequences. */
+string variant_cache_key(const Data::Set &dataset) {
+  vector<uint64_t> fingerprints;
+  fingerprints.reserve(dataset.sequences.size());
+  for (auto &seq : dataset.sequences)
+    fingerprints.push_back(seq.isequence.fingerprint());
+  unsigned char hash[20];
+  char hexstring[41];  // 40 chars + a zero
+  sha1::calc(fingerprints.data(), fingerprints.size() * sizeof(uint64_t),
+             hash);
+  sha1::toHexString(hash, hexstring);
+  return string(hexstring, 40);
+}
+
+VariantCache::values_t HMM::log_likelihoods_without(const Data::Set &dataset,
+                                                    bitmask_t present) const {
+  string dataset_key;
+  vector<double> signature;
+  if (variant_cache) {
+    dataset_key = variant_cache_key(dataset);
+    signature = VariantCache::signature(transition, emission,
+                                        complementary_states_flags(present));
+    if (auto logps = variant_cache->find(dataset_key, signature))
+      return logps;
+  }
+  SubHMM subhmm(*this, complementary_states_mask(present));
+  auto logps
+      = make_shared<const vector<double>>(subhmm.log_likelihoods(dataset));
+  if (variant_cache)
+    variant_cache->insert(dataset_key, signature, logps);
+  return logps;
+}
+
 vector_t HMM::posterior_atleast_one(const Data::Set &dataset,
                                     bitmask_t present) const {
   if (verbosity >= Verbosity::debug)
@@ -294,13 +397,15 @@ vector_t HMM::posterior_atleast_one(const Data::Set &dataset,
   }
 
   vector_t vec(dataset.set_size);
-  SubHMM subhmm(*this, complementary_states_mask(present));
-#pragma omp parallel for schedule(static) if (DO_PARALLEL)
+  // the complete model changes with every evaluation, but the one lacking the
+  // motif is taken from the cache if the other states were evaluated before,
+  // e.g. during training or sampling of the motif
+  const vector<double> logps = log_likelihoods(dataset);
+  const VariantCache::values_t logps_wo_motif
+      = log_likelihoods_without(dataset, present);
   for (size_t i = 0; i < dataset.set_size; i++) {
-    double logp = log_likelihood_from_scale(
-        compute_forward_scale(dataset.sequences[i]));
-    double logp_wo_motif = log_likelihood_from_scale(
-        subhmm.compute_forward_scale(dataset.sequences[i]));
+    double logp = logps[i];
+    double logp_wo_motif = (*logps_wo_motif)[i];
     double z = 1 - exp(logp_wo_motif - logp);
     if (verbosity >= Verbosity::debug)
       cout << "seq = "
@@ -334,21 +439,54 @@ HMM::pair_posteriors_t HMM::pair_posterior_atleast_one(
   }
 
   pair_posteriors_t vec(dataset.set_size);
-  SubHMM subhmm_one(*this, complementary_states_mask(present));
-  SubHMM subhmm_two(*this, complementary_states_mask(previous));
-  SubHMM subhmm_both(*this, complementary_states_mask(present | previous));
-#pragma omp parallel for schedule(static) if (DO_PARALLEL)
+  // the complete HMM and those lacking one or both of the motifs
+  const vector<vector<bool>> variants
+      = {vector<bool>(n_states, true), complementary_states_flags(present),
+         complementary_states_flags(previous),
+         complementary_states_flags(present | previous)};
+
+  // the variants lacking the previous motif do not change while the present
+  // one is trained; take their log likelihoods from the cache if they were
+  // evaluated before, and only compute the others
+  const size_t first_frozen = 2;
+  const string dataset_key
+      = variant_cache ? variant_cache_key(dataset) : string();
+  vector<vector<double>> signatures(variants.size());
+  vector<VariantCache::values_t> cached(variants.size());
+  vector<vector<bool>> missing;
+  vector<size_t> missing_idx;
+  for (size_t v = 0; v < variants.size(); v++) {
+    if (variant_cache and v >= first_frozen) {
+      signatures[v]
+          = VariantCache::signature(transition, emission, variants[v]);
+      cached[v] = variant_cache->find(dataset_key, signatures[v]);
+    }
+    if (not cached[v]) {
+      missing.push_back(variants[v]);
+      missing_idx.push_back(v);
+    }
+  }
+  vector<vector<double>> computed(missing.size(),
+                                  vector<double>(dataset.set_size));
+
+#pragma omp parallel for schedule(dynamic) if (DO_PARALLEL)
   for (size_t i = 0; i < dataset.set_size; i++) {
+    double logps[4];
+    if (not missing.empty()) {
+      double missing_logps[4];
+      ForwardBatch::variant_log_likelihoods(topology, dataset.sequences[i],
+                                            missing, missing_logps);
+      for (size_t k = 0; k < missing.size(); k++)
+        computed[k][i] = missing_logps[k];
+    }
+    for (size_t v = 0, k = 0; v < variants.size(); v++)
+      logps[v] = cached[v] ? (*cached[v])[i] : computed[k++][i];
     const PairPosteriorMode mode = PairPosteriorMode::Independence;
+    double logp = logps[0];
+    double logp_wo_one = logps[1];
+    double logp_wo_two = logps[2];
+    double logp_wo_either = logps[3];
     if (mode == PairPosteriorMode::MutualPresence) {
-      double logp = log_likelihood_from_scale(
-          compute_forward_scale(dataset.sequences[i]));
-      double logp_wo_one = log_likelihood_from_scale(
-          subhmm_one.compute_forward_scale(dataset.sequences[i]));
-      double logp_wo_two = log_likelihood_from_scale(
-          subhmm_two.compute_forward_scale(dataset.sequences[i]));
-      double logp_wo_either = log_likelihood_from_scale(
-          subhmm_both.compute_forward_scale(dataset.sequences[i]));
       double z_one = 1 - exp(logp_wo_one - logp);
       double z_two = 1 - exp(logp_wo_two - logp);
       double z_either = 1 - exp(logp_wo_either - logp);
@@ -358,14 +496,6 @@ HMM::pair_posteriors_t HMM::pair_posterior_atleast_one(
         cout << "seq = " << dataset.sequences[i].definition << " " << p << endl;
       vec[i] = p;
     } else if (mode == PairPosteriorMode::Independence) {
-      double logp = log_likelihood_from_scale(
-          compute_forward_scale(dataset.sequences[i]));
-      double logp_wo_one = log_likelihood_from_scale(
-          subhmm_one.compute_forward_scale(dataset.sequences[i]));
-      double logp_wo_two = log_likelihood_from_scale(
-          subhmm_two.compute_forward_scale(dataset.sequences[i]));
-      double logp_wo_either = log_likelihood_from_scale(
-          subhmm_both.compute_forward_scale(dataset.sequences[i]));
       double z_one = 1 - exp(logp_wo_either - logp_wo_two);
       double z_two = 1 - exp(logp_wo_either - logp_wo_one);
       double z_neither = (1 - z_one) * (1 - z_two);
@@ -377,6 +507,13 @@ HMM::pair_posteriors_t HMM::pair_posterior_atleast_one(
     }
   }
 
+  if (variant_cache)
+    for (size_t k = 0; k < missing.size(); k++)
+      if (missing_idx[k] >= first_frozen)
+        variant_cache->insert(
+            dataset_key, signatures[missing_idx[k]],
+            make_shared<const vector<double>>(move(computed[k])));
+
   if (verbosity >= Verbosity::debug)
     cout << "HMM::pair_posterior_atleast_one(Data::Set = " << dataset.path
          << ")" << endl << "present  = " << present << endl
@@ -431,16 +568,16 @@ HMM::posterior_t HMM::posterior_atleast_one(const Data::Seq &seq,
     cout << "HMM::posterior_atleast_one(Data::Seq)"
          << "present = " << present << endl;
 
-  double logp = log_likelihood_from_scale(compute_forward_scale(seq));
-
-  double z;
-  SubHMM subhmm(*this, complementary_states_mask(present));
-  double logp_wo_motif
-      = log_likelihood_from_scale(subhmm.compute_forward_scale(seq));
+  const vector<vector<bool>> variants
+      = {vector<bool>(n_states, true), complementary_states_flags(present)};
+  double logps[2];
+  ForwardBatch::variant_log_likelihoods(topology, seq, variants, logps);
+  double logp = logps[0];
+  double logp_wo_motif = logps[1];
 
-  z = 1 - exp(logp_wo_motif - logp);
+  double z = 1 - exp(logp_wo_motif - logp);
   if (verbosity >= Verbosity::debug)
-    cout << "seq = " << seq.definition << " " << seq.sequence
+    cout << "seq = " << seq.definition << " " << seq.sequence()
          << " logp = " << logp << " logp_wo_motif = " << logp_wo_motif
          << " z = " << z << endl;
 
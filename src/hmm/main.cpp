@@ -44,6 +44,8 @@
 #include <git_config.hpp>
 #include <discrover_paths.hpp>
 #include "cli.hpp"
+#include "workspace.hpp"
+#include "../plasma/sequence_cache.hpp"
 
 using namespace std;
 
@@ -364,6 +366,12 @@ int main(int argc, const char **argv) {
   // set the number of threads with OpenMP
   omp_set_num_threads(options.n_threads);
 
+  // limit the memory of the dynamic programming tables
+  Workspace::max_memory = options.max_dp_memory * 1024 * 1024;
+
+  // cache the encoded sequences of the FASTA files
+  Fasta::SequenceCache::directory = options.sequence_cache;
+
   // print information about specified motifs, paths, and objectives
   if (options.verbosity >= Verbosity::debug) {
     cout << "motif_specifications:";
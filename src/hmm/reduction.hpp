@@ -0,0 +1,44 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  reduction.hpp
+ *
+ *    Description:  Summation of per-sequence results in an order that does
+ *                  not depend on the number of threads
+ *
+ *        Created:  10/16/2026 04:12:37 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef REDUCTION_HPP
+#define REDUCTION_HPP
+
+#include <cstddef>
+#include <vector>
+
+/** Number of chunks of consecutive sequences whose results are summed up
+ * sequentially into one accumulator each before entering the tree reduction.
+ * It is fixed so that the order of the floating point operations, and thus
+ * the result, does not depend on the number of threads, and it bounds the
+ * memory used by the accumulators. */
+const size_t n_reduction_chunks = 256;
+
+/** The first sequence of a chunk; chunk n_chunks marks the end */
+inline size_t chunk_begin(size_t chunk, size_t n_chunks, size_t n_seqs) {
+  return chunk * n_seqs / n_chunks;
+}
+
+/** Sum up the partial results pairwise, in an order that only depends on the
+ * number of partial results. The sum is stored in the first element. */
+template <typename Partial>
+void tree_reduce(std::vector<Partial> &partials) {
+  const size_t n = partials.size();
+  for (size_t stride = 1; stride < n; stride *= 2)
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n - stride; i += 2 * stride)
+      partials[i] += partials[i + stride];
+}
+
+#endif
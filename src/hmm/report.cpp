@@ -262,8 +262,8 @@ void correlation_report(const vector<T> &x, ostream &out, size_t width = 12,
   out.flags(flags);
 }
 
-void Evaluator::print_posterior(ostream &os, const vector_t &scale,
-                                const matrix_t &f, const matrix_t &b) const {
+void Evaluator::print_posterior(ostream &os, const DPVector &scale,
+                                const DPMatrix &f, const DPMatrix &b) const {
   const size_t n = scale.size() - 2;
   vector_t posterior(n);
   for (size_t group_idx = 0; group_idx < hmm.get_ngroups(); group_idx++)
@@ -271,7 +271,7 @@ void Evaluator::print_posterior(ostream &os, const vector_t &scale,
       size_t k = *begin(hmm.groups[group_idx].states);
       os << "Posterior (" << hmm.get_group_name(group_idx) << ")";
       for (size_t i = 1; i <= n; ++i)
-        os << " " << f(i, k) * b(i, k) * scale(i);
+        os << " " << f(i, k) * b(i, k) * scale[i];
       os << endl;
     }
 }
@@ -331,16 +331,24 @@ Evaluator::ResultsCounts Evaluator::evaluate_dataset(
         out << "RIC = " << ric << endl;
       }
 
+  Viterbi decoder = hmm.viterbi_decoder();
   for (size_t i = 0; i < dataset.sequences.size(); i++) {
     HMM::StatePath viterbi_path;
     // TODO EVALUATION
-    double lp = hmm.viterbi(dataset.sequences[i], viterbi_path);
+    double lp = decoder.decode(dataset.sequences[i], viterbi_path);
 
     if (not(options.evaluate.skip_viterbi_path
             and options.evaluate.skip_summary
             and options.evaluate.skip_bed)) {
       stringstream viterbi_str, exp_str, atl_str;
 
+      vector<size_t> motif_groups;
+      for (size_t group_idx = 0; group_idx < n_groups; group_idx++)
+        if (hmm.is_motif_group(group_idx))
+          motif_groups.push_back(group_idx);
+      const HMM::motif_posteriors_t posteriors
+          = hmm.motif_posteriors(dataset.sequences[i], motif_groups);
+
       bool first = true;
       size_t motif_idx = 0;
       for (size_t group_idx = 0; group_idx < n_groups; group_idx++)
@@ -353,13 +361,8 @@ Evaluator::ResultsCounts Evaluator::evaluate_dataset(
             atl_str << "/";
           }
 
-          bitmask_t present_mask = 1 << group_idx;
-          // TODO EVALUATION
-          double atl = hmm.posterior_atleast_one(dataset.sequences[i],
-                                                 present_mask).posterior;
-          // TODO EVALUATION
-          double expected
-              = hmm.expected_posterior(dataset.sequences[i], present_mask);
+          double atl = posteriors.posterior[motif_idx];
+          double expected = posteriors.expected[motif_idx];
           size_t n_viterbi = hmm.count_motif(viterbi_path, group_idx);
           atl_counts[motif_idx][i] = atl;
           exp_counts[motif_idx][i] = expected;
@@ -384,15 +387,18 @@ Evaluator::ResultsCounts Evaluator::evaluate_dataset(
               << " E-sites = " << exp_str.str()
               << " P(#sites>=1) = " << atl_str.str()
               << " Viterbi log-p = " << lp << endl;
-        v_out << dataset.sequences[i].sequence << endl;
+        v_out << dataset.sequences[i].sequence() << endl;
         v_out << hmm.path2string_group(viterbi_path) << endl;
       }
 
       if (options.evaluate.print_posterior) {
-        vector_t scale;
-        auto f = hmm.compute_forward_scaled(dataset.sequences[i], scale);
-        auto b = hmm.compute_backward_prescaled(dataset.sequences[i], scale);
-        print_posterior(v_out, scale, f, b);
+        Workspace &workspace = Workspace::local();
+        hmm.compute_forward_scaled(dataset.sequences[i], workspace.forward,
+                                   workspace.scale);
+        hmm.compute_backward_prescaled(dataset.sequences[i], workspace.scale,
+                                       workspace.backward);
+        print_posterior(v_out, workspace.scale, workspace.forward,
+                        workspace.backward);
       }
       if (options.evaluate.conditional_motif_probability)
         conditional_decoder.decode(v_out, dataset.sequences[i]);
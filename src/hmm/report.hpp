@@ -55,8 +55,8 @@ public:
                 const Options::HMM &options) const;
 
 private:
-  void print_posterior(std::ostream &os, const vector_t &scale,
-                       const matrix_t &f, const matrix_t &b) const;
+  void print_posterior(std::ostream &os, const DPVector &scale,
+                       const DPMatrix &f, const DPMatrix &b) const;
   void eval_contrast(std::ostream &ofs, const Data::Contrast &contrast,
                      bool limit_logp, const std::string &tag) const;
 
@@ -11,10 +11,43 @@
  * =====================================================================================
  */
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include "results.hpp"
 
 namespace Training {
-State::State(size_t n) : center(-9), scores(n){};
+State::State(size_t n)
+    : center(-9), scores(n), n_evaluations(0), abandoned(false){};
+
+Leaderboard::Leaderboard(double margin_)
+    : margin(margin_), best(), finished(){};
+
+bool Leaderboard::report(size_t iteration, double score, bool final) {
+  bool keep = true;
+  const double inf = std::numeric_limits<double>::infinity();
+#pragma omp critical(leaderboard)
+  {
+    // the best score of the other models after as many iterations
+    double reference = iteration > 0 and iteration <= best.size()
+                           ? best[iteration - 1]
+                           : -inf;
+    for (auto &model : finished)
+      if (model.first <= iteration)
+        reference = std::max(reference, model.second);
+    if (margin > 0 and std::isfinite(reference) and not final)
+      keep = score >= reference - margin * std::fabs(reference);
+
+    if (final)
+      finished.push_back({iteration, score});
+    else if (iteration > 0) {
+      if (best.size() < iteration)
+        best.resize(iteration, -inf);
+      best[iteration - 1] = std::max(best[iteration - 1], score);
+    }
+  }
+  return keep;
+}
 
 Result::Result() : state(), delta(0), parameter_file(""){};
 }
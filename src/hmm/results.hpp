@@ -31,8 +31,9 @@
 #define HMM_RESULTS_HPP
 
 #include <cstddef>
-#include <vector>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace Training {
 
@@ -40,6 +41,33 @@ struct State {
   State(size_t n = 0);
   int center;
   std::vector<std::vector<double>> scores;
+  /** Number of function and gradient evaluations of gradient training */
+  size_t n_evaluations;
+  /** Whether training stopped early because other models scored better */
+  bool abandoned;
+};
+
+/** The scores of several alternative models, e.g. those trained for
+ * different seeds, after each number of training iterations. Training of a
+ * model is abandoned when its score after some number of iterations trails
+ * the best score that any other model had after as many iterations by more
+ * than the margin, relative to the magnitude of that best score. A model that
+ * finished training keeps its final score for later iterations. Models are
+ * thus only compared at equal training effort, and a model is never abandoned
+ * just because another one already converged. A margin of 0 disables
+ * abandoning. The scores may be reported concurrently, in which case a model
+ * is only compared to those that already reached the same iteration. */
+struct Leaderboard {
+  Leaderboard(double margin = 0);
+  double margin;
+  /** For each number of iterations, less one, the best score of the models
+   * still in training */
+  std::vector<double> best;
+  /** The iteration and score of the models that finished training */
+  std::vector<std::pair<size_t, double>> finished;
+  /** Record the score of a model after the given number of iterations, and
+   * whether it finished training; returns false if it should be abandoned. */
+  bool report(size_t iteration, double score, bool final = false);
 };
 
 struct Result {
@@ -17,6 +17,7 @@ SubHMM::SubHMM(const HMM &hmm, const Training::Range &states)
     if (find(lift.begin(), lift.end(), i) == lift.end())
       del_column(i);
   initialize_pred_succ();
+  compile_topology();
   if (verbosity >= Verbosity::debug)
     cout << "Constructed SubHMM" << endl;
 }
@@ -50,3 +51,17 @@ matrix_t SubHMM::lift_transition(const matrix_t &m) const {
       n(lift[i], lift[j]) = m(i, j);
   return n;
 }
+
+PosteriorGradientContext::PosteriorGradientContext(
+    const HMM &hmm, const Training::Range &states, const Training::Task &task,
+    const Data::Set &dataset, bitmask_t present)
+    : task(task),
+      dataset(dataset),
+      reduced(hmm, states),
+      reduced_targets(reduced.map_down(task.targets)),
+      reduced_log_likelihoods(
+          reduced_targets.transition.empty()
+                  and reduced_targets.emission.empty()
+                  and hmm.has_variant_cache()
+              ? hmm.log_likelihoods_without(dataset, present)
+              : nullptr){};
@@ -48,4 +48,28 @@ public:
   // std::vector<size_t> lift(const std::vector<size_t> &v) const;
 };
 
+/** What the posterior gradients of all sequences of a data set have in common
+ * for a given HMM, task, and set of present motifs: the model lacking the
+ * motif states, with its index maps and compiled topology, and the targets
+ * mapped to it. Creating it once per data set keeps the per-sequence work to
+ * the dynamic programming.
+ *
+ * If no target is a state of the reduced model, only its log likelihoods are
+ * needed, and these do not change while the motif is trained. They are then
+ * taken from the variant cache of the HMM if it has one, so that the reduced
+ * model is evaluated once across gradient iterations, instead of by a
+ * forward-backward pass per sequence and iteration. */
+struct PosteriorGradientContext {
+  PosteriorGradientContext(const HMM &hmm, const Training::Range &states,
+                           const Training::Task &task,
+                           const Data::Set &dataset, bitmask_t present);
+  const Training::Task &task;
+  const Data::Set &dataset;
+  const SubHMM reduced;
+  const Training::Targets reduced_targets;
+  /** The log likelihoods of the sequences under the reduced model, or null if
+   * they are to be computed along with its expected statistics. */
+  const VariantCache::values_t reduced_log_likelihoods;
+};
+
 #endif
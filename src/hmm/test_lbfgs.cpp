@@ -0,0 +1,124 @@
+#define BOOST_TEST_MODULE lbfgs
+#include <boost/test/unit_test.hpp>
+#include <cmath>
+#include <random>
+#include "hmm.hpp"
+
+using namespace std;
+
+// Check the L-BFGS two-loop recursion on the quadratic f(x) = b.x - x.A.x / 2
+// with gradient g(x) = b - A x. After n steps along A-conjugate directions
+// the history determines the inverse Hessian exactly, so that the direction
+// must solve A d = g.
+
+const size_t n = 8;
+
+vector<double> flatten(const Gradient &g) {
+  vector<double> x;
+  for (size_t i = 0; i < g.transition.size1(); i++)
+    for (size_t j = 0; j < g.transition.size2(); j++)
+      x.push_back(g.transition(i, j));
+  for (size_t i = 0; i < g.emission.size1(); i++)
+    for (size_t j = 0; j < g.emission.size2(); j++)
+      x.push_back(g.emission(i, j));
+  return x;
+}
+
+Gradient unflatten(const vector<double> &x) {
+  Gradient g;
+  g.transition = matrix_t(1, 2);
+  g.emission = matrix_t(2, 3);
+  size_t k = 0;
+  for (size_t i = 0; i < g.transition.size1(); i++)
+    for (size_t j = 0; j < g.transition.size2(); j++)
+      g.transition(i, j) = x[k++];
+  for (size_t i = 0; i < g.emission.size1(); i++)
+    for (size_t j = 0; j < g.emission.size2(); j++)
+      g.emission(i, j) = x[k++];
+  return g;
+}
+
+using square_t = vector<vector<double>>;
+
+vector<double> multiply(const square_t &a, const vector<double> &x) {
+  vector<double> y(n, 0);
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      y[i] += a[i][j] * x[j];
+  return y;
+}
+
+double dot(const vector<double> &x, const vector<double> &y) {
+  double z = 0;
+  for (size_t i = 0; i < n; i++)
+    z += x[i] * y[i];
+  return z;
+}
+
+BOOST_AUTO_TEST_CASE(direction_solves_quadratic) {
+  mt19937 rng(17);
+  normal_distribution<double> normal;
+
+  for (size_t trial = 0; trial < 20; trial++) {
+    // a symmetric positive definite Hessian
+    square_t m(n, vector<double>(n)), a(n, vector<double>(n, 0));
+    for (auto &row : m)
+      for (auto &x : row)
+        x = normal(rng);
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < n; j++)
+        for (size_t k = 0; k < n; k++)
+          a[i][j] += m[k][i] * m[k][j];
+      a[i][i] += 0.1;
+    }
+    vector<double> b(n), x(n);
+    for (size_t i = 0; i < n; i++) {
+      b[i] = normal(rng);
+      x[i] = normal(rng);
+    }
+    auto gradient = [&](const vector<double> &x) {
+      vector<double> g = multiply(a, x);
+      for (size_t i = 0; i < n; i++)
+        g[i] = b[i] - g[i];
+      return unflatten(g);
+    };
+
+    // A-conjugate steps by Gram-Schmidt in the inner product of A
+    vector<vector<double>> steps;
+    for (size_t k = 0; k < n; k++) {
+      vector<double> s(n);
+      for (auto &z : s)
+        z = normal(rng);
+      for (auto &t : steps) {
+        const vector<double> at = multiply(a, t);
+        const double c = dot(s, at) / dot(t, at);
+        for (size_t i = 0; i < n; i++)
+          s[i] -= c * t[i];
+      }
+      steps.push_back(s);
+    }
+
+    LBFGSHistory history;
+    for (auto &s : steps) {
+      update_lbfgs_history(history, gradient(x), n, Verbosity::error);
+      history.step = unflatten(s);
+      for (size_t i = 0; i < n; i++)
+        x[i] += s[i];
+    }
+    const Gradient g = gradient(x);
+    update_lbfgs_history(history, g, n, Verbosity::error);
+
+    const vector<double> d = flatten(lbfgs_direction(g, history));
+    const vector<double> ad = multiply(a, d), expected = flatten(g);
+    double error = 0, norm = 0;
+    for (size_t i = 0; i < n; i++) {
+      error += (ad[i] - expected[i]) * (ad[i] - expected[i]);
+      norm += expected[i] * expected[i];
+    }
+    BOOST_CHECK_MESSAGE(history.s.size() == n
+                            and sqrt(error) <= 1e-8 * sqrt(norm),
+                        "Trial " << trial << ": " << history.s.size()
+                                 << " pairs, relative error "
+                                 << sqrt(error / norm));
+  }
+}
@@ -0,0 +1,72 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  topology.cpp
+ *
+ *    Description:  Compiled, flat representation of the HMM transition graph
+ *
+ *        Created:  10/16/2026 11:20:13 AM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "topology.hpp"
+
+using namespace std;
+
+Topology::Topology()
+    : n_states(0),
+      n_emissions(0),
+      pred_offset(1, 0),
+      pred_state(),
+      pred_prob(),
+      pred_log_prob(),
+      max_in_degree(0),
+      succ_offset(1, 0),
+      succ_state(),
+      succ_prob(),
+      emission(),
+      log_emission() {}
+
+Topology::Topology(const matrix_t &transition, const matrix_t &emission_)
+    : n_states(transition.size1()),
+      n_emissions(emission_.size2()),
+      pred_offset(n_states + 1, 0),
+      pred_state(),
+      pred_prob(),
+      pred_log_prob(),
+      max_in_degree(0),
+      succ_offset(n_states + 1, 0),
+      succ_state(),
+      succ_prob(),
+      emission(n_emissions * n_states, 0),
+      log_emission(n_emissions * n_states, 0) {
+  for (size_t j = 0; j < n_states; j++) {
+    for (size_t i = 0; i < n_states; i++)
+      if (transition(i, j) > 0) {
+        pred_state.push_back(i);
+        pred_prob.push_back(transition(i, j));
+        pred_log_prob.push_back(log(transition(i, j)));
+      }
+    pred_offset[j + 1] = pred_state.size();
+    max_in_degree = max(max_in_degree, pred_offset[j + 1] - pred_offset[j]);
+  }
+
+  for (size_t i = 0; i < n_states; i++) {
+    for (size_t j = 0; j < n_states; j++)
+      if (transition(i, j) > 0) {
+        succ_state.push_back(j);
+        succ_prob.push_back(transition(i, j));
+      }
+    succ_offset[i + 1] = succ_state.size();
+  }
+
+  for (size_t i = 0; i < n_states; i++)
+    for (size_t b = 0; b < n_emissions; b++) {
+      emission[b * n_states + i] = emission_(i, b);
+      log_emission[b * n_states + i] = log(emission_(i, b));
+    }
+}
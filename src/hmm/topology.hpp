@@ -0,0 +1,80 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  topology.hpp
+ *
+ *    Description:  Compiled, flat representation of the HMM transition graph
+ *
+ *        Created:  10/16/2026 11:20:13 AM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef TOPOLOGY_HPP
+#define TOPOLOGY_HPP
+
+#include <vector>
+#include "../matrix.hpp"
+
+/** The transition graph of an HMM, compiled for the dynamic programming
+ * kernels.
+ *
+ * The predecessors and successors of every state are stored in compressed
+ * sparse row (CSR) form, i.e. the edges into state i are found at the indices
+ * pred_offset[i] up to (but excluding) pred_offset[i + 1] of pred_state and
+ * pred_prob. Next to the state indices the transition probabilities of the
+ * edges are gathered, so that the inner loops of the forward and backward
+ * algorithms walk contiguous arrays instead of nested vectors and matrix
+ * accessors. The emission probabilities are stored symbol-major, so that the
+ * emissions of all states for a given symbol are contiguous.
+ *
+ * The edge order equals that of the pred and succ lists of the HMM, so that
+ * results are identical to the ones obtained by iterating over those.
+ *
+ * For the Viterbi algorithm the logarithms of the transition probabilities of
+ * the incoming edges and of the emission probabilities are cached, too.
+ */
+struct Topology {
+  Topology();
+  Topology(const matrix_t &transition, const matrix_t &emission);
+
+  /** The number of states. */
+  size_t n_states;
+  /** The number of emissions. */
+  size_t n_emissions;
+
+  /** Offsets of the incoming edges of each state; n_states + 1 entries. */
+  std::vector<size_t> pred_offset;
+  /** Source states of the incoming edges. */
+  std::vector<size_t> pred_state;
+  /** Transition probabilities of the incoming edges. */
+  std::vector<double> pred_prob;
+  /** Logarithms of the transition probabilities of the incoming edges. */
+  std::vector<double> pred_log_prob;
+  /** The largest number of incoming edges of any state. */
+  size_t max_in_degree;
+
+  /** Offsets of the outgoing edges of each state; n_states + 1 entries. */
+  std::vector<size_t> succ_offset;
+  /** Target states of the outgoing edges. */
+  std::vector<size_t> succ_state;
+  /** Transition probabilities of the outgoing edges. */
+  std::vector<double> succ_prob;
+
+  /** Emission probabilities; n_emissions rows of n_states entries. */
+  std::vector<double> emission;
+  /** Logarithms of the emission probabilities; same layout as emission. */
+  std::vector<double> log_emission;
+
+  /** Pointer to the emission probabilities of all states for a symbol. */
+  const double *emissions_of(size_t symbol) const {
+    return &emission[symbol * n_states];
+  };
+  /** Pointer to the log emission probabilities of all states for a symbol. */
+  const double *log_emissions_of(size_t symbol) const {
+    return &log_emission[symbol * n_states];
+  };
+};
+
+#endif
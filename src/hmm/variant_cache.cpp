@@ -0,0 +1,74 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  variant_cache.cpp
+ *
+ *    Description:  Cache of log likelihoods under HMMs lacking some states
+ *
+ *        Created:  10/16/2026 06:41:27 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#include "variant_cache.hpp"
+
+using namespace std;
+
+VariantCache::VariantCache(size_t max_bytes_)
+    : hits(0), misses(0), max_bytes(max_bytes_), n_bytes(0), lru(), index(){};
+
+vector<double> VariantCache::signature(const matrix_t &transition,
+                                       const matrix_t &emission,
+                                       const vector<bool> &present) {
+  vector<size_t> states;
+  for (size_t i = 0; i < present.size(); i++)
+    if (present[i])
+      states.push_back(i);
+  vector<double> sig(1, states.size());
+  for (auto i : states) {
+    for (auto j : states)
+      sig.push_back(transition(i, j));
+    for (size_t j = 0; j < emission.size2(); j++)
+      sig.push_back(emission(i, j));
+  }
+  return sig;
+}
+
+VariantCache::values_t VariantCache::find(const string &dataset,
+                                          const vector<double> &signature) {
+  values_t values;
+#pragma omp critical(variant_cache)
+  {
+    auto iter = index.find(key_t(dataset, signature));
+    if (iter == end(index))
+      misses++;
+    else {
+      hits++;
+      lru.splice(begin(lru), lru, iter->second);
+      values = iter->second->second;
+    }
+  }
+  return values;
+}
+
+void VariantCache::insert(const string &dataset,
+                          const vector<double> &signature, values_t values) {
+  const size_t size = values->size() * sizeof(double);
+  if (size > max_bytes)
+    return;
+#pragma omp critical(variant_cache)
+  {
+    key_t key(dataset, signature);
+    if (index.find(key) == end(index)) {
+      while (not lru.empty() and n_bytes + size > max_bytes) {
+        n_bytes -= lru.back().second->size() * sizeof(double);
+        index.erase(lru.back().first);
+        lru.pop_back();
+      }
+      lru.push_front(make_pair(key, values));
+      index[key] = begin(lru);
+      n_bytes += size;
+    }
+  }
+}
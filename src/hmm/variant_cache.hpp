@@ -0,0 +1,71 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  variant_cache.hpp
+ *
+ *    Description:  Cache of log likelihoods under HMMs lacking some states
+ *
+ *        Created:  10/16/2026 06:41:27 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef VARIANT_CACHE_HPP
+#define VARIANT_CACHE_HPP
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../matrix.hpp"
+
+/** Cache of the log likelihoods of the sequences of data sets under variants
+ * of an HMM that lack some of its states, as they are needed for the posterior
+ * of motif occurrence, its gradient, and the conditional mutual information of
+ * motifs.
+ *
+ * The log likelihoods under a variant only depend on the parameters of its
+ * states. A variant is therefore identified by its signature, i.e. these
+ * parameters, so that values computed for one model are reused for others
+ * that differ only in the parameters of the missing states. This is the case
+ * for the model lacking the motif that is trained, across the iterations of
+ * training and across seeds, and for the models of previously accepted motifs,
+ * which are not re-trained, when they are scored against several new motifs,
+ * or against each other.
+ *
+ * The least recently used entries are dropped once the cached values exceed
+ * the given size. The cache may be used concurrently.
+ */
+class VariantCache {
+public:
+  using values_t = std::shared_ptr<const std::vector<double>>;
+
+  explicit VariantCache(size_t max_bytes);
+
+  /** The parameters of the states present in a variant, in state order. */
+  static std::vector<double> signature(const matrix_t &transition,
+                                       const matrix_t &emission,
+                                       const std::vector<bool> &present);
+
+  /** The cached log likelihoods of the sequences of a data set under the
+   * variant with the given signature, or nullptr. */
+  values_t find(const std::string &dataset,
+                const std::vector<double> &signature);
+  void insert(const std::string &dataset,
+              const std::vector<double> &signature, values_t values);
+
+  size_t hits, misses;
+
+private:
+  using key_t = std::pair<std::string, std::vector<double>>;
+  using lru_t = std::list<std::pair<key_t, values_t>>;
+  size_t max_bytes, n_bytes;
+  /** Entries, most recently used first */
+  lru_t lru;
+  std::map<key_t, lru_t::iterator> index;
+};
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  viterbi.cpp
+ *
+ *    Description:  Viterbi decoder working on the compiled HMM topology
+ *
+ *        Created:  10/16/2026 12:02:41 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#include <algorithm>
+#include <limits>
+#include "viterbi.hpp"
+
+using namespace std;
+
+const size_t start_state = 0;
+
+Viterbi::Viterbi(const Topology &topology_)
+    : topology(&topology_),
+      v_previous(),
+      v_current(),
+      traceback8(),
+      traceback16(),
+      traceback32() {}
+
+double Viterbi::decode(const Data::Seq &s, StatePath &path) {
+  if (topology->max_in_degree <= numeric_limits<uint8_t>::max() + 1ul)
+    return decode(s, path, traceback8);
+  else if (topology->max_in_degree <= numeric_limits<uint16_t>::max() + 1ul)
+    return decode(s, path, traceback16);
+  else
+    return decode(s, path, traceback32);
+}
+
+template <typename Offset>
+double Viterbi::decode(const Data::Seq &s, StatePath &path,
+                       vector<Offset> &traceback) {
+  const size_t L = s.isequence.size();
+  const size_t n_states = topology->n_states;
+  const size_t *pred_offset = topology->pred_offset.data();
+  const size_t *pred_state = topology->pred_state.data();
+  const double *pred_log_prob = topology->pred_log_prob.data();
+  const double neg_inf = -numeric_limits<double>::infinity();
+
+  v_previous.assign(n_states, neg_inf);
+  v_current.assign(n_states, neg_inf);
+  if (traceback.size() < L * n_states)
+    traceback.resize(L * n_states);
+
+  v_previous[start_state] = 0;
+  for (size_t i = 0; i < L; i++) {
+    size_t symbol = s.isequence(i);
+    Offset *tb = &traceback[i * n_states];
+    fill(tb, tb + n_states, 0);
+    if (symbol == empty_symbol) {
+      const size_t begin = pred_offset[start_state];
+      for (size_t e = begin; e < pred_offset[start_state + 1]; e++) {
+        double tmp = v_previous[pred_state[e]] + pred_log_prob[e];
+        if (tmp > v_current[start_state]) {
+          v_current[start_state] = tmp;
+          tb[start_state] = e - begin;
+        }
+      }
+    } else {
+      const double *log_emission = topology->log_emissions_of(symbol);
+      for (size_t l = 0; l < n_states; l++) {
+        const size_t begin = pred_offset[l];
+        double m = neg_inf;
+        for (size_t e = begin; e < pred_offset[l + 1]; e++) {
+          double tmp = v_previous[pred_state[e]] + pred_log_prob[e];
+          if (tmp > m) {
+            m = tmp;
+            tb[l] = e - begin;
+          }
+        }
+        v_current[l] = log_emission[l] + m;
+      }
+    }
+    swap(v_previous, v_current);
+    fill(begin(v_current), end(v_current), neg_inf);
+  }
+
+  double p = neg_inf;
+  size_t pi = 0;
+  for (size_t e = pred_offset[start_state]; e < pred_offset[start_state + 1];
+       e++) {
+    double tmp = v_previous[pred_state[e]] + pred_log_prob[e];
+    if (tmp > p) {
+      p = tmp;
+      pi = pred_state[e];
+    }
+  }
+
+  path = StatePath(L);
+  if (L == 0)
+    return p;
+  path(L - 1) = pi;
+  for (size_t i = L - 1; i > 0; i--) {
+    // states that cannot be reached have no predecessors to trace back to
+    size_t e = pred_offset[pi] + traceback[i * n_states + pi];
+    pi = path(i - 1) = e < pred_offset[pi + 1] ? pred_state[e] : start_state;
+  }
+
+  return p;
+}
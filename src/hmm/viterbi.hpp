@@ -0,0 +1,57 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  viterbi.hpp
+ *
+ *    Description:  Viterbi decoder working on the compiled HMM topology
+ *
+ *        Created:  10/16/2026 12:02:41 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef VITERBI_HPP
+#define VITERBI_HPP
+
+#include <cstdint>
+#include <vector>
+#include "basedefs.hpp"
+#include "topology.hpp"
+
+/** Viterbi decoder for the HMMs.
+ *
+ * The log transition and emission probabilities are taken from the cached
+ * tables of the topology, and only the actual predecessors of each state are
+ * considered. The traceback stores for each position and state the offset of
+ * the best predecessor within the predecessor list of the state, using 8 bit
+ * or, for states with more than 256 predecessors, 16 or 32 bit integers.
+ *
+ * The decoder keeps its DP buffers between calls; thus, reuse one instance to
+ * decode many sequences. It refers to the topology of the HMM it was created
+ * from, and has to be re-created whenever the parameters of that HMM change.
+ */
+class Viterbi {
+public:
+  using StatePath = boost::numeric::ublas::vector<size_t>;
+
+  explicit Viterbi(const Topology &topology);
+
+  /** Compute the most likely state path of a sequence.
+   * Returns the log probability of the path. */
+  double decode(const Data::Seq &s, StatePath &path);
+
+private:
+  template <typename Offset>
+  double decode(const Data::Seq &s, StatePath &path,
+                std::vector<Offset> &traceback);
+
+  const Topology *topology;
+  std::vector<double> v_previous;
+  std::vector<double> v_current;
+  std::vector<uint8_t> traceback8;
+  std::vector<uint16_t> traceback16;
+  std::vector<uint32_t> traceback32;
+};
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  workspace.cpp
+ *
+ *    Description:  Reusable per-thread scratch space for the dynamic
+ *                  programming algorithms
+ *
+ *        Created:  10/16/2026 12:31:05 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#include <cmath>
+#include <iostream>
+#include "workspace.hpp"
+
+using namespace std;
+
+ostream &operator<<(ostream &os, const DPMatrix &m) {
+  os << "[" << m.size1() << "," << m.size2() << "](";
+  for (size_t i = 0; i < m.size1(); i++) {
+    os << (i == 0 ? "(" : ",(");
+    for (size_t j = 0; j < m.size2(); j++)
+      os << (j == 0 ? "" : ",") << m(i, j);
+    os << ")";
+  }
+  os << ")";
+  return os;
+}
+
+size_t Workspace::max_memory = 256 * 1024 * 1024;
+
+void Workspace::reserve(size_t max_len, size_t n_states) {
+  scale.reserve(max_len + 2);
+  // sequences exceeding the limit only need checkpoint sized tables
+  if (2 * (max_len + 2) * n_states * sizeof(double) > max_memory)
+    max_len = ceil(sqrt(max_len + 2));
+  forward.reserve(max_len + 2, n_states);
+  backward.reserve(max_len + 2, n_states);
+  previous.reserve(n_states);
+  current.reserve(n_states);
+}
+
+Workspace &Workspace::local() {
+  static thread_local Workspace workspace;
+  return workspace;
+}
@@ -0,0 +1,94 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  workspace.hpp
+ *
+ *    Description:  Reusable per-thread scratch space for the dynamic
+ *                  programming algorithms
+ *
+ *        Created:  10/16/2026 12:31:05 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef WORKSPACE_HPP
+#define WORKSPACE_HPP
+
+#include <vector>
+#include "../matrix.hpp"
+
+/** Vector type of the scaling factors of the forward and backward algorithms.
+ */
+using DPVector = std::vector<double>;
+
+/** Row-major matrix for the tables of the forward and backward algorithms.
+ *
+ * Re-sizing it to a size not exceeding that of any earlier use does not
+ * allocate memory, so that one instance can be reused for many sequences.
+ */
+struct DPMatrix {
+  DPMatrix() : n_rows(0), n_cols(0), data(){};
+
+  /** Set the dimensions and fill with zeros. */
+  void reset(size_t rows, size_t cols) {
+    n_rows = rows;
+    n_cols = cols;
+    data.assign(rows * cols, 0);
+  };
+  /** Make sure that matrices of the given size fit without re-allocation. */
+  void reserve(size_t rows, size_t cols) { data.reserve(rows * cols); };
+
+  size_t size1() const { return n_rows; };
+  size_t size2() const { return n_cols; };
+
+  double &operator()(size_t i, size_t j) { return data[i * n_cols + j]; };
+  double operator()(size_t i, size_t j) const { return data[i * n_cols + j]; };
+  double *row(size_t i) { return &data[i * n_cols]; };
+  const double *row(size_t i) const { return &data[i * n_cols]; };
+
+  size_t n_rows, n_cols;
+  std::vector<double> data;
+};
+
+std::ostream &operator<<(std::ostream &os, const DPMatrix &m);
+
+/** Scratch space of the dynamic programming algorithms.
+ *
+ * Every thread has its own workspace, obtained with Workspace::local(). Its
+ * buffers only grow, so that once they have reached the size needed for the
+ * longest sequence no further memory is allocated for the evaluation of the
+ * HMMs. The buffers are handed out to the functions that need them by the
+ * callers; a function must not use a buffer of the workspace that its caller
+ * may still be using.
+ */
+struct Workspace {
+  /** Forward table. */
+  DPMatrix forward;
+  /** Backward table. */
+  DPMatrix backward;
+  /** Scaling factors of the forward and backward tables. */
+  DPVector scale;
+  /** Forward columns used when only the scaling factors are computed. */
+  DPVector previous, current;
+  /** State masks of the lanes of the batched forward algorithm. */
+  DPVector keep;
+  /** Expected transition and emission statistics of single sequences. */
+  matrix_t transition_stats, emission_stats;
+  /** The same under the model lacking the motifs, for posterior gradients. */
+  matrix_t reduced_transition_stats, reduced_emission_stats;
+
+  /** Maximal number of bytes that the forward and backward tables of a
+   * single sequence may occupy. Longer sequences are processed with
+   * checkpointing, using memory proportional to the square root of the
+   * sequence length. */
+  static size_t max_memory;
+
+  /** Pre-allocate the buffers for sequences of up to max_len symbols. */
+  void reserve(size_t max_len, size_t n_states);
+
+  /** The workspace of the calling thread. */
+  static Workspace &local();
+};
+
+#endif
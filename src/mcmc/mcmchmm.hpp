@@ -46,25 +46,22 @@ public:
     if (options.sampling.max_size == -1)
       options.sampling.max_size = w;
   };
-  HMM generate(const HMM &hmm) const {
-    return hmm.random_variant(options, EntropySource::rng);
+  HMM generate(const HMM &hmm, std::mt19937 &rng) const {
+    return hmm.random_variant(options, rng);
   };
 };
 template <>
 class Evaluator<HMM> {
 private:
-  Data::Collection collection;
+  /** The sequences are not copied; they have to outlive the evaluator */
+  const Data::Collection &collection;
   Training::Task task;
-  Training::State ts;
   Options::HMM options;
 
 public:
   Evaluator(const Data::Collection &col, const Training::Task &obj,
             const Options::HMM &opt)
-      : collection(col),
-        task(obj),
-        ts(1),  // TODO make this work with multiple tasks
-        options(opt){};
+      : collection(col), task(obj), options(opt){};
 
   double evaluate(const HMM &hmm) const {
     // TODO consider using compute_score instead of compute_score_all_motifs
@@ -31,7 +31,6 @@
 #define MCMCHMM_HPP
 
 #include <random>
-#include <functional>
 #include "../plasma/score.hpp"
 #include "../plasma/motif.hpp"
 #include "montecarlo.hpp"
@@ -44,40 +43,40 @@ private:
   Seeding::Options options;
   size_t motif_length;
   size_t max_degeneracy;
-  std::uniform_int_distribution<size_t> dist2, dist3, dist4, dist6, dist7,
-      dist8, dist14, dist15, distPos;
-  std::function<size_t()> rand2, rand3, rand4, rand6, rand7, rand8, rand14,
-      rand15, randPos;
-  void replace_similar(char &c) const {
+  /** A uniformly distributed random number from 0 to n - 1 */
+  static size_t draw(size_t n, std::mt19937 &rng) {
+    return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+  }
+  void replace_similar(char &c, std::mt19937 &rng) const {
     if (options.verbosity >= Verbosity::debug)
       std::cout << "Replacing nucleotide " << static_cast<char>(c) << std::endl;
     switch (tolower(c)) {
       // individual nucleotides
-      case 'a': c = "cgtmwr"[rand6()]; break;
-      case 'c': c = "agtmsy"[rand6()]; break;
-      case 'g': c = "actksr"[rand6()]; break;
+      case 'a': c = "cgtmwr"[draw(6, rng)]; break;
+      case 'c': c = "agtmsy"[draw(6, rng)]; break;
+      case 'g': c = "actksr"[draw(6, rng)]; break;
       case 't':
-      case 'u': c = "acgkwy"[rand6()]; break;
+      case 'u': c = "acgkwy"[draw(6, rng)]; break;
       // two nucleotide wildcards
-      case 'm': c = "acrwsyvh"[rand8()]; break;
-      case 'r': c = "agmwskvd"[rand8()]; break;
-      case 'w': c = "atmrykhd"[rand8()]; break;
-      case 's': c = "cgmyrkvb"[rand8()]; break;
-      case 'y': c = "ctmswkhb"[rand8()]; break;
-      case 'k': c = "gtmswydb"[rand8()]; break;
+      case 'm': c = "acrwsyvh"[draw(8, rng)]; break;
+      case 'r': c = "agmwskvd"[draw(8, rng)]; break;
+      case 'w': c = "atmrykhd"[draw(8, rng)]; break;
+      case 's': c = "cgmyrkvb"[draw(8, rng)]; break;
+      case 'y': c = "ctmswkhb"[draw(8, rng)]; break;
+      case 'k': c = "gtmswydb"[draw(8, rng)]; break;
       // three nucleotide wildcards
-      case 'b': c = "sykdhvn"[rand7()]; break;
-      case 'd': c = "rwkbhvn"[rand7()]; break;
-      case 'h': c = "mwykbvn"[rand7()]; break;
-      case 'v': c = "mrsbdhn"[rand7()]; break;
+      case 'b': c = "sykdhvn"[draw(7, rng)]; break;
+      case 'd': c = "rwkbhvn"[draw(7, rng)]; break;
+      case 'h': c = "mwykbvn"[draw(7, rng)]; break;
+      case 'v': c = "mrsbdhn"[draw(7, rng)]; break;
       // four nucleotide wildcard
-      case 'n': c = "bdhv"[rand4()]; break;
+      case 'n': c = "bdhv"[draw(4, rng)]; break;
       default:
         throw Exception::NucleicAcids::InvalidNucleotideCode(c);
     }
   }
-  void replace_arbitrary(char &c) const {
-    const size_t r = rand14();
+  void replace_arbitrary(char &c, std::mt19937 &rng) const {
+    const size_t r = draw(14, rng);
     switch (tolower(c)) {
       // individual nucleotides
       case 'a': c = "cgtmrwsykbdhvn"[r]; break;
@@ -105,54 +104,35 @@ public:
   Generator(const Seeding::Options &opt, size_t len, size_t max_degen)
       : options(opt),
         motif_length(len),
-        max_degeneracy(max_degen),
-        dist2(0, 1),
-        dist3(0, 2),
-        dist4(0, 3),
-        dist6(0, 5),
-        dist7(0, 6),
-        dist8(0, 7),
-        dist14(0, 13),
-        dist15(0, 14),
-        distPos(0, len - 1) {
-    rand2 = std::bind(dist2, MCMC::EntropySource::rng);
-    rand3 = std::bind(dist3, MCMC::EntropySource::rng);
-    rand4 = std::bind(dist4, MCMC::EntropySource::rng);
-    rand6 = std::bind(dist6, MCMC::EntropySource::rng);
-    rand7 = std::bind(dist7, MCMC::EntropySource::rng);
-    rand8 = std::bind(dist8, MCMC::EntropySource::rng);
-    rand14 = std::bind(dist14, MCMC::EntropySource::rng);
-    rand15 = std::bind(dist15, MCMC::EntropySource::rng);
-    randPos = std::bind(distPos, MCMC::EntropySource::rng);
-  };
-  Motif generate(const Motif &motif_) const {
+        max_degeneracy(max_degen){};
+  Motif generate(const Motif &motif_, std::mt19937 &rng) const {
     Motif motif(motif_);
     if (options.verbosity >= Verbosity::verbose)
       std::cout << "Generating new motif based off of " << motif << std::endl;
     do {
-      size_t r = rand3();
+      size_t r = draw(3, rng);
       size_t p;
       switch (r) {
         case 0:  // replace nucleotide by a similar one
           if (options.verbosity >= Verbosity::verbose)
             std::cout << "Replace nucleotide by a similar one" << std::endl;
-          p = randPos();
-          replace_similar(motif[p]);
+          p = draw(motif_length, rng);
+          replace_similar(motif[p], rng);
           break;
         case 1:  // replace nucleotide by a random one
           if (options.verbosity >= Verbosity::verbose)
             std::cout << "Replace nucleotide by an arbitrary one" << std::endl;
-          p = randPos();
-          replace_arbitrary(motif[p]);
+          p = draw(motif_length, rng);
+          replace_arbitrary(motif[p], rng);
           break;
         case 2:  // roll one position
           if (options.verbosity >= Verbosity::verbose)
             std::cout << "Roll one position" << std::endl;
           {
-            char nucl = "acgtmrwsykbdhvn"[rand15()];
+            char nucl = "acgtmrwsykbdhvn"[draw(15, rng)];
             std::string w = " ";
             w[0] = nucl;
-            bool r = rand2();
+            bool r = draw(2, rng);
             size_t n = motif.size() - 1;
             if (r == 0)
               motif = w + motif.substr(0, n);
@@ -169,27 +149,27 @@ public:
   Motif generate() {
     std::string word;
     for (size_t j = 0; j < motif_length; j++)
-      word += "acgt"[rand4()];
+      word += "acgt"[draw(4, EntropySource::rng)];
     return word;
   };
 };
 template <>
 class Evaluator<Motif> {
 private:
-  Seeding::Collection collection;
+  /** The sequences are not copied; they have to outlive the evaluator */
+  const Seeding::Collection &collection;
   Seeding::Options options;
-  Seeding::Objective objective;
+  CompiledObjective objective;
 
 public:
   Evaluator(const Seeding::Collection &col, const Seeding::Options &opt,
             const Seeding::Objective &obj)
-      : collection(col), options(opt), objective(obj){};
+      : collection(col), options(opt), objective(col, obj, opt){};
 
   double evaluate(const Motif &motif) const {
     count_vector_t counts = count_motif(collection, motif, options);
     double score
-        = compute_score(collection, counts, options, objective, motif.size(),
-                        Seeding::motif_degeneracy(motif));
+        = objective(counts, motif.size(), Seeding::motif_degeneracy(motif));
     return score;
   };
 };
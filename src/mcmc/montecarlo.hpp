@@ -35,6 +35,8 @@
 #include <list>
 #include <vector>
 #include <cmath>
+#include <random>
+#include "../concurrency.hpp"
 #include "../verbosity.hpp"
 #include "../random_distributions.hpp"
 
@@ -65,7 +67,21 @@ public:
 template <class T>
 class Generator {
 public:
-  T generate(const T &i) const;
+  T generate(const T &i, std::mt19937 &rng) const;
+};
+
+/** Counts of the moves of a chain of parallel tempering */
+struct ChainStatistics {
+  ChainStatistics()
+      : accepted(0), rejected(0), invalid(0), swaps_proposed(0),
+        swaps_accepted(0){};
+  size_t accepted;
+  size_t rejected;
+  /** Proposals whose score was not a number */
+  size_t invalid;
+  /** Exchanges with a neighboring chain */
+  size_t swaps_proposed;
+  size_t swaps_accepted;
 };
 
 template <class T>
@@ -87,11 +103,12 @@ public:
   friend Evaluator<T>;
 
 private:
-  bool GibbsStep(double temp, T &state, double &G) const {
-    T nextstate = generator.generate(state);
+  bool GibbsStep(double temp, T &state, double &G, std::mt19937 &rng,
+                 ChainStatistics &stats) const {
+    T nextstate = generator.generate(state, rng);
     double nextG = evaluator.evaluate(nextstate);
     double dG = nextG - G;
-    double r = RandomDistribution::Probability(EntropySource::rng);
+    double r = RandomDistribution::Probability(rng);
     double p = std::min<double>(1.0, boltzdist(-dG, temp));
     if (verbosity >= Verbosity::verbose)
       std::cerr << "T = " << temp << " next state = " << nextstate << std::endl
@@ -100,12 +117,17 @@ private:
     if (std::isnan(nextG) == 0 and (dG > 0 or r <= p)) {
       if (verbosity >= Verbosity::verbose)
         std::cerr << "Accepted!" << std::endl;
-      state = nextstate;
+      state = std::move(nextstate);
       G = nextG;
+      stats.accepted++;
       return true;
     } else {
       if (verbosity >= Verbosity::verbose)
         std::cerr << "Rejected!" << std::endl;
+      if (std::isnan(nextG))
+        stats.invalid++;
+      else
+        stats.rejected++;
       return false;
     }
   }
@@ -139,8 +161,9 @@ public:
     double G = evaluator.evaluate(state);
     std::list<E> trajectory;
     trajectory.push_back(E(state, G));
+    ChainStatistics stats;
     for (size_t i = 0; i < steps; i++) {
-      if (GibbsStep(temp, state, G))
+      if (GibbsStep(temp, state, G, EntropySource::rng, stats))
         trajectory.push_back(E(state, G));
       temp *= anneal;
     }
@@ -150,26 +173,56 @@ public:
   std::vector<std::list<E>> parallel_tempering(const std::vector<double> &temp,
                                                const std::vector<T> &init,
                                                size_t steps) const {
+    std::vector<ChainStatistics> stats;
+    auto trajectory = parallel_tempering(temp, init, steps, stats);
+    if (verbosity >= Verbosity::info)
+      for (size_t t = 0; t < stats.size(); t++)
+        std::cout << "Chain " << t << " at temperature " << temp[t]
+                  << ": accepted " << stats[t].accepted << ", rejected "
+                  << stats[t].rejected << ", invalid " << stats[t].invalid
+                  << ", swaps " << stats[t].swaps_accepted << " of "
+                  << stats[t].swaps_proposed << std::endl;
+    return trajectory;
+  };
+
+  /** Perform parallel tempering. The chains are advanced concurrently, each
+   * with its own random number generator seeded from the entropy source, and
+   * synchronize after each step to exchange states of neighboring chains.
+   * The moves of each chain are counted in stats. */
+  std::vector<std::list<E>> parallel_tempering(
+      const std::vector<double> &temp, const std::vector<T> &init, size_t steps,
+      std::vector<ChainStatistics> &stats) const {
     size_t n = temp.size();
     std::uniform_int_distribution<size_t> r_unif(0, n - 2);
     std::vector<T> state = init;
+    stats = std::vector<ChainStatistics>(n);
+
+    std::vector<std::mt19937> rng;
+    for (size_t t = 0; t < n; t++)
+      rng.push_back(std::mt19937(EntropySource::rng()));
 
     std::vector<double> G;
-    for (auto s : state)
+    for (auto &s : state)
       G.push_back(evaluator.evaluate(s));
 
     std::vector<std::list<E>> trajectory(temp.size());
     for (size_t t = 0; t < temp.size(); t++)
       trajectory[t].push_back(E(state[t], G[t]));
 
+    // the threads are divided among the chains
+    const ConcurrentJobs jobs(n);
+
     for (size_t i = 0; i < steps; i++) {
       if (verbosity >= Verbosity::info)
         std::cerr << "Iteration " << i << " of " << steps << std::endl;
-      for (size_t t = 0; t < n; t++)
+#pragma omp parallel for schedule(static, 1) num_threads(jobs.n_jobs)
+      for (size_t t = 0; t < n; t++) {
+        jobs.enter();
         // TODO: if one wants to determine means one should respect the failed
         // changes, and input once more the original state to the trajectory.
-        if (GibbsStep(temp[t], state[t], G[t]))
+        if (GibbsStep(temp[t], state[t], G[t], rng[t], stats[t]))
           trajectory[t].push_back(E(state[t], G[t]));
+      }
 
       if (verbosity >= Verbosity::info) {
         std::cout << "Scores =";
@@ -182,8 +235,12 @@ public:
         size_t r = r_unif(EntropySource::rng);
         if (verbosity >= Verbosity::verbose)
           std::cerr << "Testing swap of " << r << " and " << r + 1 << std::endl;
+        stats[r].swaps_proposed++;
+        stats[r + 1].swaps_proposed++;
         if (swap(temp[r], temp[r + 1], state[r], state[r + 1], G[r],
                  G[r + 1])) {
+          stats[r].swaps_accepted++;
+          stats[r + 1].swaps_accepted++;
           trajectory[r].push_back(E(state[r], G[r]));
           trajectory[r + 1].push_back(E(state[r + 1], G[r + 1]));
           if (verbosity >= Verbosity::info)
@@ -11,6 +11,7 @@
  * =====================================================================================
  */
 
+#include <limits>
 #include "align.hpp"
 
 using namespace std;
@@ -18,7 +19,7 @@ using namespace std;
 const char TERMINATOR_SYMBOL = '$';
 
 vector<symbol_t> collapse_collection(const Seeding::Collection &collection,
-                                     vector<size_t> &pos2seq,
+                                     SequenceRanks &pos2seq,
                                      vector<size_t> &seq2set,
                                      vector<size_t> &set2contrast,
                                      bool allow_iupac_wildcards) {
@@ -31,8 +32,7 @@ vector<symbol_t> collapse_collection(const Seeding::Collection &collection,
       for (auto &seq : dataset) {
         add_sequence(s, seq.sequence + TERMINATOR_SYMBOL,
                      allow_iupac_wildcards);
-        for (size_t i = 0; i < seq.sequence.size() + 1; i++)
-          pos2seq.push_back(seq_idx);
+        pos2seq.add(seq.sequence.size() + 1);
         seq2set.push_back(set_idx);
         seq_idx++;
       }
@@ -43,3 +43,53 @@ vector<symbol_t> collapse_collection(const Seeding::Collection &collection,
   }
   return s;
 }
+
+/** Whether the collapsed collection is too long for 32 bit indices; the
+ * suffix array construction pads the data by three symbols */
+bool needs_wide_index(const Seeding::Collection &collection) {
+  size_t n = 3;
+  for (auto &contrast : collection)
+    for (auto &dataset : contrast)
+      for (auto &seq : dataset)
+        n += seq.sequence.size() + 1;
+  return n > numeric_limits<uint32_t>::max();
+}
+
+CompactNucleotideIndex::CompactNucleotideIndex(Verbosity verbosity)
+    : wide(false), narrow_index(verbosity), wide_index(verbosity) {}
+
+CompactNucleotideIndex::CompactNucleotideIndex(
+    const Seeding::Collection &collection, bool allow_iupac_wildcards,
+    Verbosity verbosity)
+    : wide(needs_wide_index(collection)),
+      // only the index that is used is built, in place
+      narrow_index(wide ? NucleotideIndex<uint32_t>(verbosity)
+                        : NucleotideIndex<uint32_t>(
+                              collection, allow_iupac_wildcards, verbosity)),
+      wide_index(wide ? NucleotideIndex<uint64_t>(collection,
+                                                  allow_iupac_wildcards,
+                                                  verbosity)
+                      : NucleotideIndex<uint64_t>(verbosity)) {}
+
+vector<vector<size_t>> CompactNucleotideIndex::hits_by_file(
+    const vector<base_type> &queries, bool word_stats, bool revcomp) const {
+  if (wide)
+    return wide_index.hits_by_file(queries, word_stats, revcomp);
+  else
+    return narrow_index.hits_by_file(queries, word_stats, revcomp);
+}
+
+bool CompactNucleotideIndex::mask(const Seeding::Collection &collection,
+                                  bool allow_iupac_wildcards) {
+  if (wide)
+    return wide_index.mask(collection, allow_iupac_wildcards);
+  else
+    return narrow_index.mask(collection, allow_iupac_wildcards);
+}
+
+double CompactNucleotideIndex::masked_fraction() const {
+  if (wide)
+    return wide_index.masked_fraction();
+  else
+    return narrow_index.masked_fraction();
+}
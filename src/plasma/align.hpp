@@ -32,6 +32,7 @@
 
 #include <iostream>
 #include <cstring>
+#include <numeric>
 #include <vector>
 #include "suffix.hpp"
 #include "align.hpp"
@@ -43,16 +44,19 @@ bool binary_and_not_null(T a, T b) {
   return (a & b) != 0;
 }
 
-template <class data_t, class idx_t = size_t, class lcp_t = size_t,
-          bool shift = false>
+template <class data_t, class idx_t = size_t,
+          class lcp_table_t = std::vector<size_t>, bool shift = false>
 class Index {
 public:
   Index(const data_t &x, Verbosity verbosity)
       : data(x),
         // generate suffix array, LCP, and JMP tables
         sa(gen_suffix_array<shift, idx_t>(begin(data), end(data), verbosity)),
-        lcp(gen_lcp<lcp_t>(begin(data), end(data), sa, verbosity)),
-        jmp(gen_jmp<idx_t>(lcp, verbosity)){};
+        lcp(),
+        jmp() {
+    gen_lcp(begin(data), end(data), sa, verbosity, lcp);
+    jmp = gen_jmp<idx_t>(lcp, verbosity);
+  };
 
   template <class Cmp = std::equal_to<typename data_t::value_type>>
   std::vector<idx_t> find_matches(const data_t &query, Cmp cmp = Cmp()) const {
@@ -60,34 +64,90 @@ public:
                  cmp);
   };
 
+  /** Find the occurrences of several sorted queries at once; see match_batch
+   */
+  template <class Cmp, class Report>
+  void find_matches(const std::vector<data_t> &queries, Report report,
+                    Cmp cmp) const {
+    match_batch(queries, begin(data), end(data), sa, lcp, jmp, cmp, report);
+  };
+
+  /** The position in the data of the suffix of the given rank */
+  idx_t position(idx_t rank) const { return sa[rank]; };
+
+  /** The symbol at a position in the data */
+  typename data_t::value_type symbol(idx_t pos) const { return data[pos]; };
+
 private:
   data_t data;             // the original data
   std::vector<idx_t> sa;   // suffix array
-  std::vector<lcp_t> lcp;  // LCP table
+  lcp_table_t lcp;         // LCP table
   std::vector<idx_t> jmp;  // JMP table
 };
 
+/** The sequence containing each position of a collapsed collection. Instead
+ * of storing it for every position, the positions where the sequences begin
+ * are stored, together with the sequence of every 2^sample_bits-th position,
+ * from which the boundaries are scanned. */
+class SequenceRanks {
+public:
+  SequenceRanks() : starts(1, 0), samples(){};
+
+  /** Append a sequence of the given length */
+  void add(size_t length) {
+    const size_t seq_idx = starts.size() - 1;
+    const size_t end = starts.back() + length;
+    for (size_t pos = samples.size() << sample_bits; pos < end;
+         pos += size_t(1) << sample_bits)
+      samples.push_back(seq_idx);
+    starts.push_back(end);
+  };
+
+  /** The sequence containing a position */
+  size_t operator[](size_t pos) const {
+    size_t seq_idx = samples[pos >> sample_bits];
+    while (starts[seq_idx + 1] <= pos)
+      seq_idx++;
+    return seq_idx;
+  };
+
+  /** The total length of the sequences */
+  size_t size() const { return starts.back(); };
+
+  bool operator==(const SequenceRanks &other) const {
+    return starts == other.starts;
+  };
+  bool operator!=(const SequenceRanks &other) const {
+    return not(*this == other);
+  };
+
+private:
+  static const size_t sample_bits = 6;
+  std::vector<size_t> starts;
+  std::vector<size_t> samples;
+};
+
 seq_type collapse_collection(const Seeding::Collection &collection,
-                             std::vector<size_t> &pos2seq,
+                             SequenceRanks &pos2seq,
                              std::vector<size_t> &seq2set,
                              std::vector<size_t> &set2contrast,
                              bool allow_iupac_wildcards);
 
-template <class idx_t = size_t, class lcp_t = size_t, class base_t = seq_type,
-          class index_t = Index<base_t, idx_t, lcp_t, true>>
+template <class idx_t = size_t, class lcp_table_t = CompactLCP<idx_t>,
+          class base_t = seq_type,
+          class index_t = Index<base_t, idx_t, lcp_table_t, true>>
 class NucleotideIndex {
 public:
   using base_type = base_t;
 
-  NucleotideIndex(const NucleotideIndex &i)
-      : paths(i.paths),
-        pos2seq(i.pos2seq),
-        seq2set(i.seq2set),
-        set2contrast(i.set2contrast),
-        index(i.index){};
-
   NucleotideIndex(Verbosity verbosity = Verbosity::info)
-      : paths(), pos2seq(), seq2set(), set2contrast(), index({}, verbosity){};
+      : paths(),
+        pos2seq(),
+        seq2set(),
+        set2contrast(),
+        masked(),
+        n_masked(0),
+        index({}, verbosity){};
 
   NucleotideIndex(const Seeding::Collection &collection,
                   bool allow_iupac_wildcards, Verbosity verbosity)
@@ -95,30 +155,62 @@ public:
         pos2seq(),
         seq2set(),
         set2contrast(),
+        masked(),
+        n_masked(0),
         index(collapse_collection(collection, pos2seq, seq2set, set2contrast,
                                   allow_iupac_wildcards),
               verbosity) {
     for (auto &contrast : collection)
       for (auto &dataset : contrast)
         paths.push_back(dataset.path);
+    masked.resize(pos2seq.size(), false);
+  };
+
+  /** Excludes from matching the positions that have been masked in the
+   * collection since the index was built, i.e. those whose symbols now match
+   * nothing. The suffix array is kept, and hits overlapping masked positions
+   * are skipped when counting. Returns false without any changes if the
+   * sequences of the collection differ otherwise, e.g. because sequences were
+   * removed; the index then has to be rebuilt. */
+  bool mask(const Seeding::Collection &collection,
+            bool allow_iupac_wildcards) {
+    SequenceRanks pos2seq_;
+    std::vector<size_t> seq2set_, set2contrast_;
+    auto data = collapse_collection(collection, pos2seq_, seq2set_,
+                                    set2contrast_, allow_iupac_wildcards);
+    if (pos2seq_ != pos2seq or seq2set_ != seq2set)
+      return false;
+    for (size_t pos = 0; pos < data.size(); pos++)
+      if (data[pos] == 0 and not masked[pos] and index.symbol(pos) != 0) {
+        masked[pos] = true;
+        n_masked++;
+      }
+    return true;
+  };
+
+  /** The fraction of positions excluded from matching by mask */
+  double masked_fraction() const {
+    return pos2seq.size() == 0 ? 0 : 1.0 * n_masked / pos2seq.size();
   };
 
   std::vector<size_t> word_hits_by_file(const base_type &query,
                                         bool revcomp = false) const {
     std::vector<size_t> counts(paths.size(), 0);
-    for (auto &p : index.find_matches(query, binary_and_not_null<symbol_t>)) {
-      size_t seqIdx = pos2seq[p];
-      size_t fileIdx = seq2set[seqIdx];
-      counts[fileIdx]++;
-    }
+    for (auto &p : index.find_matches(query, binary_and_not_null<symbol_t>))
+      if (unmasked(p, query.size())) {
+        size_t seqIdx = pos2seq[p];
+        size_t fileIdx = seq2set[seqIdx];
+        counts[fileIdx]++;
+      }
     if (revcomp) {
       auto rc = iupac_reverse_complement(query);
       if (rc != query)
-        for (auto &p : index.find_matches(rc, binary_and_not_null<symbol_t>)) {
-          size_t seqIdx = pos2seq[p];
-          size_t fileIdx = seq2set[seqIdx];
-          counts[fileIdx]++;
-        }
+        for (auto &p : index.find_matches(rc, binary_and_not_null<symbol_t>))
+          if (unmasked(p, rc.size())) {
+            size_t seqIdx = pos2seq[p];
+            size_t fileIdx = seq2set[seqIdx];
+            counts[fileIdx]++;
+          }
     }
     return counts;
   };
@@ -127,12 +219,14 @@ public:
                                         bool revcomp = false) const {
     std::unordered_set<size_t> seqs;
     for (auto &p : index.find_matches(query, binary_and_not_null<symbol_t>))
-      seqs.insert(pos2seq[p]);
+      if (unmasked(p, query.size()))
+        seqs.insert(pos2seq[p]);
     if (revcomp) {
       auto rc = iupac_reverse_complement(query);
       if (rc != query)
         for (auto &p : index.find_matches(rc, binary_and_not_null<symbol_t>))
-          seqs.insert(pos2seq[p]);
+          if (unmasked(p, rc.size()))
+            seqs.insert(pos2seq[p]);
     }
 
     std::vector<size_t> counts(paths.size(), 0);
@@ -145,12 +239,14 @@ public:
                                        bool revcomp = false) const {
     std::vector<size_t> seqs;
     for (auto &p : index.find_matches(query, binary_and_not_null<symbol_t>))
-      seqs.push_back(pos2seq[p]);
+      if (unmasked(p, query.size()))
+        seqs.push_back(pos2seq[p]);
     if (revcomp) {
       auto rc = iupac_reverse_complement(query);
       if (rc != query)
         for (auto &p : index.find_matches(rc, binary_and_not_null<symbol_t>))
-          seqs.push_back(pos2seq[p]);
+          if (unmasked(p, rc.size()))
+            seqs.push_back(pos2seq[p]);
     }
 
     std::sort(begin(seqs), end(seqs));
@@ -162,10 +258,105 @@ public:
     return counts;
   };
 
+  /** The counts by file of a batch of queries, as given by word_hits_by_file
+   * or seq_hits_by_file for each of them. The queries and their reverse
+   * complements are matched together, so that shared prefixes are matched
+   * once, and the hits are counted without collecting their positions. */
+  std::vector<std::vector<size_t>> hits_by_file(
+      const std::vector<base_type> &queries, bool word_stats,
+      bool revcomp = false) const {
+    std::vector<base_type> patterns;
+    std::vector<size_t> owners;
+    for (size_t i = 0; i < queries.size(); i++) {
+      patterns.push_back(queries[i]);
+      owners.push_back(i);
+      if (revcomp) {
+        auto rc = iupac_reverse_complement(queries[i]);
+        if (rc != queries[i]) {
+          patterns.push_back(rc);
+          owners.push_back(i);
+        }
+      }
+    }
+    std::vector<size_t> order(patterns.size());
+    std::iota(begin(order), end(order), 0);
+    std::sort(begin(order), end(order), [&](size_t a, size_t b) {
+      return patterns[a] < patterns[b];
+    });
+    std::vector<base_type> sorted;
+    sorted.reserve(patterns.size());
+    for (auto p : order)
+      sorted.push_back(std::move(patterns[p]));
+
+    // the intervals of the suffix array matched by each query
+    std::vector<std::vector<std::pair<size_t, size_t>>> intervals(
+        queries.size());
+    index.find_matches(sorted, [&](size_t p, size_t first, size_t last) {
+      intervals[owners[order[p]]].push_back({first, last});
+    }, binary_and_not_null<symbol_t>);
+
+    std::vector<std::vector<size_t>> counts(
+        queries.size(), std::vector<size_t>(paths.size(), 0));
+    // the last query for which each sequence was counted
+    std::vector<size_t> counted(seq2set.size(), queries.size());
+    for (size_t q = 0; q < queries.size(); q++)
+      for (auto &interval : intervals[q])
+        for (size_t k = interval.first; k < interval.second; k++) {
+          size_t pos = index.position(k);
+          if (not unmasked(pos, queries[q].size()))
+            continue;
+          size_t seqIdx = pos2seq[pos];
+          if (word_stats)
+            counts[q][seq2set[seqIdx]]++;
+          else if (counted[seqIdx] != q) {
+            counted[seqIdx] = q;
+            counts[q][seq2set[seqIdx]]++;
+          }
+        }
+    return counts;
+  };
+
 private:
   std::vector<std::string> paths;
-  std::vector<size_t> pos2seq, seq2set, set2contrast;
+  SequenceRanks pos2seq;
+  std::vector<size_t> seq2set, set2contrast;
+  std::vector<bool> masked;  // positions excluded from matching
+  size_t n_masked;
   index_t index;
+
+  /** Whether none of the positions of a hit have been masked */
+  bool unmasked(size_t pos, size_t length) const {
+    if (n_masked == 0)
+      return true;
+    for (size_t i = 0; i < length; i++)
+      if (masked[pos + i])
+        return false;
+    return true;
+  };
+};
+
+/** A NucleotideIndex using 32 bit indices for collections that are small
+ * enough for them, and 64 bit indices otherwise */
+class CompactNucleotideIndex {
+public:
+  using base_type = seq_type;
+
+  CompactNucleotideIndex(Verbosity verbosity = Verbosity::info);
+  CompactNucleotideIndex(const Seeding::Collection &collection,
+                         bool allow_iupac_wildcards, Verbosity verbosity);
+
+  /** See NucleotideIndex::hits_by_file */
+  std::vector<std::vector<size_t>> hits_by_file(
+      const std::vector<base_type> &queries, bool word_stats,
+      bool revcomp = false) const;
+  /** See NucleotideIndex::mask */
+  bool mask(const Seeding::Collection &collection, bool allow_iupac_wildcards);
+  double masked_fraction() const;
+
+private:
+  bool wide;
+  NucleotideIndex<uint32_t> narrow_index;
+  NucleotideIndex<uint64_t> wide_index;
 };
 
 #endif
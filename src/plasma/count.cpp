@@ -11,6 +11,7 @@
  * =====================================================================================
  */
 
+#include <omp.h>
 #include "../aux.hpp"
 #include "code.hpp"
 #include "data.hpp"
@@ -49,6 +50,71 @@ hash_map_t get_word_counts(const Collection &collection, size_t length,
   return counts;
 }
 
+KmerCounts count_kmers(const Collection &collection, size_t length,
+                       const Options &options) {
+  Timer t;
+
+  vector<pair<const string *, size_t>> sequences;
+  size_t n_samples = 0;
+  for (auto &contrast : collection)
+    for (auto &dataset : contrast) {
+      for (auto &seq : dataset)
+        sequences.push_back({&seq.sequence, n_samples});
+      n_samples++;
+    }
+
+  if (options.verbosity >= Verbosity::debug)
+    cout << "Getting packed word counts for " << n_samples << " samples."
+         << endl;
+
+  // short words are counted by all threads in one array; otherwise, each
+  // thread counts into its own hash table, and these are merged pairwise in
+  // parallel afterwards
+  const size_t n_threads = sequences.size() > 1 ? omp_get_max_threads() : 1;
+  KmerCounts counts(length, n_samples);
+  const bool shared = counts.is_dense();
+  vector<KmerCounts> tables(shared ? 0 : n_threads,
+                            KmerCounts(length, n_samples));
+  const bool canonical = not options.word_stats;
+#pragma omp parallel num_threads(n_threads)
+  {
+    vector<kmer_t> words;
+#pragma omp for schedule(dynamic, 64)
+    for (size_t i = 0; i < sequences.size(); i++) {
+      words.clear();
+      packed_words(*sequences[i].first, length, options.revcomp, canonical,
+                   words);
+      // without word statistics, each word is counted once per sequence
+      if (not options.word_stats) {
+        sort(begin(words), end(words));
+        words.resize(unique(begin(words), end(words)) - begin(words));
+      }
+      if (shared)
+        for (auto word : words)
+          counts.add_concurrent(word, sequences[i].second);
+      else {
+        KmerCounts &local = tables[omp_get_thread_num()];
+        for (auto word : words)
+          local.add(word, sequences[i].second);
+      }
+    }
+  }
+  if (not shared) {
+    for (size_t step = 1; step < n_threads; step *= 2) {
+#pragma omp parallel for schedule(dynamic, 1)
+      for (size_t t = 0; t < n_threads - step; t += 2 * step)
+        tables[t].merge(tables[t + step]);
+    }
+    counts = move(tables[0]);
+  }
+
+  if (options.measure_runtime)
+    cerr << "Got packed word counts of length " + to_string(length) + " in "
+            + time_to_pretty_string(t.tock()) << endl;
+
+  return counts;
+}
+
 size_t count_motif(const string &seq, const string &motif,
                    const Options &options) {
   size_t cnt = 0;
@@ -35,6 +35,7 @@
 #include <list>
 #include "options.hpp"
 #include "plasma_stats.hpp"
+#include "kmer.hpp"
 
 namespace Seeding {
 /** Count occurrences of non-degenerate words
@@ -48,6 +49,13 @@ void add_counts(const Set &dataset, size_t len, hash_map_t &counts, size_t idx,
 
 hash_map_t get_word_counts(const Collection &collection, size_t length,
                            const Options &options);
+/** Count occurrences of non-degenerate words of up to KmerCounts::max_length
+ * nucleotides, packed into integers. The sequences are processed in parallel;
+ * the threads count short words into one array, and longer ones each into
+ * its own hash table.
+ */
+KmerCounts count_kmers(const Collection &collection, size_t length,
+                       const Options &options);
 count_vector_t count_motif(const Collection &collection,
                            const std::string &motif, const Options &options);
 
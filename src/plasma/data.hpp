@@ -30,11 +30,13 @@
 #ifndef DATA_HPP
 #define DATA_HPP
 
+#include <algorithm>
 #include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include "specification.hpp"
 #include "fasta.hpp"
+#include "sequence_cache.hpp"
 
 std::string sha1hash(const std::string &s);
 
@@ -67,13 +69,18 @@ struct Set : public Specification::Set {
   Set() : Specification::Set(), seq_size(0), set_size(0), sequences(){};
   Set(const Specification::Set &s, bool revcomp = false, size_t n_seq = 0)
       : Specification::Set(s), seq_size(0), set_size(0), sequences() {
-    read_fasta(path, sequences, revcomp, n_seq, is_shuffle);
-
-    sha1 = compute_sha1();
+    if (is_shuffle
+        or not Fasta::SequenceCache::load(path, revcomp, n_seq, sequences,
+                                          sha1)) {
+      read_fasta(path, sequences, revcomp, n_seq, is_shuffle);
+      sha1 = compute_sha1();
+      if (not is_shuffle)
+        Fasta::SequenceCache::save(path, revcomp, n_seq, sequences, sha1);
+    }
 
     set_size = sequences.size();
     for (auto &seq : sequences)
-      seq_size += seq.sequence.size();
+      seq_size += seq.size();
   };
   template <typename Y>
   Set(const Set<Y> &set)
@@ -84,7 +91,7 @@ struct Set : public Specification::Set {
         sha1(set.sha1) {
     for (auto &seq : set) {
       seq_t s(seq);
-      seq_size += s.sequence.size();
+      seq_size += s.size();
       sequences.push_back(s);
     }
   };
@@ -100,7 +107,7 @@ struct Set : public Specification::Set {
   std::string compute_sha1() const {
     std::string d;
     for (auto &s : sequences)
-      d += s.sequence;
+      d += Fasta::text(s);
     return sha1hash(d);
   }
 
@@ -132,9 +139,9 @@ struct Set : public Specification::Set {
         if (noisy_output)
           std::cerr << "Dropping!" << std::endl;
         report.sequences++;
-        report.nucleotides += iter->sequence.size();
+        report.nucleotides += iter->size();
         set_size--;
-        seq_size -= iter->sequence.size();  // TODO: find out if this is correct
+        seq_size -= iter->size();  // TODO: find out if this is correct
                                             // for reverse complements
         auto i = iter;
         bool done = (++i) == sequences.rend();
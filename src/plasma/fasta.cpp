@@ -1,4 +1,5 @@
 
+#include <cstring>
 #include <random>
 #include "fasta.hpp"
 #include "../random_distributions.hpp"
@@ -29,10 +30,9 @@ mt19937 Fasta::EntropySource::random_nucl_rng;
 Entry::Entry() : definition(), sequence(){};
 Entry::Entry(const Entry &entry)
     : definition(entry.definition), sequence(entry.sequence){};
-Entry::Entry(const IEntry &ientry) : definition(ientry.definition), sequence() {
-  size_t pos = ientry.sequence.find("$");
-  sequence = ientry.sequence.substr(0, pos);
-}
+Entry::Entry(const IEntry &ientry)
+    : definition(ientry.definition),
+      sequence(ientry.isequence.forward_text()){};
 
 size_t Entry::mask(const vector<size_t> &positions) {
   size_t masked_nucleotides = 0;
@@ -66,62 +66,17 @@ size_t Entry::mask(const vector<size_t> &positions) {
   return masked_nucleotides;
 }
 
-/** Convert a string of nucleic acids into an IEntry::seq_t
- * Note: characters other than 'acgt' are assigned random nucleotides
- *       if n_enc < 0.
- **/
-IEntry::seq_t string2seq(const string &s, int n_enc = -1) {
-  IEntry::seq_t seq(s.size());
-  size_t idx = 0;
-  for (auto iter : s) {
-    switch (tolower(iter)) {
-      case 'a':
-        seq[idx] = 0;
-        break;
-      case 'c':
-        seq[idx] = 1;
-        break;
-      case 'g':
-        seq[idx] = 2;
-        break;
-      case 't':
-      case 'u':
-        seq[idx] = 3;
-        break;
-      case '$':
-        seq[idx] = IEntry::empty_symbol;
-        break;
-      default:
-        if (n_enc < 0)
-          seq[idx]
-              = RandomDistribution::Nucleotide(EntropySource::random_nucl_rng);
-        else
-          seq[idx] = n_enc;
-    }
-    idx++;
-  }
-  return seq;
-}
-
-IEntry::IEntry(const Entry &entry)
-    : Entry(entry), isequence(string2seq(entry.sequence)){};
+IEntry::IEntry(const Entry &entry, bool revcomp)
+    : definition(entry.definition),
+      isequence(entry.sequence, revcomp, EntropySource::random_nucl_rng){};
 
 size_t IEntry::mask(const vector<size_t> &positions) {
   size_t masked_nucleotides = 0;
   // uses random nucleotides;
-  // const char mask_symbol = 'n';
-  // const Verbosity verbosity = Verbosity::info;
-  size_t dollar_position = sequence.find("$");
-  for (auto pos : positions) {
-    // TODO do something more sensible than random nucleotides
-    size_t nucl_idx
-        = RandomDistribution::Nucleotide(EntropySource::random_nucl_rng);
-    sequence[pos] = "acgt"[nucl_idx];
-    if (dollar_position != string::npos)
-      sequence[sequence.size() - pos - 1] = "tgca"[nucl_idx];
-  }
-
-  isequence = string2seq(sequence);
+  // TODO do something more sensible than random nucleotides
+  for (auto pos : positions)
+    isequence.set(pos, RandomDistribution::Nucleotide(
+                           EntropySource::random_nucl_rng));
   return masked_nucleotides;
 }
 
@@ -130,6 +85,11 @@ ostream &operator<<(ostream &os, const Entry &entry) {
   return os;
 }
 
+ostream &operator<<(ostream &os, const IEntry &entry) {
+  os << entry.string();
+  return os;
+}
+
 istream &operator>>(istream &is, Entry &entry) {
   // consume until '>'
   char c;
@@ -201,20 +161,212 @@ istream &operator>>(istream &is, vector<IEntry> &seqs) {
   return is;
 }
 
-void read_fasta(const string &path, vector<Entry> &sequences, bool revcomp,
-                size_t n_seq, bool shuffled) {
-  try {
-    parse_file(path, [&](istream &is) { is >> sequences; });
-  } catch (runtime_error &e) {
-    std::cout << "Error while reading FASTA file " << path << "." << std::endl;
-    throw e;
+namespace {
+enum class CharClass : unsigned char { Nucleotide = 0, Space, Other };
+
+/** Character classes of the FASTA reader. */
+struct CharTable {
+  CharTable() {
+    for (size_t c = 0; c < 256; c++)
+      cls[c] = isspace(c) ? CharClass::Space : CharClass::Other;
+    for (auto c : valid_nucleotides) {
+      cls[static_cast<unsigned char>(c)] = CharClass::Nucleotide;
+      cls[toupper(c)] = CharClass::Nucleotide;
+    }
+  };
+  CharClass cls[256];
+};
+const CharTable char_table;
+
+/** Reads FASTA and FASTQ formatted input in blocks.
+ *
+ * The records are passed to the sink while they are read: sink.begin() with
+ * the definition at the start of a record, sink.append() for every stretch of
+ * nucleotides, and sink.end() at its end. The format is FASTQ if the first
+ * character other than white space is '@'. If n_seq is positive, reading
+ * stops after n_seq records instead of consuming the rest of the input.
+ */
+template <typename Sink>
+void read_records(istream &is, Sink &sink, size_t n_seq) {
+  enum class State {
+    Preamble,
+    Definition,
+    Sequence,
+    FastqDefinition,
+    FastqSequence,
+    FastqSeparator,
+    FastqQuality
+  };
+  State state = State::Preamble;
+  bool fastq = false, seen_text = false, line_start = true;
+  string definition;
+  size_t n_records = 0, seq_len = 0, qual_len = 0;
+  bool done = false;
+
+  auto finish = [&]() {
+    sink.end();
+    done = n_seq > 0 and ++n_records == n_seq;
+  };
+
+  const size_t block_size = 1 << 20;
+  vector<char> buffer(block_size);
+  while (not done) {
+    is.read(buffer.data(), block_size);
+    const char *p = buffer.data(), *end = p + is.gcount();
+    if (p == end)
+      break;
+    while (not done and p != end)
+      switch (state) {
+        case State::Preamble: {
+          const char c = *p++;
+          if (c == '>')
+            state = State::Definition;
+          else if (c == '@' and (fastq or not seen_text)) {
+            fastq = true;
+            state = State::FastqDefinition;
+          } else if (not isspace(c))
+            seen_text = true;
+        } break;
+        case State::Definition:
+        case State::FastqDefinition: {
+          const char *eol
+              = static_cast<const char *>(memchr(p, '\n', end - p));
+          definition.append(p, eol == nullptr ? end : eol);
+          p = eol == nullptr ? end : eol + 1;
+          if (eol != nullptr) {
+            sink.begin(move(definition));
+            definition.clear();
+            state = state == State::Definition ? State::Sequence
+                                               : State::FastqSequence;
+            line_start = true;
+            seq_len = 0;
+          }
+        } break;
+        case State::Sequence: {
+          // whole lines of nucleotides are passed on at once
+          const char *eol;
+          while (p != end
+                 and (eol = static_cast<const char *>(
+                          memchr(p, '\n', end - p))) != nullptr) {
+            unsigned char other = 0;
+            for (const char *q = p; q != eol; q++)
+              other |= static_cast<unsigned char>(
+                  char_table.cls[static_cast<unsigned char>(*q)]);
+            if (other != 0)
+              break;
+            if (eol != p)
+              sink.append(p, eol);
+            p = eol + 1;
+          }
+          const char *run = p;
+          for (; p != end; p++) {
+            const CharClass cls = char_table.cls[static_cast<unsigned char>(*p)];
+            if (cls == CharClass::Nucleotide)
+              continue;
+            if (run != p)
+              sink.append(run, p);
+            run = p + 1;
+            if (cls == CharClass::Space)
+              continue;
+            if (*p != '>')
+              throw Exception::NucleicAcids::InvalidNucleotideCode(*p);
+            break;
+          }
+          if (p == end) {
+            if (run < end)
+              sink.append(run, end);
+          } else {
+            p++;
+            finish();
+            state = State::Definition;
+          }
+        } break;
+        case State::FastqSequence: {
+          const char *run = p;
+          for (; p != end; p++) {
+            if (line_start and *p == '+')
+              break;
+            line_start = false;
+            const CharClass cls = char_table.cls[static_cast<unsigned char>(*p)];
+            if (cls == CharClass::Nucleotide) {
+              seq_len++;
+              continue;
+            }
+            if (run != p)
+              sink.append(run, p);
+            run = p + 1;
+            if (*p == '\n')
+              line_start = true;
+            else if (cls != CharClass::Space)
+              throw Exception::NucleicAcids::InvalidNucleotideCode(*p);
+          }
+          if (run < p)
+            sink.append(run, p);
+          if (p != end) {
+            p++;
+            state = State::FastqSeparator;
+          }
+        } break;
+        case State::FastqSeparator: {
+          const char *eol
+              = static_cast<const char *>(memchr(p, '\n', end - p));
+          p = eol == nullptr ? end : eol + 1;
+          if (eol != nullptr) {
+            state = State::FastqQuality;
+            qual_len = 0;
+          }
+        } break;
+        case State::FastqQuality:
+          for (; p != end and qual_len < seq_len; p++)
+            if (*p != '\n' and *p != '\r')
+              qual_len++;
+          if (qual_len == seq_len) {
+            finish();
+            state = State::Preamble;
+          }
+          break;
+      }
   }
 
-  // TODO: improve efficiency by only reading in n_seq sequences
-  if (n_seq > 0 and sequences.size() > n_seq)
-    sequences.resize(n_seq);
+  // a definition without line end is discarded
+  if (not done and state != State::Preamble and state != State::Definition
+      and state != State::FastqDefinition)
+    finish();
+
+  // reaching end-of-file is not an error
+  is.clear(is.bad() ? ios_base::badbit : ios_base::goodbit);
+}
+
+struct EntrySink {
+  vector<Entry> &entries;
+  void begin(string &&definition) {
+    entries.push_back(Entry());
+    entries.back().definition = move(definition);
+  };
+  void append(const char *first, const char *last) {
+    entries.back().sequence.append(first, last);
+  };
+  void end(){};
+};
+
+/** Encodes the sequences while they are read. */
+struct IEntrySink {
+  vector<IEntry> &entries;
+  bool revcomp;
+  mt19937 &rng;
+  void begin(string &&definition) {
+    entries.push_back(IEntry());
+    entries.back().definition = move(definition);
+    entries.back().isequence = PackedSequence(revcomp);
+  };
+  void append(const char *first, const char *last) {
+    entries.back().isequence.append(first, last, rng);
+  };
+  void end() { entries.back().isequence.shrink_to_fit(); };
+};
 
-  if (sequences.size() == 0) {
+void warn_if_empty(const string &path, size_t n, bool shuffled) {
+  if (n == 0) {
     // TODO: throw exception?
     if (not shuffled)
       cout << "Warning while parsing FASTA format file " << path
@@ -225,6 +377,20 @@ void read_fasta(const string &path, vector<Entry> &sequences, bool revcomp,
     cout << "Please check the format of this file and whether it is the right "
             "file." << endl;
   }
+}
+}
+
+void read_fasta(const string &path, vector<Entry> &sequences, bool,
+                size_t n_seq, bool shuffled) {
+  try {
+    EntrySink sink = {sequences};
+    parse_file(path, [&](istream &is) { read_records(is, sink, n_seq); });
+  } catch (runtime_error &e) {
+    std::cout << "Error while reading FASTA file " << path << "." << std::endl;
+    throw e;
+  }
+
+  warn_if_empty(path, sequences.size(), shuffled);
 
   if (shuffled)
     for (auto &s : sequences) {
@@ -237,15 +403,27 @@ void read_fasta(const string &path, vector<Entry> &sequences, bool revcomp,
 
 void read_fasta(const string &path, vector<IEntry> &isequences, bool revcomp,
                 size_t n_seq, bool shuffled) {
-  vector<Entry> sequences;
-  read_fasta(path, sequences, revcomp, n_seq, shuffled);
-  for (auto &s : sequences) {
-    IEntry is(s);
-    if (revcomp)
-      is.sequence += "$" + reverse_complement(is.sequence);
-    is.isequence = string2seq(is.sequence);
-    isequences.push_back(is);
+  if (shuffled) {
+    // the shuffles are generated from the text
+    vector<Entry> sequences;
+    read_fasta(path, sequences, revcomp, n_seq, shuffled);
+    isequences.reserve(isequences.size() + sequences.size());
+    for (auto &s : sequences) {
+      isequences.push_back(IEntry(s, revcomp));
+      s = Entry();
+    }
+    return;
+  }
+
+  const size_t n_before = isequences.size();
+  try {
+    IEntrySink sink = {isequences, revcomp, EntropySource::random_nucl_rng};
+    parse_file(path, [&](istream &is) { read_records(is, sink, n_seq); });
+  } catch (runtime_error &e) {
+    std::cout << "Error while reading FASTA file " << path << "." << std::endl;
+    throw e;
   }
+  warn_if_empty(path, isequences.size() - n_before, shuffled);
 };
 }
 
@@ -31,8 +31,9 @@
 #define FASTA_HPP
 
 #include <iostream>
+#include <random>
 #include <vector>
-#include <boost/numeric/ublas/vector.hpp>
+#include "packed_sequence.hpp"
 
 std::string reverse_complement(const std::string &s);
 
@@ -44,24 +45,41 @@ struct Entry {
   Entry(const IEntry &ientry);
   std::string definition;
   std::string sequence;
-  std::string string(size_t width = 60) const {
+  std::string string() const {
     return ">" + definition + "\n" + sequence;
   };
+  size_t size() const { return sequence.size(); };
   std::string reverse_complement() const {
     return ::reverse_complement(sequence);
   };
   size_t mask(const std::vector<size_t> &pos);
 };
-struct IEntry : public Entry {
-  using alphabet_idx_t = unsigned char;
-  using seq_t = boost::numeric::ublas::vector<alphabet_idx_t>;
-  // using seq_t = std::vector<alphabet_idx_t>;
-  static const alphabet_idx_t empty_symbol = 5;
+/** A sequence encoded for the dynamic programming algorithms.
+ *
+ * Only the packed representation of the sequence is kept; its text is
+ * re-constructed on demand for reporting.
+ */
+struct IEntry {
+  using alphabet_idx_t = PackedSequence::symbol_t;
+  using seq_t = PackedSequence;
+  static const alphabet_idx_t empty_symbol = PackedSequence::separator;
+  std::string definition;
   seq_t isequence;
-  IEntry(const Entry &entry = Entry());
+  IEntry(const Entry &entry = Entry(), bool revcomp = false);
+  /** Number of symbols, including separator and reverse complement. */
+  size_t size() const { return isequence.size(); };
+  /** The text of the sequence, including separator and reverse complement. */
+  std::string sequence() const { return isequence.text(); };
+  std::string string() const {
+    return ">" + definition + "\n" + sequence();
+  };
   size_t mask(const std::vector<size_t> &pos);
 };
 
+/** The text of a sequence, for code handling both kinds of entries. */
+inline const std::string &text(const Entry &entry) { return entry.sequence; }
+inline std::string text(const IEntry &entry) { return entry.sequence(); }
+
 template <typename X>
 struct Parser {
   X x;
@@ -87,6 +105,7 @@ std::istream &operator>>(std::istream &is, Parser<X> &parser) {
 };
 
 std::ostream &operator<<(std::ostream &os, const Entry &entry);
+std::ostream &operator<<(std::ostream &os, const IEntry &entry);
 std::istream &operator>>(std::istream &is, std::vector<Entry> &parser);
 std::istream &operator>>(std::istream &is, std::vector<IEntry> &parser);
 
@@ -108,8 +127,8 @@ private:
                          bool revcomp, size_t n_seq, bool shuffled);
   friend void read_fasta(const std::string &path, std::vector<IEntry> &entries,
                          bool revcomp, size_t n_seq, bool shuffled);
-  friend IEntry::seq_t string2seq(const std::string &s, int n_enc);
   friend struct IEntry;
+  friend struct SequenceCache;
 };
 }
 
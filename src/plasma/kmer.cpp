@@ -0,0 +1,198 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  kmer.cpp
+ *
+ *    Description:  Counting of words packed into 64 bit integers
+ *
+ *        Created:  10/16/2026 09:12:36 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#include <algorithm>
+#include <cctype>
+#include "kmer.hpp"
+
+using namespace std;
+
+namespace Seeding {
+
+/** Words up to this length are counted in an array, provided it stays within
+ * max_dense_counters */
+const size_t max_dense_length = 12;
+const size_t max_dense_counters = 1ul << 22;
+/** The initial number of slots of the hash table is 2^initial_bits */
+const size_t initial_bits = 16;
+
+/** The two bit codes of ACGT, in upper and lower case; 4 for other symbols */
+vector<uint8_t> build_nucleotide_codes() {
+  vector<uint8_t> codes(256, 4);
+  const string nucleotides = "acgt";
+  for (uint8_t i = 0; i < 4; i++) {
+    codes[static_cast<uint8_t>(nucleotides[i])] = i;
+    codes[static_cast<uint8_t>(toupper(nucleotides[i]))] = i;
+  }
+  return codes;
+}
+
+static const vector<uint8_t> nucleotide_codes = build_nucleotide_codes();
+
+KmerCounts::KmerCounts(size_t length_, size_t n_samples_)
+    : length(length_),
+      n_samples(n_samples_),
+      dense(length <= max_dense_length
+            and (n_samples << (2 * length)) <= max_dense_counters),
+      table(),
+      keys(),
+      used(),
+      n_used(0),
+      bits(initial_bits) {
+  if (dense)
+    table.resize(n_samples << (2 * length), 0);
+  else {
+    table.resize(n_samples << bits, 0);
+    keys.resize(1ul << bits);
+    used.resize(1ul << bits, false);
+  }
+}
+
+size_t KmerCounts::slot(kmer_t word) const {
+  const size_t mask = (1ul << bits) - 1;
+  size_t i = (word * 0x9E3779B97F4A7C15ull) >> (64 - bits);
+  while (used[i] and keys[i] != word)
+    i = (i + 1) & mask;
+  return i;
+}
+
+void KmerCounts::grow() {
+  vector<count_t> old_table;
+  vector<kmer_t> old_keys;
+  vector<bool> old_used;
+  swap(old_table, table);
+  swap(old_keys, keys);
+  swap(old_used, used);
+  bits++;
+  table.resize(n_samples << bits, 0);
+  keys.resize(1ul << bits);
+  used.resize(1ul << bits, false);
+  for (size_t i = 0; i < old_used.size(); i++)
+    if (old_used[i]) {
+      size_t j = slot(old_keys[i]);
+      used[j] = true;
+      keys[j] = old_keys[i];
+      copy(begin(old_table) + i * n_samples,
+           begin(old_table) + (i + 1) * n_samples,
+           begin(table) + j * n_samples);
+    }
+}
+
+KmerCounts::count_t *KmerCounts::find_or_insert(kmer_t word) {
+  if (dense)
+    return table.data() + word * n_samples;
+  size_t i = slot(word);
+  if (not used[i]) {
+    // keep the load factor at most one half
+    if (2 * (n_used + 1) > used.size()) {
+      grow();
+      i = slot(word);
+    }
+    used[i] = true;
+    keys[i] = word;
+    n_used++;
+  }
+  return table.data() + i * n_samples;
+}
+
+void KmerCounts::add(kmer_t word, size_t sample) {
+  find_or_insert(word)[sample]++;
+}
+
+void KmerCounts::add_concurrent(kmer_t word, size_t sample) {
+  count_t &count = table[word * n_samples + sample];
+#pragma omp atomic
+  count++;
+}
+
+void KmerCounts::merge(const KmerCounts &other) {
+  if (dense) {
+    for (size_t i = 0; i < table.size(); i++)
+      table[i] += other.table[i];
+    return;
+  }
+  // inserting the words in the slot order of a larger table would cluster
+  // them in a smaller one
+  while (bits < other.bits)
+    grow();
+  for (size_t i = 0; i < other.used.size(); i++)
+    if (other.used[i]) {
+      count_t *counts = find_or_insert(other.keys[i]);
+      for (size_t s = 0; s < n_samples; s++)
+        counts[s] += other.table[i * n_samples + s];
+    }
+}
+
+vector<kmer_t> KmerCounts::words() const {
+  vector<kmer_t> result;
+  if (dense) {
+    for (kmer_t word = 0; word < table.size() / n_samples; word++)
+      for (size_t s = 0; s < n_samples; s++)
+        if (table[word * n_samples + s] > 0) {
+          result.push_back(word);
+          break;
+        }
+  } else {
+    for (size_t i = 0; i < used.size(); i++)
+      if (used[i])
+        result.push_back(keys[i]);
+    sort(begin(result), end(result));
+  }
+  return result;
+}
+
+const KmerCounts::count_t *KmerCounts::counts(kmer_t word) const {
+  if (dense)
+    return table.data() + word * n_samples;
+  return table.data() + slot(word) * n_samples;
+}
+
+seq_type KmerCounts::decode(kmer_t word) const {
+  static const seq_type symbols = encode("acgt");
+  seq_type seq(length);
+  for (size_t i = length; i > 0; i--) {
+    seq[i - 1] = symbols[word & 3];
+    word >>= 2;
+  }
+  return seq;
+}
+
+void packed_words(const string &seq, size_t length, bool revcomp,
+                  bool canonical, vector<kmer_t> &words) {
+  const kmer_t mask
+      = length == KmerCounts::max_length ? ~kmer_t(0)
+                                         : (kmer_t(1) << (2 * length)) - 1;
+  const size_t shift = 2 * (length - 1);
+  kmer_t fwd = 0, rev = 0;
+  size_t valid = 0;  // the number of consecutive ACGT nucleotides
+  for (auto c : seq) {
+    kmer_t code = nucleotide_codes[static_cast<uint8_t>(c)];
+    if (code > 3) {
+      valid = 0;
+      continue;
+    }
+    fwd = ((fwd << 2) | code) & mask;
+    rev = (rev >> 2) | ((3 - code) << shift);
+    if (++valid >= length) {
+      if (not revcomp)
+        words.push_back(fwd);
+      else if (canonical)
+        words.push_back(max(fwd, rev));
+      else {
+        words.push_back(fwd);
+        words.push_back(rev);
+      }
+    }
+  }
+}
+}
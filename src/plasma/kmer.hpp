@@ -0,0 +1,89 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  kmer.hpp
+ *
+ *    Description:  Counting of words packed into 64 bit integers
+ *
+ *        Created:  10/16/2026 09:12:36 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef KMER_HPP
+#define KMER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "code.hpp"
+
+namespace Seeding {
+/** A word of ACGT nucleotides, packed into two bits per nucleotide; the first
+ * nucleotide occupies the most significant bits in use, so that the order of
+ * the integers is the lexicographical order of the words. */
+using kmer_t = uint64_t;
+
+/** Occurrence counts of the words of a given length in a number of samples.
+ *
+ * For short words the counts are kept in an array indexed by the packed
+ * words, which threads may increment concurrently. Otherwise, an
+ * open-addressing hash table with linear probing is used.
+ */
+class KmerCounts {
+public:
+  using count_t = uint32_t;
+
+  /** The longest words that can be packed */
+  static const size_t max_length = 32;
+
+  KmerCounts(size_t length, size_t n_samples);
+
+  size_t length;
+  size_t n_samples;
+
+  /** Whether the counts are kept in an array, so that add_concurrent() may
+   * be used */
+  bool is_dense() const { return dense; };
+
+  /** Increment the count of a word in a sample */
+  void add(kmer_t word, size_t sample);
+  /** As above, but safe to call from concurrent threads; only for dense
+   * tables */
+  void add_concurrent(kmer_t word, size_t sample);
+  /** Add the counts of another table for the same length and samples */
+  void merge(const KmerCounts &other);
+
+  /** The words with a non-zero count, in increasing order */
+  std::vector<kmer_t> words() const;
+  /** The counts of a word in the samples; the word must have been added */
+  const count_t *counts(kmer_t word) const;
+
+  seq_type decode(kmer_t word) const;
+
+private:
+  bool dense;
+  /** The counts of the n_samples samples of each slot, contiguously */
+  std::vector<count_t> table;
+  /** Only for the hash table: the word of each slot and whether it is used */
+  std::vector<kmer_t> keys;
+  std::vector<bool> used;
+  size_t n_used;
+  /** log2 of the number of slots of the hash table */
+  size_t bits;
+
+  size_t slot(kmer_t word) const;
+  count_t *find_or_insert(kmer_t word);
+  void grow();
+};
+
+/** The packed words of the given length in a sequence, skipping those with
+ * other symbols than ACGT. If revcomp is set, then either both the words and
+ * their reverse complements are reported, or if canonical is set, just the
+ * larger one of the two. */
+void packed_words(const std::string &seq, size_t length, bool revcomp,
+                  bool canonical, std::vector<kmer_t> &words);
+}
+
+#endif /* ----- #ifndef KMER_HPP ----- */
@@ -0,0 +1,300 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  packed_sequence.cpp
+ *
+ *    Description:  Nucleotide sequences stored with two bits per base
+ *
+ *        Created:  10/16/2026 03:12:40 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#include <algorithm>
+#include <cctype>
+#include "packed_sequence.hpp"
+#include "fasta.hpp"
+#include "../random_distributions.hpp"
+
+using namespace std;
+
+namespace Fasta {
+
+namespace {
+const uint8_t ambiguous = 4, uracil = 8, upper = 16;
+
+/** For each character the nucleotide index in the lowest two bits, and flags
+ * for ambiguity codes, the letter u, and upper case. */
+struct CodeTable {
+  CodeTable() {
+    for (size_t c = 0; c < 256; c++)
+      code[c] = ambiguous | (isupper(c) ? upper : 0);
+    const string nucleotides = "acgtu";
+    for (size_t i = 0; i < nucleotides.size(); i++) {
+      const uint8_t x = min<size_t>(i, 3) | (nucleotides[i] == 'u' ? uracil : 0);
+      code[static_cast<unsigned char>(nucleotides[i])] = x;
+      code[toupper(nucleotides[i])] = x | upper;
+    }
+  };
+  uint8_t code[256];
+};
+const CodeTable code_table;
+}
+
+PackedSequence::PackedSequence() : PackedSequence(false){};
+
+PackedSequence::PackedSequence(bool revcomp_)
+    : length(0),
+      revcomp(revcomp_),
+      words(nullptr),
+      storage(),
+      owned(),
+      patches(),
+      annotation(){};
+
+PackedSequence::PackedSequence(const string &s, bool revcomp_, mt19937 &rng)
+    : PackedSequence(revcomp_) {
+  append(s.data(), s.data() + s.size(), rng);
+  shrink_to_fit();
+}
+
+void PackedSequence::append(const char *first, const char *last,
+                            mt19937 &rng) {
+  const size_t n = last - first;
+  vector<uint64_t> &w = own_words();
+  w.resize(n_words(length + n), 0);
+  words = w.data();
+  // the annotation is only acquired once it is needed
+  Annotation *a = nullptr;
+  if (annotation)
+    a = &own_annotation();
+  bool in_upper = a != nullptr and not a->upper_case.empty()
+                  and a->upper_case.back().second == length;
+  auto put = [&](size_t i, unsigned char c) {
+    const uint8_t x = code_table.code[c];
+    uint64_t nucleotide = x & 3;
+    if (x & (ambiguous | uracil)) {
+      if (x & ambiguous)
+        nucleotide = RandomDistribution::Nucleotide(rng);
+      if (a == nullptr)
+        a = &own_annotation();
+      const char symbol = tolower(c);
+      auto &exceptions = a->exceptions;
+      if (not exceptions.empty()
+          and exceptions.back().start + exceptions.back().length == i
+          and exceptions.back().symbol == symbol)
+        exceptions.back().length++;
+      else
+        exceptions.push_back({i, 1, symbol});
+    }
+    w[i / 32] |= nucleotide << (2 * (i % 32));
+    if (((x & upper) != 0) != in_upper) {
+      if (a == nullptr)
+        a = &own_annotation();
+      if (in_upper)
+        a->upper_case.back().second = i;
+      else
+        a->upper_case.push_back({i, i});
+      in_upper = not in_upper;
+    }
+  };
+
+  const size_t end = length + n;
+  // the nucleotides are encoded a word at a time if they are all acgt of one
+  // case, and one by one otherwise
+  for (size_t i = length; i < end;) {
+    const size_t next = min(end, (i / 32 + 1) * 32);
+    uint64_t word = 0;
+    uint8_t any = 0, all = 0xff;
+    for (size_t j = i; j < next; j++) {
+      const uint8_t x = code_table.code[static_cast<unsigned char>(first[j - i])];
+      word |= uint64_t(x & 3) << (2 * (j % 32));
+      any |= x;
+      all &= x;
+    }
+    if ((any & (ambiguous | uracil)) == 0
+        and (in_upper ? (all & upper) != 0 : (any & upper) == 0))
+      w[i / 32] |= word;
+    else
+      for (size_t j = i; j < next; j++)
+        put(j, first[j - i]);
+    first += next - i;
+    i = next;
+  }
+
+  length = end;
+  if (in_upper)
+    a->upper_case.back().second = length;
+}
+
+void PackedSequence::shrink_to_fit() {
+  if (owned) {
+    owned->shrink_to_fit();
+    words = owned->data();
+  }
+  if (annotation) {
+    Annotation &a = own_annotation();
+    a.exceptions.shrink_to_fit();
+    a.upper_case.shrink_to_fit();
+  }
+}
+
+void PackedSequence::set(size_t i, symbol_t symbol) {
+  if (i == length)
+    return;
+  if (i > length) {
+    i = 2 * length - i;
+    symbol = 3 - symbol;
+  }
+  vector<uint64_t> &w = own_words();
+  w[i / 32] &= ~(uint64_t(3) << (2 * (i % 32)));
+  w[i / 32] |= uint64_t(symbol) << (2 * (i % 32));
+
+  if (not annotation)
+    return;
+  Annotation &a = own_annotation();
+  auto &exceptions = a.exceptions;
+  auto &upper_case = a.upper_case;
+  // split the run of exceptions containing i, if any
+  auto exception = upper_bound(
+      begin(exceptions), end(exceptions), i,
+      [](size_t pos, const Exception &e) { return pos < e.start; });
+  if (exception != begin(exceptions)
+      and (--exception)->start + exception->length > i) {
+    const Exception e = *exception;
+    exception = exceptions.erase(exception);
+    if (i + 1 < e.start + e.length)
+      exception = exceptions.insert(
+          exception, {i + 1, e.start + e.length - i - 1, e.symbol});
+    if (e.start < i)
+      exceptions.insert(exception, {e.start, i - e.start, e.symbol});
+  }
+
+  auto run = upper_bound(begin(upper_case), end(upper_case),
+                         make_pair(i, length + 1));
+  if (run != begin(upper_case) and (--run)->second > i) {
+    const size_t first = run->first, last = run->second;
+    run = upper_case.erase(run);
+    if (i + 1 < last)
+      run = upper_case.insert(run, {i + 1, last});
+    if (first < i)
+      upper_case.insert(run, {first, i});
+  }
+}
+
+void PackedSequence::redraw_ambiguous(mt19937 &rng) {
+  if (not annotation or annotation->exceptions.empty())
+    return;
+  if (not owned) {
+    redraw_ambiguous_patches(rng);
+    return;
+  }
+  vector<uint64_t> &w = own_words();
+  for (auto &exception : annotation->exceptions)
+    if (exception.symbol != 'u')
+      for (size_t i = exception.start; i < exception.start + exception.length;
+           i++) {
+        const uint64_t x = RandomDistribution::Nucleotide(rng);
+        w[i / 32] &= ~(uint64_t(3) << (2 * (i % 32)));
+        w[i / 32] |= x << (2 * (i % 32));
+      }
+}
+
+void PackedSequence::redraw_ambiguous_patches(mt19937 &rng) {
+  vector<pair<size_t, uint64_t>> redrawn;
+  for (auto &exception : annotation->exceptions)
+    if (exception.symbol != 'u')
+      for (size_t i = exception.start; i < exception.start + exception.length;
+           i++) {
+        const size_t j = i / 32;
+        if (redrawn.empty() or redrawn.back().first != j)
+          redrawn.push_back({j, word(j)});
+        const uint64_t x = RandomDistribution::Nucleotide(rng);
+        redrawn.back().second &= ~(uint64_t(3) << (2 * (i % 32)));
+        redrawn.back().second |= x << (2 * (i % 32));
+      }
+  // if most words are replaced, a copy of all of them is hardly larger
+  if (2 * redrawn.size() > n_words(length)) {
+    vector<uint64_t> &w = own_words();
+    for (auto &patch : redrawn)
+      w[patch.first] = patch.second;
+    return;
+  }
+  auto p = make_shared<Patches>();
+  const size_t n_blocks = (n_words(length) + 63) / 64;
+  p->flags.assign(n_blocks, 0);
+  p->rank.assign(n_blocks, 0);
+  for (auto &patch : redrawn) {
+    p->flags[patch.first / 64] |= uint64_t(1) << (patch.first % 64);
+    p->words.push_back(patch.second);
+  }
+  for (size_t b = 1; b < n_blocks; b++)
+    p->rank[b] = p->rank[b - 1] + bitset<64>(p->flags[b - 1]).count();
+  patches = p;
+}
+
+uint64_t PackedSequence::fingerprint() const {
+  // mix each word into the state with the finalizer of SplitMix64
+  auto mix = [](uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  };
+  uint64_t h = mix(length);
+  const size_t n = n_words(length);
+  for (size_t j = 0; j < n; j++) {
+    uint64_t w = word(j);
+    // ignore the unused bits of the last word
+    if (j + 1 == n and length % 32 != 0)
+      w &= (uint64_t(1) << (2 * (length % 32))) - 1;
+    h = mix(h ^ w) + j;
+  }
+  return h;
+}
+
+vector<uint64_t> &PackedSequence::own_words() {
+  if (not owned or owned.use_count() > 1) {
+    if (words == nullptr)
+      owned = make_shared<vector<uint64_t>>(n_words(length), 0);
+    else
+      owned = make_shared<vector<uint64_t>>(words, words + n_words(length));
+    if (patches)
+      for (size_t j = 0; j < owned->size(); j++)
+        (*owned)[j] = patched_word(j);
+    patches.reset();
+    storage.reset();
+    words = owned->data();
+  }
+  return *owned;
+}
+
+PackedSequence::Annotation &PackedSequence::own_annotation() {
+  if (not annotation)
+    annotation = make_shared<Annotation>();
+  else if (annotation.use_count() > 1)
+    annotation = make_shared<Annotation>(*annotation);
+  return *annotation;
+}
+
+string PackedSequence::forward_text() const {
+  string s(length, ' ');
+  for (size_t i = 0; i < length; i++)
+    s[i] = "acgt"[code(i)];
+  if (annotation) {
+    for (auto &exception : annotation->exceptions)
+      fill_n(begin(s) + exception.start, exception.length, exception.symbol);
+    for (auto &run : annotation->upper_case)
+      for (size_t i = run.first; i < run.second; i++)
+        s[i] = toupper(s[i]);
+  }
+  return s;
+}
+
+string PackedSequence::text() const {
+  string s = forward_text();
+  if (revcomp)
+    s += "$" + ::reverse_complement(s);
+  return s;
+}
+}
@@ -0,0 +1,160 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  packed_sequence.hpp
+ *
+ *    Description:  Nucleotide sequences stored with two bits per base
+ *
+ *        Created:  10/16/2026 03:12:40 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef PACKED_SEQUENCE_HPP
+#define PACKED_SEQUENCE_HPP
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Fasta {
+
+/** Nucleotide sequence with two bits per base.
+ *
+ * The nucleotides are stored as indices 0 to 3 for a, c, g, and t. Stretches
+ * of positions whose text differs from that, i.e. ambiguity codes like n and
+ * the letter u, are recorded as runs of exceptions, and stretches of upper
+ * case letters as runs as well; both are only needed to reproduce the text
+ * for reporting, and are not allocated for sequences without them. For the
+ * dynamic programming the ambiguity codes are represented by random
+ * nucleotides.
+ *
+ * If the reverse complement is included, the symbols beyond the forward
+ * sequence are a separator followed by the reverse complement, which are
+ * computed on access from the forward sequence instead of being stored.
+ *
+ * The packed nucleotides may live in memory shared by several sequences, like
+ * a memory-mapped sequence cache, or by copies of a sequence; they are copied
+ * when a sequence is modified. The same holds for the exceptions and upper
+ * case runs, so that copying a sequence, e.g. into the training and test data
+ * of cross-validation, does not copy its contents. Only the random nucleotides
+ * of ambiguity codes are drawn anew for mapped sequences; the words holding
+ * them are kept as patches on top of the mapping.
+ */
+class PackedSequence {
+public:
+  using symbol_t = unsigned char;
+  static const symbol_t separator = 5;
+
+  PackedSequence();
+  /** An empty sequence, to be filled with append(). */
+  explicit PackedSequence(bool revcomp);
+  /** Encode the text s, optionally followed by its reverse complement.
+   * Ambiguity codes are assigned random nucleotides drawn with rng. */
+  PackedSequence(const std::string &s, bool revcomp, std::mt19937 &rng);
+
+  /** Number of symbols, including separator and reverse complement. */
+  size_t size() const { return revcomp ? 2 * length + 1 : length; };
+  /** Number of symbols of the forward strand. */
+  size_t forward_size() const { return length; };
+  bool has_revcomp() const { return revcomp; };
+
+  symbol_t operator()(size_t i) const {
+    if (i < length)
+      return code(i);
+    if (i == length)
+      return separator;
+    return 3 - code(2 * length - i);
+  };
+  symbol_t operator[](size_t i) const { return (*this)(i); };
+
+  /** Overwrite position i of the forward strand with nucleotide symbol; it
+   * will be shown in lower case. Positions of the reverse complement are
+   * mapped to the forward strand. */
+  void set(size_t i, symbol_t symbol);
+
+  /** The text of the sequence, including separator and reverse complement. */
+  std::string text() const;
+  /** The text of the forward strand. */
+  std::string forward_text() const;
+
+  /** Append the nucleotides of the text from first to last. Ambiguity codes
+   * are assigned random nucleotides drawn with rng. */
+  void append(const char *first, const char *last, std::mt19937 &rng);
+  /** Release spare capacity after the last append(). */
+  void shrink_to_fit();
+
+  /** Replace the nucleotides of all ambiguity codes by new random ones. */
+  void redraw_ambiguous(std::mt19937 &rng);
+
+  /** A hash of the nucleotides of the forward strand, including those drawn
+   * for ambiguity codes; equal for sequences with the same nucleotides. */
+  uint64_t fingerprint() const;
+
+private:
+  symbol_t code(size_t i) const { return (word(i / 32) >> (2 * (i % 32))) & 3; };
+  uint64_t word(size_t j) const { return patches ? patched_word(j) : words[j]; };
+  /** The word j, from the patches if it is replaced; in constant time, as it
+   * is used for every symbol in the dynamic programming. */
+  uint64_t patched_word(size_t j) const {
+    const uint64_t flags = patches->flags[j / 64];
+    const uint64_t bit = uint64_t(1) << (j % 64);
+    if (not(flags & bit))
+      return words[j];
+    return patches->words[patches->rank[j / 64]
+                          + std::bitset<64>(flags & (bit - 1)).count()];
+  };
+  static size_t n_words(size_t length) { return (length + 31) / 32; };
+  /** Make the nucleotides private to this sequence, so they may be changed. */
+  std::vector<uint64_t> &own_words();
+  /** Redraw the ambiguity codes of mapped nucleotides without copying them. */
+  void redraw_ambiguous_patches(std::mt19937 &rng);
+
+  /** A run of positions with the same text that is not one of acgt */
+  struct Exception {
+    size_t start;
+    size_t length;
+    char symbol;
+  };
+  struct Annotation {
+    /** Runs of exceptions, sorted by position. */
+    std::vector<Exception> exceptions;
+    /** Half-open intervals of upper case letters, sorted by position. */
+    std::vector<std::pair<size_t, size_t>> upper_case;
+  };
+  /** Make the annotation private to this sequence, so it may be changed. */
+  Annotation &own_annotation();
+
+  size_t length;
+  bool revcomp;
+  /** The nucleotide indices, 32 per word. */
+  const uint64_t *words;
+  /** Keeps alive the memory that words points into, unless it is owned. */
+  std::shared_ptr<const void> storage;
+  /** The nucleotides if they are held by this sequence or its copies. */
+  std::shared_ptr<std::vector<uint64_t>> owned;
+  /** Words replacing some of those of the mapped memory. */
+  struct Patches {
+    /** One bit per word of the sequence, set for the replaced words. */
+    std::vector<uint64_t> flags;
+    /** The number of replaced words before those of each element of flags. */
+    std::vector<uint32_t> rank;
+    /** The replacing words, sorted by word index. */
+    std::vector<uint64_t> words;
+  };
+  /** The patches of the mapped memory; null if there are none. */
+  std::shared_ptr<const Patches> patches;
+  /** Exceptions and upper case runs, shared with copies of this sequence;
+   * null if there are none. */
+  std::shared_ptr<Annotation> annotation;
+
+  friend struct SequenceCache;
+};
+}
+
+#endif
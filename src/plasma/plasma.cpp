@@ -19,6 +19,8 @@
 #include <fstream>
 #include <set>
 #include <thread>
+#include <numeric>
+#include <omp.h>
 #include "plasma.hpp"
 #include "mask.hpp"
 #include "../aux.hpp"
@@ -30,6 +32,10 @@
 using namespace std;
 
 namespace Seeding {
+/** The suffix array is rebuilt once more than this fraction of the positions
+ * has been masked */
+const double max_masked_fraction = 0.2;
+
 Plasma::Plasma(const Options &opt)
     : options(opt),
       collection(options.paths, options.revcomp, options.n_seq),
@@ -194,8 +200,10 @@ Results Plasma::find_seeds(size_t length, const Objective &objective,
       degeneracies.insert(i);
 
   future<void> rebuilding_done;
-  if (needs_rebuilding and max_degeneracy > 0)
+  if (needs_rebuilding and max_degeneracy > 0) {
     rebuilding_done = rebuild_index();
+    needs_rebuilding = false;
+  }
 
   Results plasma_results;
   if ((algorithm & Algorithm::Plasma) == Algorithm::Plasma)
@@ -229,6 +237,10 @@ Results Plasma::find_seeds(size_t length, const Objective &objective,
       results.push_back(m);
     }
 
+  // the index must not be changed by masking before it is built
+  if (rebuilding_done.valid())
+    rebuilding_done.wait();
+
   return results;
 }
 
@@ -297,34 +309,20 @@ rev_map_t Plasma::determine_initial_candidates(
   const double initial_score = -numeric_limits<double>::infinity();
   max_score = initial_score;
 
-  Timer my_timer;
-  if (options.verbosity >= Verbosity::verbose)
-    cerr << "Starting to get word counts." << endl;
-  hash_map_t word_counts = get_word_counts(collection, length, options);
-  if (options.measure_runtime) {
-    cerr << "Got words for length " + to_string(length) + " in "
-            + time_to_pretty_string(my_timer.tock()) << endl;
-    my_timer.tick();
-  }
-
-  for (auto &iter : word_counts) {
-    if (options.verbosity >= Verbosity::debug)
-      cout << "Candidate " << decode(iter.first) << endl;
-    double score = compute_score(collection, iter.second, options, objective,
-                                 length, degeneracy);
-
+  auto consider = [&](const seq_type &motif, const count_vector_t &counts,
+                      double score) {
     if (options.verbosity >= Verbosity::debug)
       cout << "score = " << score << endl;
     if (score > max_score) {
       max_score = score;
-      best_motif = iter.first;
+      best_motif = motif;
       if (options.verbosity >= Verbosity::debug)
         cout << "motif = " << decode(best_motif) << " score = " << score << " "
-             << vec2string(iter.second) << endl;
+             << vec2string(counts) << endl;
     }
     if (candidates.empty() or score > candidates.rbegin()->first
         or n_candidates < options.plasma.max_candidates) {
-      candidates.insert({score, iter.first});
+      candidates.insert({score, motif});
       n_candidates++;
       if (n_candidates > options.plasma.max_candidates) {
         auto to_erase = prev(end(candidates));
@@ -332,6 +330,52 @@ rev_map_t Plasma::determine_initial_candidates(
         n_candidates--;
       }
     }
+  };
+  // whether a score would change the best motif or the candidates
+  auto relevant = [&](double score) {
+    return score > max_score or candidates.empty()
+           or score > candidates.rbegin()->first
+           or n_candidates < options.plasma.max_candidates;
+  };
+
+  const CompiledObjective compiled_objective(collection, objective, options);
+
+  Timer my_timer;
+  if (options.verbosity >= Verbosity::verbose)
+    cerr << "Starting to get word counts." << endl;
+  if (length <= KmerCounts::max_length) {
+    // words are packed into integers and are only decoded when retained
+    KmerCounts word_counts = count_kmers(collection, length, options);
+    if (options.measure_runtime) {
+      cerr << "Got words for length " + to_string(length) + " in "
+              + time_to_pretty_string(my_timer.tock()) << endl;
+      my_timer.tick();
+    }
+
+    count_vector_t counts(word_counts.n_samples);
+    for (auto word : word_counts.words()) {
+      const KmerCounts::count_t *c = word_counts.counts(word);
+      copy(c, c + word_counts.n_samples, begin(counts));
+      if (options.verbosity >= Verbosity::debug)
+        cout << "Candidate " << decode(word_counts.decode(word)) << endl;
+      double score = compiled_objective(counts, length, degeneracy);
+      if (relevant(score))
+        consider(word_counts.decode(word), counts, score);
+    }
+  } else {
+    hash_map_t word_counts = get_word_counts(collection, length, options);
+    if (options.measure_runtime) {
+      cerr << "Got words for length " + to_string(length) + " in "
+              + time_to_pretty_string(my_timer.tock()) << endl;
+      my_timer.tick();
+    }
+
+    for (auto &iter : word_counts) {
+      if (options.verbosity >= Verbosity::debug)
+        cout << "Candidate " << decode(iter.first) << endl;
+      double score = compiled_objective(iter.second, length, degeneracy);
+      consider(iter.first, iter.second, score);
+    }
   }
 
   if (degeneracies.find(degeneracy) != end(degeneracies)
@@ -409,8 +453,10 @@ Results Plasma::find_plasma(size_t length, const Objective &objective,
   bool best_motif_changed = true;
 
   if (max_degeneracy > 0) {
-    index_rebuilt.wait();
+    if (index_rebuilt.valid())
+      index_rebuilt.wait();
 
+    const CompiledObjective compiled_objective(collection, objective, options);
     Timer my_timer;
     while ((not candidates.empty()) and degeneracy < max_degeneracy) {
       degeneracy++;
@@ -455,16 +501,26 @@ Results Plasma::find_plasma(size_t length, const Objective &objective,
         work.push_back(x);
       const size_t n = work.size();
       vector<double> scores(work.size());
-#pragma omp parallel for
-      for (size_t i = 0; i < n; i++) {
-        auto generalization = work[i]->first;
-        count_vector_t counts;
-        if (options.word_stats)
-          counts = index.word_hits_by_file(generalization, options.revcomp);
-        else
-          counts = index.seq_hits_by_file(generalization, options.revcomp);
-        scores[i] = compute_score(collection, counts, options, objective,
-                                  length, degeneracy);
+      // the generalizations are sorted, so that those sharing prefixes fall
+      // into the same batch, and are searched for together
+      vector<size_t> order(n);
+      iota(begin(order), end(order), 0);
+      sort(begin(order), end(order), [&](size_t a, size_t b) {
+        return work[a]->first < work[b]->first;
+      });
+      const size_t n_batches = min<size_t>(n, 4 * omp_get_max_threads());
+#pragma omp parallel for schedule(dynamic, 1)
+      for (size_t b = 0; b < n_batches; b++) {
+        const size_t first = b * n / n_batches,
+                     last = (b + 1) * n / n_batches;
+        vector<seq_type> batch;
+        for (size_t i = first; i < last; i++)
+          batch.push_back(work[order[i]]->first);
+        auto counts
+            = index.hits_by_file(batch, options.word_stats, options.revcomp);
+        for (size_t i = first; i < last; i++)
+          scores[order[i]]
+              = compiled_objective(counts[i - first], length, degeneracy);
       }
 
       candidates = rev_map_t();
@@ -701,7 +757,12 @@ Results Plasma::find_motifs(const Specification::Motif &motif_spec,
 
 void Plasma::apply_mask(const string &motif) {
   ::Seeding::apply_mask(collection, motif, options);
-  needs_rebuilding = true;
+  // masked occurrences are excluded from matching in the existing index,
+  // unless sequences were removed or too much of the index is masked
+  if (not needs_rebuilding)
+    needs_rebuilding
+        = not index.mask(collection, options.allow_iupac_wildcards)
+          or index.masked_fraction() > max_masked_fraction;
 }
 
 void Plasma::apply_mask(const Result &result) { apply_mask(result.motif); }
@@ -717,8 +778,9 @@ future<void> Plasma::rebuild_index() {
     Timer my_timer;
     if (options.verbosity >= Verbosity::verbose)
       cerr << "Starting building of index." << endl;
-    index = NucleotideIndex<size_t, size_t>(
-        collection, options.allow_iupac_wildcards, options.verbosity);
+    // the new index is moved into place, replacing the old one
+    index = CompactNucleotideIndex(collection, options.allow_iupac_wildcards,
+                                   options.verbosity);
     if (options.measure_runtime)
       cerr << "Built index in " + time_to_pretty_string(my_timer.tock())
            << endl;
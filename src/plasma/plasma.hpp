@@ -45,7 +45,7 @@ public:
 
 private:
   bool needs_rebuilding;
-  NucleotideIndex<size_t, size_t> index;
+  CompactNucleotideIndex index;
 
 public:
   Plasma(const Options &options);
@@ -344,6 +344,173 @@ double compute_score(const Seeding::Contrast &contrast,
   return score;
 }
 
+CompiledObjective::CompiledObjective(const Seeding::Collection &collection,
+                                     const Seeding::Objective &objective,
+                                     const Seeding::Options &options_,
+                                     Measures::Discrete::Measure measure_,
+                                     bool do_correction_)
+    : options(options_),
+      motif_name(objective.motif_name),
+      measure(measure_ == Measures::Discrete::Measure::Undefined
+                  ? objective.measure
+                  : measure_),
+      do_correction(do_correction_),
+      terms() {
+  if (measure == Measures::Discrete::Measure::Undefined)
+    throw Exception::Plasma::UndefinedMeasure();
+  for (auto &expr : objective) {
+    auto contrast_iter = collection.find(expr.contrast);
+    if (contrast_iter == end(collection)) {
+      vector<string> names;
+      for (auto &x : collection)
+        names.push_back(x.name);
+      throw Exception::Plasma::NoContrastForObjective(to_string(expr), names);
+    }
+    Term term;
+    term.contrast = &*contrast_iter;
+    term.sign = expr.sign;
+    term.weight = options.weighting ? contrast_iter->set_size : 1;
+    term.offset = 0;
+    for (auto iter = begin(collection); iter != contrast_iter; ++iter)
+      term.offset += iter->sets.size();
+    term.signal_present = false;
+    term.signal_size = term.control_size = 0;
+    for (auto &dataset : *contrast_iter) {
+      size_t size = options.word_stats ? dataset.seq_size : dataset.set_size;
+      bool signal = find(begin(dataset.motifs), end(dataset.motifs), motif_name)
+                    != end(dataset.motifs);
+      term.sizes.push_back(size);
+      term.signal.push_back(signal);
+      if (signal) {
+        term.signal_size += size;
+        term.signal_present = true;
+      } else
+        term.control_size += size;
+    }
+    terms.push_back(term);
+  }
+}
+
+double CompiledObjective::operator()(const count_vector_t &counts,
+                                     size_t length, size_t degeneracy) const {
+  double score = 0;
+  double W = 0;
+  for (auto &term : terms) {
+    W += term.weight;
+    score += term.sign * term.weight
+             * this->score(term, counts.data() + term.offset, length,
+                           degeneracy);
+  }
+  if (options.weighting)
+    score /= W;
+  return score;
+}
+
+/** The mutual information of the occurrence table with a row per sample and
+ * columns for the number of sequences or positions with and without
+ * occurrences. This follows compute_mutual_information with normalization
+ * step by step, to give identical results, but without forming the table. */
+double CompiledObjective::mutual_information(const Term &term,
+                                             const size_t *counts,
+                                             bool correction) const {
+  const size_t n = term.sizes.size();
+  const double pseudo_count = options.pseudo_count;
+  double z = 0;
+  for (size_t i = 0; i < n; i++) {
+    z += counts[i] + pseudo_count;
+    z += (term.sizes[i] - counts[i]) + pseudo_count;
+  }
+  double cs0 = 0, cs1 = 0;
+  for (size_t i = 0; i < n; i++) {
+    cs0 += (counts[i] + pseudo_count) / z;
+    cs1 += ((term.sizes[i] - counts[i]) + pseudo_count) / z;
+  }
+  cs0 = log(cs0);
+  cs1 = log(cs1);
+
+  double mi = 0;
+  for (size_t i = 0; i < n; i++) {
+    double a = (counts[i] + pseudo_count) / z;
+    double b = ((term.sizes[i] - counts[i]) + pseudo_count) / z;
+    double rs = log(a + b);
+    if (a != 0)
+      mi += a * (log(a) - rs - cs0);
+    if (b != 0)
+      mi += b * (log(b) - rs - cs1);
+  }
+  mi /= log(2.0);
+
+  if (correction)
+    mi += (n - 1) / (z + 1);
+  return mi;
+}
+
+double CompiledObjective::score(const Term &term, const size_t *counts,
+                                size_t length, size_t degeneracy) const {
+  const size_t n = term.sizes.size();
+  if (measure != Measures::Discrete::Measure::SignalFrequency and n < 2)
+    return -std::numeric_limits<double>::infinity();
+
+  double signal_freq = 0, control_freq = 0;
+  for (size_t i = 0; i < n; i++)
+    if (term.signal[i])
+      signal_freq += counts[i];
+    else
+      control_freq += counts[i];
+
+  double signal_rel_freq
+      = term.signal_size > 0 ? signal_freq / term.signal_size : 0;
+  double control_rel_freq
+      = term.control_size > 0 ? control_freq / term.control_size : 0;
+
+  if (not options.no_enrichment_filter and term.signal_present
+      and signal_rel_freq < control_rel_freq)
+    return -std::numeric_limits<double>::infinity();
+
+  switch (measure) {
+    case Measures::Discrete::Measure::MutualInformation:
+      return mutual_information(term, counts, do_correction);
+    case Measures::Discrete::Measure::Gtest:
+    case Measures::Discrete::Measure::LogpGtest:
+    case Measures::Discrete::Measure::CorrectedLogpGtest: {
+      double total = 0;
+      for (size_t i = 0; i < n; i++) {
+        total += counts[i];
+        total += term.sizes[i] - counts[i];
+      }
+      total += n * 2 * options.pseudo_count;
+      double gtest
+          = log(2.0) * 2 * total * mutual_information(term, counts, false);
+      if (measure == Measures::Discrete::Measure::Gtest)
+        return gtest;
+      double logp = -pchisq(gtest, (n - 1) * 1, false, true);
+      if (measure == Measures::Discrete::Measure::LogpGtest)
+        return logp;
+      double log_correction;
+      if (not options.fixed_motif_space_mode)
+        log_correction = compute_correction(length, degeneracy);
+      else
+        log_correction = log(149);
+      return logp - log_correction;
+    }
+    case Measures::Discrete::Measure::MatthewsCorrelationCoefficient:
+      return compute_mcc(signal_freq, term.signal_size - signal_freq,
+                         control_freq, term.control_size - control_freq);
+    case Measures::Discrete::Measure::DeltaFrequency:
+      return signal_rel_freq - control_rel_freq;
+    case Measures::Discrete::Measure::SignalFrequency:
+      return signal_rel_freq;
+    case Measures::Discrete::Measure::ControlFrequency:
+      return control_rel_freq;
+    default: {
+      // measures without a specialized kernel are computed on the table
+      count_vector_t contrast_counts(counts, counts + n);
+      return compute_score(*term.contrast, contrast_counts, options, measure,
+                           length, degeneracy, motif_name, do_correction);
+    }
+  }
+}
+
 namespace Exception {
 namespace Plasma {
 UndefinedMeasure::UndefinedMeasure()
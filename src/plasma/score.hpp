@@ -72,6 +72,54 @@ double compute_score(const Seeding::Contrast &contrast,
                      size_t degeneracy, const std::string &motif_name = "",
                      bool do_correction = false);
 
+/** An objective whose contrasts are resolved in a collection, for scoring the
+ * counts of many motifs.
+ *
+ * The contrasts, the offsets of their samples in the count vectors, and the
+ * partition of the samples into signal and control are determined once, so
+ * that scoring requires neither look-ups nor allocations. The scores are
+ * identical to those of compute_score.
+ */
+class CompiledObjective {
+public:
+  CompiledObjective(const Seeding::Collection &collection,
+                    const Seeding::Objective &objective,
+                    const Seeding::Options &options,
+                    Measures::Discrete::Measure measure
+                    = Measures::Discrete::Measure::Undefined,
+                    bool do_correction = false);
+
+  double operator()(const count_vector_t &counts, size_t length,
+                    size_t degeneracy) const;
+
+private:
+  /** A contrast of the objective's expression */
+  struct Term {
+    const Seeding::Contrast *contrast;
+    int sign;
+    double weight;
+    /** The index of the contrast's first sample in the count vectors */
+    size_t offset;
+    /** The number of sequences or positions of each sample */
+    std::vector<size_t> sizes;
+    /** Whether each sample contains the motif */
+    std::vector<bool> signal;
+    bool signal_present;
+    size_t signal_size, control_size;
+  };
+
+  Seeding::Options options;
+  std::string motif_name;
+  Measures::Discrete::Measure measure;
+  bool do_correction;
+  std::vector<Term> terms;
+
+  double score(const Term &term, const size_t *counts, size_t length,
+               size_t degeneracy) const;
+  double mutual_information(const Term &term, const size_t *counts,
+                            bool correction) const;
+};
+
 double approximate_score(const std::string &motif,
                          const Seeding::hash_map_t &counts,
                          const Seeding::Options &options);
@@ -0,0 +1,270 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sequence_cache.cpp
+ *
+ *    Description:  Memory-mapped binary cache of encoded FASTA files
+ *
+ *        Created:  10/16/2026 04:05:51 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <boost/filesystem.hpp>
+#include "sequence_cache.hpp"
+#include "../aux.hpp"
+
+using namespace std;
+
+namespace Fasta {
+
+string SequenceCache::directory = "";
+
+namespace {
+const char magic[8] = {'D', 'S', 'Q', 'C', 'A', 'C', 'H', 'E'};
+const uint64_t version = 2;
+
+struct Header {
+  char magic[8];
+  uint64_t version;
+  uint64_t source_size;
+  int64_t source_mtime;
+  uint64_t revcomp;
+  uint64_t n_seq;
+  uint64_t n_entries;
+  uint64_t path_length;
+  char sha1[40];
+};
+
+struct Record {
+  uint64_t definition_offset, definition_length;
+  uint64_t length;
+  uint64_t words_offset;
+  uint64_t exceptions_offset, n_exceptions;
+  uint64_t upper_case_offset, n_upper_case;
+};
+
+/** The key of a FASTA file; the cache file name is derived from it. */
+struct Key {
+  Key(const string &path, bool revcomp, size_t n_seq)
+      : path(boost::filesystem::absolute(path).string()),
+        revcomp(revcomp),
+        n_seq(n_seq),
+        size(boost::filesystem::file_size(path)),
+        mtime(boost::filesystem::last_write_time(path)) {}
+  string cache_path() const {
+    string s = path + "\t" + to_string(revcomp) + "\t" + to_string(n_seq);
+    return (boost::filesystem::path(SequenceCache::directory)
+            / (sha1hash(s) + ".seqcache")).string();
+  }
+  bool matches(const Header &header) const {
+    return memcmp(header.magic, magic, sizeof(magic)) == 0
+           and header.version == version and header.source_size == size
+           and header.source_mtime == mtime and header.revcomp == revcomp
+           and header.n_seq == n_seq and header.path_length == path.size();
+  }
+  string path;
+  bool revcomp;
+  size_t n_seq;
+  uint64_t size;
+  int64_t mtime;
+};
+
+/** A read-only mapping of a whole file. */
+struct Mapping {
+  Mapping(const string &path) : data(nullptr), size(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 and st.st_size > 0) {
+      void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        data = static_cast<const char *>(p);
+        size = st.st_size;
+      }
+    }
+    close(fd);
+  }
+  ~Mapping() {
+    if (data != nullptr)
+      munmap(const_cast<char *>(data), size);
+  }
+  const char *data;
+  size_t size;
+};
+
+size_t align(size_t offset) { return (offset + 7) / 8 * 8; }
+}
+
+bool SequenceCache::load(const string &path, bool revcomp, size_t n_seq,
+                         vector<IEntry> &entries, string &sha1) {
+  if (directory.empty())
+    return false;
+  try {
+    const Key key(path, revcomp, n_seq);
+    auto mapping = make_shared<Mapping>(key.cache_path());
+    const char *data = mapping->data;
+    if (data == nullptr or mapping->size < sizeof(Header))
+      return false;
+    Header header;
+    memcpy(&header, data, sizeof(Header));
+    if (not key.matches(header)
+        or align(sizeof(Header) + header.path_length)
+                   + header.n_entries * sizeof(Record) > mapping->size
+        or key.path.compare(0, string::npos, data + sizeof(Header),
+                            header.path_length) != 0)
+      return false;
+
+    const Record *records = reinterpret_cast<const Record *>(
+        data + align(sizeof(Header) + header.path_length));
+    vector<IEntry> loaded(header.n_entries);
+    for (size_t i = 0; i < header.n_entries; i++) {
+      const Record &r = records[i];
+      if (r.upper_case_offset + r.n_upper_case * 16 > mapping->size
+          or r.exceptions_offset + r.n_exceptions * 24 > mapping->size
+          or r.words_offset + PackedSequence::n_words(r.length) * 8
+                 > mapping->size
+          or r.definition_offset + r.definition_length > mapping->size)
+        return false;
+      IEntry &entry = loaded[i];
+      entry.definition.assign(data + r.definition_offset, r.definition_length);
+      PackedSequence &seq = entry.isequence;
+      seq.length = r.length;
+      seq.revcomp = revcomp;
+      seq.words = reinterpret_cast<const uint64_t *>(data + r.words_offset);
+      seq.storage = mapping;
+      seq.owned.reset();
+      seq.patches.reset();
+      seq.annotation.reset();
+      if (r.n_exceptions + r.n_upper_case > 0) {
+        auto &annotation = seq.own_annotation();
+        const uint64_t *exceptions
+            = reinterpret_cast<const uint64_t *>(data + r.exceptions_offset);
+        for (size_t j = 0; j < r.n_exceptions; j++)
+          annotation.exceptions.push_back(
+              {exceptions[3 * j], exceptions[3 * j + 1],
+               static_cast<char>(exceptions[3 * j + 2])});
+        const uint64_t *upper_case
+            = reinterpret_cast<const uint64_t *>(data + r.upper_case_offset);
+        for (size_t j = 0; j < r.n_upper_case; j++)
+          annotation.upper_case.push_back(
+              {upper_case[2 * j], upper_case[2 * j + 1]});
+      }
+    }
+
+    // ambiguity codes get the same random nucleotides as when parsing
+    for (auto &entry : loaded)
+      entry.isequence.redraw_ambiguous(EntropySource::random_nucl_rng);
+
+    sha1.assign(header.sha1, sizeof(header.sha1));
+    for (auto &entry : loaded)
+      entries.push_back(move(entry));
+    return true;
+  } catch (boost::filesystem::filesystem_error &e) {
+    return false;
+  }
+}
+
+void SequenceCache::save(const string &path, bool revcomp, size_t n_seq,
+                         const vector<IEntry> &entries, const string &sha1) {
+  if (directory.empty())
+    return;
+  try {
+    const Key key(path, revcomp, n_seq);
+
+    Header header;
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.source_size = key.size;
+    header.source_mtime = key.mtime;
+    header.revcomp = revcomp;
+    header.n_seq = n_seq;
+    header.n_entries = entries.size();
+    header.path_length = key.path.size();
+    memset(header.sha1, 0, sizeof(header.sha1));
+    memcpy(header.sha1, sha1.data(), min(sha1.size(), sizeof(header.sha1)));
+
+    // lay out the records and the variable-sized data
+    vector<Record> records(entries.size());
+    size_t offset
+        = align(sizeof(Header) + key.path.size()) + entries.size() * sizeof(Record);
+    for (size_t i = 0; i < entries.size(); i++) {
+      const PackedSequence &seq = entries[i].isequence;
+      Record &r = records[i];
+      r.length = seq.length;
+      r.words_offset = offset;
+      offset += PackedSequence::n_words(seq.length) * 8;
+      r.exceptions_offset = offset;
+      r.n_exceptions = seq.annotation ? seq.annotation->exceptions.size() : 0;
+      offset += r.n_exceptions * 24;
+      r.upper_case_offset = offset;
+      r.n_upper_case = seq.annotation ? seq.annotation->upper_case.size() : 0;
+      offset += r.n_upper_case * 16;
+      r.definition_offset = offset;
+      r.definition_length = entries[i].definition.size();
+      offset = align(offset + r.definition_length);
+    }
+
+    boost::filesystem::create_directories(directory);
+    const string cache_path = key.cache_path();
+    const string tmp_path = cache_path + "." + to_string(getpid());
+    try {
+      ofstream ofs(tmp_path, ios::binary);
+      auto write = [&](const void *p, size_t n) {
+        ofs.write(static_cast<const char *>(p), n);
+      };
+      auto pad = [&]() {
+        const char zeros[8] = {0};
+        write(zeros, align(ofs.tellp()) - ofs.tellp());
+      };
+      write(&header, sizeof(Header));
+      write(key.path.data(), key.path.size());
+      pad();
+      write(records.data(), records.size() * sizeof(Record));
+      for (auto &entry : entries) {
+        const PackedSequence &seq = entry.isequence;
+        if (seq.patches)
+          for (size_t j = 0; j < PackedSequence::n_words(seq.length); j++) {
+            const uint64_t w = seq.word(j);
+            write(&w, sizeof(w));
+          }
+        else
+          write(seq.words, PackedSequence::n_words(seq.length) * 8);
+        if (seq.annotation) {
+          for (auto &exception : seq.annotation->exceptions) {
+            const uint64_t x[3] = {exception.start, exception.length,
+                                   uint64_t(exception.symbol)};
+            write(x, sizeof(x));
+          }
+          for (auto &run : seq.annotation->upper_case) {
+            const uint64_t x[2] = {run.first, run.second};
+            write(x, sizeof(x));
+          }
+        }
+        write(entry.definition.data(), entry.definition.size());
+        pad();
+      }
+      if (not ofs)
+        throw runtime_error("writing failed");
+      ofs.close();
+      boost::filesystem::rename(tmp_path, cache_path);
+    } catch (exception &e) {
+      boost::system::error_code ec;
+      boost::filesystem::remove(tmp_path, ec);
+      throw;
+    }
+  } catch (exception &e) {
+    cout << "Warning: could not write the sequence cache for " << path << ": "
+         << e.what() << endl;
+  }
+}
+}
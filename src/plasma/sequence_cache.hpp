@@ -0,0 +1,57 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  sequence_cache.hpp
+ *
+ *    Description:  Memory-mapped binary cache of encoded FASTA files
+ *
+ *        Created:  10/16/2026 04:05:51 PM
+ *         Author:  Jonas Maaskola <jonas@maaskola.de>
+ *
+ * =====================================================================================
+ */
+
+#ifndef SEQUENCE_CACHE_HPP
+#define SEQUENCE_CACHE_HPP
+
+#include <string>
+#include <vector>
+#include "fasta.hpp"
+
+namespace Fasta {
+
+/** Binary cache of encoded FASTA files.
+ *
+ * A cache file holds the definitions, the packed nucleotides and the SHA1 of
+ * the sequences of one FASTA file, read with given settings for the reverse
+ * complement and the number of sequences. It is valid as long as size and
+ * modification time of the FASTA file are unchanged. Cache files are mapped
+ * into memory, and the packed nucleotides of the sequences are used directly
+ * from the mapping without being copied.
+ *
+ * Only the encoded sequences used by the HMMs are cached; for plain entries
+ * loading always fails and saving does nothing.
+ */
+struct SequenceCache {
+  /** Directory of the cache files; caching is disabled if empty. */
+  static std::string directory;
+
+  /** Load the sequences of a FASTA file from the cache. Returns false if
+   * there is no valid cache file. */
+  static bool load(const std::string &path, bool revcomp, size_t n_seq,
+                   std::vector<IEntry> &entries, std::string &sha1);
+  static bool load(const std::string &, bool, size_t, std::vector<Entry> &,
+                   std::string &) {
+    return false;
+  };
+
+  /** Write the sequences of a FASTA file to the cache. Failure to do so is
+   * reported but not an error. */
+  static void save(const std::string &path, bool revcomp, size_t n_seq,
+                   const std::vector<IEntry> &entries, const std::string &sha1);
+  static void save(const std::string &, bool, size_t,
+                   const std::vector<Entry> &, const std::string &){};
+};
+}
+
+#endif
@@ -33,6 +33,7 @@
 #include <iostream>
 #include <cstdlib>
 #include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <stack>
 #include <numeric>
@@ -132,77 +133,126 @@ std::vector<lcp_t> gen_lcp_slow(Iter begin, Iter end,
  *      if h > 0:
  *        h := h-1
  */
-template <class lcp_t, class idx_t, class Iter>
-std::vector<lcp_t> gen_lcp(Iter begin, Iter end, const std::vector<idx_t> &sa,
-                           Verbosity verbosity) {
-  Timer timer;
+/** The LCP values of the suffix array, as determined by the algorithm of
+ * Kasai et al; store(rank, value) is called for the ranks 1 to n-1 */
+template <class idx_t, class Iter, class Store>
+void kasai_lcp(Iter begin, Iter end, const std::vector<idx_t> &sa,
+               Store store) {
   idx_t n = std::distance(begin, end);
-  std::vector<idx_t> lcp(n), rank(n);
+  std::vector<idx_t> rank(n);
   for (idx_t i = 0; i < n; i++)
     rank[sa[i]] = i;
   idx_t h = 0;
   for (idx_t i = 0; i < n; i++)
     if (rank[i] > 0) {
       idx_t j = sa[rank[i] - 1];
-      while (*(begin + i + h) == *(begin + j + h))
+      while (i + h < n and j + h < n and *(begin + i + h) == *(begin + j + h))
         h++;
-      lcp[rank[i]] = h;
+      store(rank[i], h);
       if (h > 0)
         h--;
     }
+}
+
+template <class lcp_t, class idx_t, class Iter>
+std::vector<lcp_t> gen_lcp(Iter begin, Iter end, const std::vector<idx_t> &sa,
+                           Verbosity verbosity) {
+  Timer timer;
+  std::vector<lcp_t> lcp(std::distance(begin, end), 0);
+  kasai_lcp(begin, end, sa, [&lcp](idx_t rank, idx_t h) { lcp[rank] = h; });
   double time = timer.tock();
   if (verbosity >= Verbosity::verbose)
     std::cerr << "Built LCP in " + time_to_pretty_string(time) << std::endl;
   return lcp;
 }
 
-// TODO use more efficient algorithm (although so far this is not a bottle-neck)
+/** An LCP table using a byte per entry. The rare values that do not fit are
+ * kept in a table of overflows, sorted by rank. */
+template <class idx_t>
+class CompactLCP {
+public:
+  using value_type = idx_t;
+
+  CompactLCP(idx_t n = 0) : bytes(n, 0), overflows(){};
+
+  template <class Iter>
+  CompactLCP(Iter begin, Iter end, const std::vector<idx_t> &sa,
+             Verbosity verbosity)
+      : bytes(std::distance(begin, end), 0), overflows() {
+    Timer timer;
+    kasai_lcp(begin, end, sa, [this](idx_t rank, idx_t h) {
+      if (h < saturated)
+        bytes[rank] = h;
+      else {
+        bytes[rank] = saturated;
+        overflows.push_back({rank, h});
+      }
+    });
+    std::sort(overflows.begin(), overflows.end());
+    double time = timer.tock();
+    if (verbosity >= Verbosity::verbose)
+      std::cerr << "Built LCP in " + time_to_pretty_string(time) << std::endl;
+  };
+
+  idx_t size() const { return bytes.size(); };
+
+  idx_t operator[](idx_t rank) const {
+    if (bytes[rank] < saturated)
+      return bytes[rank];
+    return std::lower_bound(overflows.begin(), overflows.end(),
+                            std::make_pair(rank, idx_t(0)))->second;
+  };
+
+private:
+  static const uint8_t saturated = 255;
+  std::vector<uint8_t> bytes;
+  std::vector<std::pair<idx_t, idx_t>> overflows;
+};
+
+/** Construct an LCP table of the given type */
+template <class lcp_t, class idx_t, class Iter>
+void gen_lcp(Iter begin, Iter end, const std::vector<idx_t> &sa,
+             Verbosity verbosity, std::vector<lcp_t> &lcp) {
+  lcp = gen_lcp<lcp_t>(begin, end, sa, verbosity);
+}
+
+template <class idx_t, class Iter>
+void gen_lcp(Iter begin, Iter end, const std::vector<idx_t> &sa,
+             Verbosity verbosity, CompactLCP<idx_t> &lcp) {
+  lcp = CompactLCP<idx_t>(begin, end, sa, verbosity);
+}
+
+/** Construct the JMP table in linear time: jmp[i] is the next suffix whose
+ * LCP is at most lcp[i], or n if there is none. The suffixes whose successor
+ * has not yet been found are kept on a stack, with increasing LCP values.
+ */
 // TODO another thought should be spent on the definition of the jmp pointer;
 // right now it's defined to be the next suffix with lcp <= to the current;
 // perhaps it might be helpful to use strictly less instead.
-template <class idx_t, class lcp_t>
-std::vector<idx_t> gen_jmp(const std::vector<lcp_t> &lcp, Verbosity verbosity) {
+template <class idx_t, class LCP>
+std::vector<idx_t> gen_jmp(const LCP &lcp, Verbosity verbosity) {
   Timer timer;
   idx_t n = lcp.size();
-  std::vector<idx_t> jmp(n);
+  std::vector<idx_t> jmp(n, n);
+  std::stack<std::pair<idx_t, idx_t>> s;
   for (idx_t i = 0; i < n; i++) {
-    jmp[i] = i + 1;
-    size_t j = i + 1;
-    while (j < n and lcp[j++] > lcp[i])
-      jmp[i]++;
-  }
-  double time = timer.tock();
-  if (verbosity >= Verbosity::verbose)
-    std::cerr << "Built JMP in " + time_to_pretty_string(time) << std::endl;
-  return jmp;
-}
-
-template <class idx_t, class lcp_t>
-std::vector<idx_t> gen_jmp_var(const std::vector<lcp_t> &lcp) {
-  idx_t n = lcp.size();
-  std::vector<idx_t> jmp(n);
-
-  std::stack<std::pair<idx_t, lcp_t>> s;
-  s.push(std::make_pair(0, 0));
-  for (idx_t i = 1; i < n; i++) {
-    while (lcp[i] < s.top().second) {
+    const idx_t l = lcp[i];
+    while (not s.empty() and l <= s.top().second) {
       jmp[s.top().first] = i;
       s.pop();
     }
-    s.push(std::make_pair(i, lcp[i]));
-  }
-  while (not s.empty()) {
-    jmp[s.top().first] = n;
-    s.pop();
+    s.push(std::make_pair(i, l));
   }
+  double time = timer.tock();
+  if (verbosity >= Verbosity::verbose)
+    std::cerr << "Built JMP in " + time_to_pretty_string(time) << std::endl;
   return jmp;
 }
 
-template <class lcp_t, class idx_t, class Iter,
+template <class LCP, class idx_t, class Iter,
           typename Cmp = std::equal_to<typename Iter::value_type>>
 std::vector<idx_t> match(Iter qbegin, Iter qend, Iter begin, Iter end,
-                         const std::vector<idx_t> &sa,
-                         const std::vector<lcp_t> &lcp,
+                         const std::vector<idx_t> &sa, const LCP &lcp,
                          const std::vector<idx_t> &jmp, Cmp cmp = Cmp()) {
   Timer timer;
   const bool do_debug = false;
@@ -219,7 +269,7 @@ std::vector<idx_t> match(Iter qbegin, Iter qend, Iter begin, Iter end,
     // invariant: lcp[i] > length of current match
     // consequence: there is always at least one character to match
     jmp_stack.push(jmp[i]);
-    lcp_t j = lcp[i];
+    idx_t j = lcp[i];
     auto q = qbegin + j;
     auto t = begin + sa[i] + j;
     if (do_debug)
@@ -275,4 +325,84 @@ std::vector<idx_t> match(Iter qbegin, Iter qend, Iter begin, Iter end,
   return hits;
 }
 
+/** Descend from an interval of the suffix array whose suffixes share the
+ * first depth symbols with a range of queries, see match_batch. */
+template <class LCP, class idx_t, class Iter, class QIter, class Cmp,
+          class Report>
+void match_batch_descend(QIter qbegin, QIter qfirst, QIter qlast,
+                         size_t depth, idx_t first, idx_t last, Iter begin,
+                         idx_t n, const std::vector<idx_t> &sa, const LCP &lcp,
+                         const std::vector<idx_t> &jmp, Cmp cmp,
+                         Report &report) {
+  // queries that are matched completely by the suffixes of the interval
+  while (qfirst != qlast and qfirst->size() == depth) {
+    report(std::distance(qbegin, qfirst), first, last);
+    ++qfirst;
+  }
+  if (qfirst == qlast)
+    return;
+
+  // few suffixes are compared with the remaining queries directly
+  const idx_t max_direct = 16;
+  if (last - first <= max_direct) {
+    for (QIter q = qfirst; q != qlast; ++q)
+      for (idx_t k = first; k < last; k++) {
+        const idx_t pos = sa[k];
+        size_t i = depth;
+        while (i < q->size() and pos + i < n
+               and cmp(*(begin + pos + i), (*q)[i]))
+          i++;
+        if (i == q->size())
+          report(std::distance(qbegin, q), k, k + 1);
+      }
+    return;
+  }
+
+  // a suffix that ends at this depth precedes the others
+  idx_t k = first;
+  if (sa[k] + depth >= n)
+    k++;
+
+  // the suffixes are grouped by their symbol at this depth; the group of
+  // suffix k extends up to the next suffix sharing at most depth symbols with
+  // its predecessor, which is found following the JMP pointers
+  while (k < last) {
+    const auto s = *(begin + sa[k] + depth);
+    idx_t next = k + 1;
+    while (next < last and lcp[next] > depth)
+      next = jmp[next];
+    if (next > last)
+      next = last;
+    // the queries are grouped by their symbol at this depth
+    for (QIter q = qfirst; q != qlast;) {
+      const auto x = (*q)[depth];
+      QIter r = q;
+      while (r != qlast and (*r)[depth] == x)
+        ++r;
+      if (cmp(s, x))
+        match_batch_descend(qbegin, q, r, depth + 1, k, next, begin, n, sa,
+                            lcp, jmp, cmp, report);
+      q = r;
+    }
+    k = next;
+  }
+}
+
+/** Find the occurrences of several queries in one traversal of the suffix
+ * array. The queries have to be sorted, so that those sharing a prefix are
+ * adjacent, and the prefix is matched only once. The occurrences are not
+ * collected; instead, for each query and each interval [first, last) of the
+ * suffix array whose suffixes begin with a match, report(query, first, last)
+ * is called, where query is the index of the query.
+ */
+template <class LCP, class idx_t, class Iter, class Query, class Cmp,
+          class Report>
+void match_batch(const std::vector<Query> &queries, Iter begin, Iter end,
+                 const std::vector<idx_t> &sa, const LCP &lcp,
+                 const std::vector<idx_t> &jmp, Cmp cmp, Report report) {
+  const idx_t n = std::distance(begin, end);
+  match_batch_descend(queries.begin(), queries.begin(), queries.end(), 0,
+                      idx_t(0), n, begin, n, sa, lcp, jmp, cmp, report);
+}
+
 #endif
@@ -0,0 +1,55 @@
+#define BOOST_TEST_MODULE count
+#include <boost/test/unit_test.hpp>
+#include <omp.h>
+#include <random>
+#include "count.hpp"
+#include "test_data.hpp"
+
+using namespace std;
+using namespace Seeding;
+
+// Check that the packed word counts agree with the word counts of the
+// hash map of encoded words, for short words counted in a shared array and
+// longer ones counted in per-thread hash tables, on random sequences that
+// contain ambiguity codes, the letter u, and upper case letters.
+
+BOOST_AUTO_TEST_CASE(packed_counts_match_word_counts) {
+  // use several threads even on a single core, to exercise the merging
+  omp_set_num_threads(4);
+
+  mt19937 rng(11);
+  const Collection collection = random_collection(
+      rng, 2, 2, 40, 300, "acgtACGTnNu", {10, 10, 10, 10, 3, 3, 3, 3, 1, 1, 1});
+
+  Options options;
+  options.verbosity = Verbosity::error;
+  options.measure_runtime = false;
+
+  for (bool revcomp : {false, true})
+    for (bool word_stats : {false, true})
+      for (size_t length : {1, 2, 5, 8, 12, 13, 16, 20}) {
+        options.revcomp = revcomp;
+        options.word_stats = word_stats;
+        const hash_map_t expected = get_word_counts(collection, length, options);
+        const KmerCounts counts = count_kmers(collection, length, options);
+        const vector<kmer_t> words = counts.words();
+
+        bool ok = words.size() == expected.size();
+        for (auto word : words) {
+          auto iter = expected.find(counts.decode(word));
+          if (iter == end(expected)) {
+            ok = false;
+            break;
+          }
+          const KmerCounts::count_t *c = counts.counts(word);
+          for (size_t s = 0; s < counts.n_samples; s++)
+            if (c[s] != iter->second[s])
+              ok = false;
+        }
+        BOOST_CHECK_MESSAGE(ok, "Counts differ for length "
+                                    << length << " revcomp = " << revcomp
+                                    << " word_stats = " << word_stats << ": "
+                                    << words.size() << " words instead of "
+                                    << expected.size() << ".");
+      }
+}
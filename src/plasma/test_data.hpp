@@ -0,0 +1,48 @@
+#ifndef TEST_DATA_HPP
+#define TEST_DATA_HPP
+
+#include <random>
+#include <string>
+#include <vector>
+#include "data.hpp"
+
+/** Random sequences for the test programs: n_contrasts contrasts with n_sets
+ * sets of n_seqs sequences each. The lengths are drawn uniformly from 0 to
+ * max_length, and the letters from symbols with the given weights. */
+inline Seeding::Collection random_collection(std::mt19937 &rng,
+                                             size_t n_contrasts, size_t n_sets,
+                                             size_t n_seqs, size_t max_length,
+                                             const std::string &symbols,
+                                             const std::vector<double> &weights) {
+  std::discrete_distribution<size_t> symbol_dist(weights.begin(),
+                                                 weights.end());
+  std::uniform_int_distribution<size_t> length_dist(0, max_length);
+  Data::Basic::Collection<Seeding::Contrast> collection;
+  for (size_t c = 0; c < n_contrasts; c++) {
+    Seeding::Contrast contrast;
+    contrast.name = "contrast" + std::to_string(c);
+    for (size_t s = 0; s < n_sets; s++) {
+      Seeding::Set set;
+      set.path = contrast.name + "_set" + std::to_string(s);
+      for (size_t i = 0; i < n_seqs; i++) {
+        Fasta::Entry entry;
+        entry.definition = "seq" + std::to_string(i);
+        const size_t n = length_dist(rng);
+        for (size_t j = 0; j < n; j++)
+          entry.sequence += symbols[symbol_dist(rng)];
+        set.seq_size += n;
+        set.sequences.push_back(entry);
+      }
+      set.set_size = set.sequences.size();
+      contrast.seq_size += set.seq_size;
+      contrast.set_size += set.set_size;
+      contrast.sets.push_back(set);
+    }
+    collection.seq_size += contrast.seq_size;
+    collection.set_size += contrast.set_size;
+    collection.contrasts.push_back(contrast);
+  }
+  return collection;
+}
+
+#endif
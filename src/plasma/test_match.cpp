@@ -0,0 +1,116 @@
+#define BOOST_TEST_MODULE match
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <random>
+#include "align.hpp"
+#include "test_data.hpp"
+
+using namespace std;
+using namespace Seeding;
+
+// Check that matching a sorted batch of queries in one traversal of the suffix
+// array finds the same occurrences as matching each query on its own, both
+// for the raw suffix array positions and for the counts by file. The random
+// collections consist of many short sequences, so that the sequence markers of
+// the collapsed collection are frequent, and the queries include degenerate
+// words, palindromes, duplicates, and prefixes of each other.
+
+const string nucleotides = "acgt";
+const string iupac = "acgtacgtacgtmrwsykvhdbn";
+
+vector<seq_type> random_queries(mt19937 &rng) {
+  vector<string> queries;
+  for (size_t rep = 0; rep < 10; rep++) {
+    // variants of a common word, some of them truncated
+    const size_t length = 1 + rng() % 8;
+    string base;
+    for (size_t i = 0; i < length; i++)
+      base += iupac[rng() % iupac.size()];
+    for (size_t j = 0; j < 20; j++) {
+      string query = base;
+      for (size_t m = 0; m < 2; m++)
+        query[rng() % length] = iupac[rng() % iupac.size()];
+      if (rng() % 4 == 0)
+        query = query.substr(0, 1 + rng() % length);
+      queries.push_back(query);
+    }
+    // a palindrome, i.e. a word that equals its reverse complement
+    string half;
+    for (size_t i = 0; i < 1 + rng() % 4; i++)
+      half += nucleotides[rng() % 4];
+    string palindrome = half;
+    for (auto iter = half.rbegin(); iter != half.rend(); iter++)
+      palindrome += nucleotides[3 - nucleotides.find(*iter)];
+    queries.push_back(palindrome);
+  }
+  // a duplicate
+  queries.push_back(queries.front());
+
+  vector<seq_type> encoded;
+  for (auto &query : queries)
+    encoded.push_back(encode(query));
+  return encoded;
+}
+
+BOOST_AUTO_TEST_CASE(batch_matches_single_queries) {
+  mt19937 rng(5);
+
+  for (size_t trial = 0; trial < 10; trial++) {
+    const Collection collection
+        = random_collection(rng, 1, 3, 50, 60, "acgtn", {10, 10, 10, 10, 1});
+    vector<seq_type> queries = random_queries(rng);
+
+    for (bool wildcards : {false, true}) {
+      // raw occurrences in the suffix array
+      SequenceRanks pos2seq;
+      vector<size_t> seq2set, set2contrast;
+      const Index<seq_type, uint32_t, CompactLCP<uint32_t>, true> index(
+          collapse_collection(collection, pos2seq, seq2set, set2contrast,
+                              wildcards),
+          Verbosity::error);
+
+      vector<seq_type> sorted = queries;
+      sort(begin(sorted), end(sorted));
+      vector<vector<uint32_t>> batch(sorted.size());
+      index.find_matches(sorted, [&](size_t q, uint32_t first, uint32_t last) {
+        for (uint32_t k = first; k < last; k++)
+          batch[q].push_back(index.position(k));
+      }, binary_and_not_null<symbol_t>);
+
+      for (size_t q = 0; q < sorted.size(); q++) {
+        vector<uint32_t> single
+            = index.find_matches(sorted[q], binary_and_not_null<symbol_t>);
+        sort(begin(single), end(single));
+        sort(begin(batch[q]), end(batch[q]));
+        BOOST_CHECK_MESSAGE(single == batch[q],
+                            "Positions of " << decode(sorted[q])
+                                            << " differ with wildcards = "
+                                            << wildcards << ": "
+                                            << single.size() << " single vs "
+                                            << batch[q].size() << " batch.");
+      }
+
+      // counts by file, with and without reverse complements
+      const NucleotideIndex<uint32_t> nucleotide_index(collection, wildcards,
+                                                       Verbosity::error);
+      for (bool revcomp : {false, true})
+        for (bool word_stats : {false, true}) {
+          auto counts
+              = nucleotide_index.hits_by_file(queries, word_stats, revcomp);
+          for (size_t q = 0; q < queries.size(); q++) {
+            auto expected
+                = word_stats
+                      ? nucleotide_index.word_hits_by_file(queries[q], revcomp)
+                      : nucleotide_index.seq_hits_by_file(queries[q], revcomp);
+            BOOST_CHECK_MESSAGE(
+                counts[q] == expected,
+                "Counts of " << decode(queries[q]) << " differ with wildcards = "
+                             << wildcards << " revcomp = " << revcomp
+                             << " word_stats = " << word_stats << ": "
+                             << vec2string(expected) << " single vs "
+                             << vec2string(counts[q]) << " batch.");
+          }
+        }
+    }
+  }
+}
@@ -0,0 +1,96 @@
+#define BOOST_TEST_MODULE suffix
+#include <boost/test/unit_test.hpp>
+#include <random>
+#include <type_traits>
+#include "align.hpp"
+
+using namespace std;
+
+// Check the tables of the suffix array index against direct constructions:
+// the LCP table by the algorithm of Kasai et al, also in its compact form with
+// values of 255 and more, against pairwise comparison of adjacent suffixes,
+// the stack-based JMP table against a quadratic scan, and the sampled
+// sequence ranks against an explicit table.
+
+// rebuilding the index of Plasma has to move it instead of copying it
+static_assert(is_nothrow_move_constructible<NucleotideIndex<uint32_t>>::value
+                  and is_nothrow_move_assignable<CompactNucleotideIndex>::value,
+              "Nucleotide indices have to be movable.");
+
+/** The JMP table by its definition: the next suffix whose LCP is at most that
+ * of the current one, or n if there is none. */
+vector<uint32_t> quadratic_jmp(const vector<size_t> &lcp) {
+  const uint32_t n = lcp.size();
+  vector<uint32_t> jmp(n, n);
+  for (uint32_t i = 0; i < n; i++)
+    for (uint32_t j = i + 1; j < n; j++)
+      if (lcp[j] <= lcp[i]) {
+        jmp[i] = j;
+        break;
+      }
+  return jmp;
+}
+
+BOOST_AUTO_TEST_CASE(lcp_and_jmp_tables) {
+  mt19937 rng(1);
+
+  const size_t n_tables = 200;
+  size_t max_lcp = 0;
+  for (size_t rep = 0; rep < n_tables; rep++) {
+    // small alphabets and repeats give long common prefixes
+    const size_t length = 1 + rng() % 2000;
+    const size_t alphabet = 1 + rng() % 4;
+    seq_type data(length);
+    for (auto &x : data)
+      x = 1 + rng() % alphabet;
+    if (rep % 4 == 0 and length > 700) {
+      const size_t repeat = 300 + rng() % 300;
+      copy(data.begin(), data.begin() + repeat, data.end() - repeat);
+    }
+
+    const vector<uint32_t> sa = gen_suffix_array<false, uint32_t>(
+        data.begin(), data.end(), Verbosity::error);
+    const vector<size_t> lcp
+        = gen_lcp<size_t>(data.begin(), data.end(), sa, Verbosity::error);
+    const vector<size_t> slow = gen_lcp_slow<size_t>(
+        data.begin(), data.end(),
+        vector<uint32_t>(sa.begin(), sa.begin() + length), Verbosity::error);
+    const CompactLCP<uint32_t> compact(data.begin(), data.end(), sa,
+                                       Verbosity::error);
+
+    bool ok = lcp.size() == length and compact.size() == length;
+    for (size_t i = 0; ok and i < length; i++) {
+      max_lcp = max(max_lcp, slow[i]);
+      if (lcp[i] != slow[i] or compact[i] != slow[i])
+        ok = false;
+    }
+    BOOST_CHECK_MESSAGE(ok, "LCP table " << rep << " differs.");
+    BOOST_CHECK_MESSAGE(
+        gen_jmp<uint32_t>(lcp, Verbosity::error) == quadratic_jmp(lcp)
+            and gen_jmp<uint32_t>(compact, Verbosity::error)
+                    == quadratic_jmp(lcp),
+        "JMP table " << rep << " differs.");
+  }
+  BOOST_CHECK_MESSAGE(max_lcp >= 255, "No LCP value exceeds a byte.");
+}
+
+BOOST_AUTO_TEST_CASE(sequence_ranks) {
+  mt19937 rng(2);
+
+  for (size_t rep = 0; rep < 100; rep++) {
+    // both sequences shorter and longer than the sampling interval
+    SequenceRanks ranks;
+    vector<size_t> expected;
+    const size_t n_seqs = 1 + rng() % 50;
+    for (size_t s = 0; s < n_seqs; s++) {
+      const size_t length = 1 + rng() % (rng() % 2 ? 5 : 300);
+      ranks.add(length);
+      expected.resize(expected.size() + length, s);
+    }
+    bool ok = ranks.size() == expected.size();
+    for (size_t pos = 0; ok and pos < expected.size(); pos++)
+      if (ranks[pos] != expected[pos])
+        ok = false;
+    BOOST_CHECK_MESSAGE(ok, "Sequence ranks " << rep << " differ.");
+  }
+}